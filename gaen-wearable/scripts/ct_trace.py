@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+#
+# This file is part of the Contact Tracing / GAEN Wearable distribution
+#        https://github.com/Sendrato/gaen-wearable.
+#
+# Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+#                    Hessel van der Molen  (https://sendrato.com/)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License along
+# with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+#
+
+"""Decode the binary event trace of the wearable (CONFIG_CT_TRACE).
+
+Input are the hex-encoded notifications on `GET_TRACE` or on a `BATCH` of
+`GET_TRACE` commands, one notification per line. Use `--request` to compose
+such a batch.
+
+    ct_trace.py --request 0 8         # BATCH reading 8 responses from seq 0
+    ct_trace.py trace.txt             # decode captured notifications
+"""
+
+import argparse
+import struct
+import sys
+
+CMD_BATCH = 0x08
+CMD_GET_TRACE = 0x42
+CMD_MASK_OK = 0x80
+CMD_MASK_ERR = 0x40
+
+# Records per GET_TRACE response, see CMD_TRACE_RECS in ct_app_enc.c
+TRACE_RECS = 2
+# struct ct_trace_rec_t in ct_trace.h
+REC = struct.Struct('<IBBHI')
+
+# enum ct_event_t in ct.h
+EVENTS = {1: 'START', 2: 'STOP', 66: 'ADV', 67: 'SCAN'}
+
+
+def s8(v):
+    return v - 0x100 if v & 0x80 else v
+
+
+def s16(v):
+    return v - 0x10000 if v & 0x8000 else v
+
+
+def evt_rpi(a8, a16, a32):
+    rpi = struct.pack('<I', a32).hex().upper()
+    return 'rssi %d dBm, rpi %s.., db %d' % (s8(a8), rpi, s16(a16))
+
+
+def evt_state(a8, a16, a32):
+    return '%s @ ival %d' % (EVENTS.get(a8, a8), a32)
+
+
+def evt_rpi_read(a8, a16, a32):
+    return 'read %d, len %d, cursor %d' % (a8, a16, a32)
+
+
+def evt_batt(a8, a16, a32):
+    return '%d mV (median %d mV, filtered %d mV)' % (a16, a32 >> 16,
+                                                     a32 & 0xFFFF)
+
+
+# enum ct_trace_evt_t in ct_trace.h
+DECODERS = {
+    1: ('EN_RPI', evt_rpi),
+    2: ('EN_STATE', evt_state),
+    3: ('ENC_RPI_READ', evt_rpi_read),
+    4: ('BATT', evt_batt),
+}
+
+
+def request(seq, n):
+    """Compose a BATCH of 'n' GET_TRACE commands, starting at 'seq'."""
+    out = bytes([CMD_BATCH])
+    for i in range(n):
+        out += bytes([CMD_GET_TRACE, 4]) + struct.pack('<I',
+                                                       seq + i * TRACE_RECS)
+    return out
+
+
+def responses(data):
+    """Yield the values of (batched) GET_TRACE responses in a notification."""
+    if data[0] == CMD_GET_TRACE | CMD_MASK_OK:
+        yield data[1:]
+    elif data[0] & ~(CMD_MASK_OK | CMD_MASK_ERR) == CMD_BATCH:
+        i = 1
+        while i + 2 <= len(data):
+            cmd, n = data[i], data[i + 1]
+            if cmd == CMD_GET_TRACE | CMD_MASK_OK:
+                yield data[i + 2:i + 2 + n]
+            i += 2 + n
+    else:
+        print('# skipped: %s' % data.hex(), file=sys.stderr)
+
+
+def decode(lines):
+    records = {}
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        data = bytes.fromhex(line.replace(':', ' '))
+        for value in responses(data):
+            seq = struct.unpack_from('<I', value)[0]
+            for i in range((len(value) - 4) // REC.size):
+                records[seq + i] = REC.unpack_from(value, 4 + i * REC.size)
+
+    prev = None
+    for seq in sorted(records):
+        if prev is not None and seq != prev + 1:
+            print('# %d records lost' % (seq - prev - 1))
+        prev = seq
+        time, evt, a8, a16, a32 = records[seq]
+        name, fn = DECODERS.get(evt, ('EVT_%d' % evt, None))
+        args = fn(a8, a16, a32) if fn else '%02X %04X %08X' % (a8, a16, a32)
+        print('%8d %10.3f %-12s %s' % (seq, time / 1000.0, name, args))
+    if prev is not None:
+        print('# next: %d' % (prev + 1))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('file', nargs='?', help='notifications (default stdin)')
+    parser.add_argument('--request', nargs=2, type=int, metavar=('SEQ', 'N'),
+                        help='compose BATCH of N GET_TRACE commands from SEQ')
+    args = parser.parse_args()
+
+    if args.request:
+        print(request(*args.request).hex())
+    elif args.file:
+        with open(args.file) as f:
+            decode(f)
+    else:
+        decode(sys.stdin)
+
+
+if __name__ == '__main__':
+    main()
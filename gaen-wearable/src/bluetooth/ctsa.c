@@ -44,6 +44,8 @@ LOG_MODULE_REGISTER(bt_ctsa, LOG_LEVEL_INF);
 
 static uint8_t _ct[10];
 static uint8_t _ct_update;
+static bt_gatt_ctsa_set_cb_t _ct_set_cb;
+static bt_gatt_ctsa_get_cb_t _ct_get_cb;
 
 static void ct_ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
 {
@@ -85,6 +87,10 @@ static ssize_t write_ct(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 
     _ct_update = 1U;
 
+    if (_ct_set_cb) {
+        _ct_set_cb(&ts);
+    }
+
     return len;
 }
 
@@ -145,7 +151,11 @@ void bt_gatt_ctsa_now2buf(uint8_t *buf)
     struct timespec ts;
     struct tm now_tm;
 
-    clock_gettime(CLOCK_REALTIME, &ts);
+    if (_ct_get_cb) {
+        _ct_get_cb(&ts);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &ts);
+    }
     gmtime_r(&ts.tv_sec, &now_tm);
 
     year = sys_cpu_to_le16(now_tm.tm_year);
@@ -175,6 +185,16 @@ void bt_gatt_ctsa_now2buf(uint8_t *buf)
     LOG_DBG(" >> time: %lld", ts.tv_sec);
 }
 
+void bt_gatt_ctsa_set_callback(bt_gatt_ctsa_set_cb_t cb)
+{
+    _ct_set_cb = cb;
+}
+
+void bt_gatt_ctsa_get_callback(bt_gatt_ctsa_get_cb_t cb)
+{
+    _ct_get_cb = cb;
+}
+
 int bt_gatt_ctsa_init(void)
 {
     return 0;
@@ -28,6 +28,30 @@
 #include <posix/time.h>
 #include <posix/sys/time.h>
 
+/**
+ * @brief Callback, called after the clock has been set by a BLE Central.
+ * @param [in] ts : time to which the clock has been set.
+ */
+typedef void (*bt_gatt_ctsa_set_cb_t)(const struct timespec *ts);
+
+/**
+ * @brief Register a callback for clock updates by a BLE Central.
+ * @param [in] cb : callback, NULL to unregister.
+ */
+void bt_gatt_ctsa_set_callback(bt_gatt_ctsa_set_cb_t cb);
+
+/**
+ * @brief Callback, called to retrieve the time served to a BLE Central.
+ * @param [out] ts : current time.
+ */
+typedef void (*bt_gatt_ctsa_get_cb_t)(struct timespec *ts);
+
+/**
+ * @brief Register the source of the time served to a BLE Central.
+ * @param [in] cb : callback, NULL to serve CLOCK_REALTIME.
+ */
+void bt_gatt_ctsa_get_callback(bt_gatt_ctsa_get_cb_t cb);
+
 /**
  * @brief Notify a connected BLE Central with a clock-update
  */
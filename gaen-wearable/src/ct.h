@@ -105,6 +105,267 @@
  */
 #define CT_DEFAULT_BT_SCAN_WINDOW  48
 
+/**
+ * @def CT_SCHED_DUTY_MIN
+ * @brief Lower bound of the adaptive scan duty-cycle in permille.
+ *
+ * The CT_SCHED_xx bounds of the adaptive scan scheduler are configured with
+ * the CONFIG_CT_SCHED_xx Kconfig options.
+ *
+ * The scheduler backs off to this duty-cycle when no contacts are observed.
+ */
+#define CT_SCHED_DUTY_MIN  CONFIG_CT_SCHED_DUTY_MIN
+
+/**
+ * @def CT_SCHED_DUTY_MAX
+ * @brief Upper bound of the adaptive scan duty-cycle in permille.
+ *
+ * The scheduler boosts up to this duty-cycle while new RPIs are observed.
+ * Should not exceed 500 (equal scan and advertisement period).
+ */
+#define CT_SCHED_DUTY_MAX  CONFIG_CT_SCHED_DUTY_MAX
+
+/**
+ * @def CT_SCHED_ADV_PERIOD_MAX
+ * @brief Upper bound of the adaptive advertisement period in milliseconds.
+ */
+#define CT_SCHED_ADV_PERIOD_MAX  CONFIG_CT_SCHED_ADV_PERIOD_MAX
+
+/**
+ * @def CT_SCHED_SCAN_PERIOD_MAX
+ * @brief Upper bound of the adaptive scan period in milliseconds.
+ */
+#define CT_SCHED_SCAN_PERIOD_MAX  CONFIG_CT_SCHED_SCAN_PERIOD_MAX
+
+/**
+ * @def CT_SCHED_SCAN_IVAL_MIN
+ * @brief Lower bound of the adaptive scan interval in steps of 0.625ms.
+ *
+ * The scan interval is halved when new RPIs are observed, opening the scan
+ * window more often. The interval never drops below the scan window.
+ */
+#define CT_SCHED_SCAN_IVAL_MIN  CONFIG_CT_SCHED_SCAN_IVAL_MIN
+
+/**
+ * @def CT_SCHED_SCAN_IVAL_MAX
+ * @brief Upper bound of the adaptive scan interval in steps of 0.625ms.
+ *
+ * The scan interval is stretched when backing off, reducing the radio-on time
+ * of a scan period. A bound below the nominal scan interval is raised to the
+ * nominal interval.
+ */
+#define CT_SCHED_SCAN_IVAL_MAX  CONFIG_CT_SCHED_SCAN_IVAL_MAX
+
+/**
+ * @def CT_SCHED_IDLE_SCANS
+ * @brief Number of consecutive empty scan periods before backing off.
+ */
+#define CT_SCHED_IDLE_SCANS  CONFIG_CT_SCHED_IDLE_SCANS
+
+/**
+ * @def CT_SCHED_DENSE_RPIS
+ * @brief Number of new RPIs in a scan period indicating a crowded area.
+ *
+ * In a crowded area, the scan window is extended to the full scan interval.
+ */
+#define CT_SCHED_DENSE_RPIS  CONFIG_CT_SCHED_DENSE_RPIS
+
+/**
+ * @def CT_SCHED_BATT_LOW
+ * @brief Battery level [%] below which the scan duty-cycle is throttled.
+ *
+ * When throttled, the duty-cycle is limited to half the nominal duty-cycle and
+ * the scan window is halved.
+ */
+#define CT_SCHED_BATT_LOW  CONFIG_CT_SCHED_BATT_LOW
+
+/**
+ * @def CT_EN_THREAD_STACK_SIZE
+ * @brief Stack size of the thread driving the GAEN application.
+ */
+#define CT_EN_THREAD_STACK_SIZE  2048
+
+/**
+ * @def CT_EN_THREAD_PRIO
+ * @brief Priority of the thread driving the GAEN application.
+ *
+ * Cooperative and above the system workqueue (-1), so GAEN phase transitions
+ * are not delayed by settings, flash or UI work.
+ */
+#define CT_EN_THREAD_PRIO  (-2)
+
+/**
+ * @def CT_EN_BATT_PERIOD
+ * @brief Interval [in seconds] in which the GAEN application samples the battery.
+ */
+#define CT_EN_BATT_PERIOD  60
+
+/**
+ * @def CT_ENERGY_IDLE_UA
+ * @brief Base current [uA] of the system, applied over the full uptime.
+ *
+ * The CT_ENERGY_*_UA currents are used to estimate the consumed charge
+ * (see ct_energy.h). The defaults are typical values of an nRF52832 with
+ * DC/DC converter at 3V and an SPI NOR flash; calibrate for the actual
+ * hardware.
+ */
+#define CT_ENERGY_IDLE_UA  5
+
+/**
+ * @def CT_ENERGY_ADV_UA
+ * @brief Average additional current [uA] during an EN advertisement period.
+ */
+#define CT_ENERGY_ADV_UA  50
+
+/**
+ * @def CT_ENERGY_SCAN_UA
+ * @brief Additional current [uA] while a scan window is open (radio RX).
+ */
+#define CT_ENERGY_SCAN_UA  6000
+
+/**
+ * @def CT_ENERGY_ENC_UA
+ * @brief Average additional current [uA] during an EN-Config session.
+ */
+#define CT_ENERGY_ENC_UA  300
+
+/**
+ * @def CT_ENERGY_FLASH_UA
+ * @brief Additional current [uA] during a flash operation.
+ */
+#define CT_ENERGY_FLASH_UA  4000
+
+/**
+ * @def CT_ENERGY_ADC_UA
+ * @brief Additional current [uA] during an ADC sample.
+ */
+#define CT_ENERGY_ADC_UA  1000
+
+/**
+ * @def CT_BATT_EMPTY_LEVEL
+ * @brief Battery level [%] below which the battery is considered empty.
+ */
+#define CT_BATT_EMPTY_LEVEL  5
+
+/**
+ * @def CT_BATT_EMPTY_CNT
+ * @brief Number of consecutive battery samples below CT_BATT_EMPTY_LEVEL
+ *        before CT_EVENT_BATTERY_EMPTY is signalled.
+ */
+#define CT_BATT_EMPTY_CNT  3
+
+/**
+ * @def CT_BATT_EMPTY_HYST
+ * @brief Hysteresis [%] on CT_BATT_EMPTY_LEVEL.
+ *
+ * CT_EVENT_BATTERY_EMPTY is signalled once, and only signalled again after the
+ * battery level recovered to CT_BATT_EMPTY_LEVEL + CT_BATT_EMPTY_HYST.
+ */
+#define CT_BATT_EMPTY_HYST  3
+
+/**
+ * @def CT_EN_CONCURRENT_ADV_FACTOR
+ * @brief Multiplier of the GAEN advertisement period during EN-Config.
+ *
+ * When EN keeps running while EN-Config is active (CONFIG_CT_EN_CONCURRENT),
+ * the advertisement period is extended with this factor. This reduces the
+ * number of scan periods while a BLE Central is being served.
+ */
+#define CT_EN_CONCURRENT_ADV_FACTOR  3
+
+/**
+ * @def CT_ENC_CONN_IVAL
+ * @brief Connection interval requested by EN-Config when EN keeps running.
+ *
+ * Specified according to the Bluetooth Specification in steps of 1.25ms.
+ * The GAEN scan interval is aligned to the connection interval in use, which
+ * is this one when accepted by the central, and the scan window covers half
+ * of it, leaving room for one connection event per scan interval.
+ * Default value: 48 * 1.25 = 60 [ms]
+ */
+#define CT_ENC_CONN_IVAL  48
+
+/**
+ * @def CT_TIME_EPOCH_MIN
+ * @brief Lowest valid wall-clock time [seconds since epoch].
+ *
+ * GAEN heavily depends on a correct time. The correct value is unknown, but it
+ * is at least after 01-Jan-2020, 00:00.
+ */
+#define CT_TIME_EPOCH_MIN  1577836800
+
+/**
+ * @def CT_TIME_RETAIN_PERIOD
+ * @brief Interval [in seconds] in which the time is kept in retained RAM.
+ *
+ * After a reset with retained RAM, the clock is restored with an error of at
+ * most this period (plus the duration of the reset).
+ */
+#define CT_TIME_RETAIN_PERIOD  10
+
+/**
+ * @def CT_TIME_CHECKPOINT_PERIOD
+ * @brief Interval [in seconds] in which the time is stored in NVM.
+ *
+ * After a power loss the clock is restored from this checkpoint. The clock is
+ * then behind by the time the wearable was without power.
+ */
+#define CT_TIME_CHECKPOINT_PERIOD  3600
+
+/**
+ * @def CT_TIME_ERROR_PPM
+ * @brief Rate [ppm] at which the error bound of the clock grows.
+ *
+ * Crystal tolerance over temperature and ageing, the drift compensation is
+ * not relied upon.
+ */
+#define CT_TIME_ERROR_PPM  50
+
+/**
+ * @def CT_TIME_ERROR_MAX
+ * @brief Largest error bound [in seconds] with which GAEN uses the clock.
+ *
+ * Beyond this bound (or after a restore from NVM) EN is paused until the clock
+ * is synced. Default: 1 minute, i.e. 2 weeks without sync at 50 ppm.
+ */
+#define CT_TIME_ERROR_MAX  60
+
+/**
+ * @def CT_TIME_DRIFT_PAIRS
+ * @brief Number of clock synchronisations used to estimate the clock drift.
+ *
+ * Upon every CTS write the pair (uptime, CTS time) is recorded. The drift is
+ * estimated with a linear fit over the last pairs since boot.
+ */
+#define CT_TIME_DRIFT_PAIRS  8
+
+/**
+ * @def CT_TIME_DRIFT_MIN_SPAN
+ * @brief Minimum duration [in seconds] covered by the recorded pairs before
+ *        the drift is estimated.
+ *
+ * CTS has a resolution of 1 second, so the span should be long enough to
+ * observe the drift. Default: 1 day (20 ppm = 1.7 seconds).
+ */
+#define CT_TIME_DRIFT_MIN_SPAN  86400
+
+/**
+ * @def CT_TIME_DRIFT_MAX_PPM
+ * @brief Maximum accepted clock drift [ppm].
+ *
+ * Estimates exceeding this value (e.g. due to a wrongly set clock) are
+ * discarded.
+ */
+#define CT_TIME_DRIFT_MAX_PPM  250
+
+/**
+ * @def CT_TRACE_RECORDS
+ * @brief Number of records in the binary event trace (CONFIG_CT_TRACE).
+ *
+ * Each record takes 12 bytes of RAM.
+ */
+#define CT_TRACE_RECORDS  128
+
 /**
  * @def CT_DEFAULT_TEK_IVAL
  * @brief TEK Rolling Interval
@@ -117,6 +378,91 @@
  */
 #define CT_DEFAULT_TEK_PERIOD  144
 
+/**
+ * @def CT_ATT_BUCKETS
+ * @brief Number of attenuation buckets kept per RPI.
+ *
+ * Observations of an RPI are counted per attenuation bucket, similar to the
+ * exposure windows of GAEN v2. The buckets are separated by
+ * CT_ATT_BUCKETS - 1 ascending thresholds.
+ */
+#define CT_ATT_BUCKETS  4
+
+/**
+ * @def CT_DEFAULT_ATT_THRESHOLDS
+ * @brief Attenuation thresholds [dB] separating the attenuation buckets.
+ *
+ * Attenuation is computed relative to a transmit power of 0 dBm, i.e.
+ * attenuation = -RSSI. Thresholds are inclusive for the higher bucket.
+ */
+#define CT_DEFAULT_ATT_THRESHOLDS  ((const uint8_t[]){ 55, 63, 70 })
+
+/**
+ * @def CT_DB_ENC_RSSI_DIFF
+ * @brief Maximum RSSI difference [dB] between linked RPIs of an encounter.
+ *
+ * With CONFIG_CT_DB_ENCOUNTERS, a new RPI is linked to an ongoing encounter
+ * when its RSSI is within this range of the typical RSSI of the previous RPI
+ * of the encounter.
+ */
+#define CT_DB_ENC_RSSI_DIFF  6
+
+/**
+ * @def CT_DB_ENC_IVAL_GAP
+ * @brief Maximum number of intervals between an encounter and a linked RPI.
+ *
+ * A new RPI is only linked to an encounter of which the previous RPI was
+ * last observed in the current interval or up to this number of intervals
+ * ago, before the new RPI appeared.
+ */
+#define CT_DB_ENC_IVAL_GAP  1
+
+/**
+ * @def CT_DB_ENC_IVAL_MAX
+ * @brief Maximum duration [in intervals] of an encounter.
+ *
+ * Once this duration is exceeded, a following RPI starts a new encounter.
+ * Default value: 6 * 10 = 60 [minutes].
+ */
+#define CT_DB_ENC_IVAL_MAX  6
+
+/**
+ * @def CT_DB_SCRUB_SECTORS
+ * @brief Number of flash sectors verified per EN advertisement period
+ *        (CONFIG_CT_DB_SCRUB).
+ *
+ * Sectors are verified by a work item at the lowest application priority.
+ * With a full flash of 256 sectors, a complete pass takes 256 advertisement
+ * periods.
+ */
+#define CT_DB_SCRUB_SECTORS  1
+
+/**
+ * @def CT_DB_SCRUB_STACK_SIZE
+ * @brief Stack size of the work queue verifying the flash (CONFIG_CT_DB_SCRUB).
+ */
+#define CT_DB_SCRUB_STACK_SIZE  1024
+
+/**
+ * @def CT_DB_QUARANTINE_MAX
+ * @brief Maximum number of quarantined flash sectors.
+ *
+ * Beyond this number, the RPIs of a bad sector are still removed from the
+ * database, but the sector is reused, as systematic errors should not shrink
+ * the database.
+ */
+#define CT_DB_QUARANTINE_MAX  16
+
+/**
+ * @def CT_DB_RETAIN_PERIODS
+ * @brief Number of TEK rolling periods for which RPIs are kept in flash.
+ *
+ * Flash sectors holding only older RPIs are dropped from the database at the
+ * next interval, and are erased when they are reused. 14 periods of 144
+ * intervals match the 14 day retention of GAEN. 0 disables retention.
+ */
+#define CT_DB_RETAIN_PERIODS  14
+
 // GAEN data-size definitions
 #define TEK_SIZE      16
 #define RPIK_SIZE     16
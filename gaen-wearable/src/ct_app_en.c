@@ -24,6 +24,9 @@
 
 #include <sys/printk.h>
 #include <sys/util.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <devicetree.h>
 
 #include <time.h>
 #include <posix/time.h>
@@ -35,12 +38,20 @@
 #include <bluetooth/uuid.h>
 #include <bluetooth/gatt.h>
 
+#if defined(CONFIG_CPU_CORTEX_M)
+#include <arch/arm/aarch32/cortex_m/cmsis.h>
+#endif
+
 #include "ct.h"
 #include "ct_app_en.h"
 #include "ct_app_state.h"
 #include "ct_settings.h"
 #include "ct_db.h"
+#include "ct_time.h"
+#include "ct_trace.h"
 #include "ct_crypto.h"
+#include "ct_sched.h"
+#include "ct_energy.h"
 
 #include "battery.h"
 
@@ -48,15 +59,24 @@
 
 LOG_MODULE_REGISTER(app_en, LOG_LEVEL_INF);
 
-// App states and worker queue
+// App state
 static app_state_t _en_state = APP_STATE_UNDEF; // active/stopped indicator
-static struct k_delayed_work _en_state_work;
-// setup&start en_app worker
-static void app_en_state_start(struct k_work *work);
+// EN runs next to ENC (reduced rate)
+static bool _en_concurrent = false;
+// Connection interval of ENC in 1.25ms steps, 0 when ENC is not connected
+static uint16_t _en_conn_ival;
+// Log every received RPI
+static bool _en_debug = false;
+// Scan-period results, reported to the scheduler
+static bool _en_scan_pending = false;
+static uint32_t _en_scan_rpi_cnt;
+static uint16_t _en_scan_contacts;
+// setup&start en_app
+static void app_en_state_start(void);
 // run adv-period and schedule scan-period
-static void app_en_state_adv(struct k_work *work);
+static void app_en_state_adv(void);
 // start scan-period and schedule adv-period.
-static void app_en_state_scan(struct k_work *work);
+static void app_en_state_scan(void);
 
 /************* BT PARAMS ***************/
 
@@ -155,119 +175,730 @@ static void en_aem_update(void)
     metadata[2] = 0x00; // reserved
     metadata[3] = 0x00; // reserved
 
-    // AEM calculation adjusts "RPI", as this is used as counter.
-    // ==> Copy RPI to ensure this update will not propagate through this FW
-    uint8_t rpi_ctr[RPI_SIZE];
-    memcpy(rpi_ctr,_en_key_rpi,RPI_SIZE);
-    ct_crypto_calc_aem(_en_key_aemk, rpi_ctr, metadata, _en_key_aem);
+    // The RPI is used as counter, but is not modified by the AEM calculation.
+    ct_crypto_calc_aem(_en_key_aemk, _en_key_rpi, metadata, _en_key_aem);
+}
+
+// GAEN advertisement: Service Data - 16 bit UUID (0xFD6F) + RPI + AEM
+#define EN_AD_SVC_LEN   (1 + 2 + RPI_SIZE + AEM_SIZE)
+// Smallest advertisement which can hold the GAEN service data
+#define EN_AD_MIN_LEN   (1 + EN_AD_SVC_LEN)
+
+// Locate the GAEN service data in an advertisement.
+// => walks the AD structures in place, without copying or consuming data.
+// => returns pointer to RPI (followed by AEM) or NULL when not a GAEN frame.
+static const uint8_t *en_adv_parse(const uint8_t *data, uint16_t len)
+{
+    uint16_t i = 0;
+
+    if (len < EN_AD_MIN_LEN) {
+        return NULL;
+    }
+
+    // Each AD structure: [len][type][payload (len - 1 bytes)]
+    while ((i + EN_AD_MIN_LEN) <= len) {
+        uint8_t ad_len = data[i];
+
+        if ((ad_len == 0U) || ((i + 1 + ad_len) > len)) {
+            return NULL;
+        }
+
+        if ((ad_len == EN_AD_SVC_LEN) &&
+                (data[i + 1] == BT_DATA_SVC_DATA16) &&
+                (data[i + 2] == 0x6F) && (data[i + 3] == 0xFD)) {
+            return &data[i + 4];
+        }
+
+        i += 1 + ad_len;
+    }
+
+    return NULL;
+}
+
+static void en_bt_rpi_log(const bt_addr_le_t *addr, int8_t rssi,
+            const uint8_t *rpi)
+{
+    char rpi_str[80];
+    char le_addr[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(addr, le_addr, sizeof(le_addr));
+
+    memset(rpi_str, 0, sizeof(rpi_str));
+    for(int i = 0; i<20; i++) {
+        snprintf(&rpi_str[i*3], sizeof(rpi_str) - i*3, " %02X", rpi[i]);
+    }
+    LOG_INF("\tCT RPI %s @ %i [dB] from %s", log_strdup(rpi_str),
+                    rssi, log_strdup(le_addr));
+}
+
+#if defined(CONFIG_CT_EN_CROWD_BENCH)
+// Distinct RPIs (first 4 bytes) received since boot, with the scan period in
+//  which they were last received. Open addressing at a load of at most 50%,
+//  scan period 0 marks a free slot.
+#define EN_CROWD_SLOTS  (2 * CONFIG_CT_EN_CROWD_RPIS)
+
+static struct {
+    uint32_t rpi;
+    uint16_t scan;
+} _en_crowd_rpis[EN_CROWD_SLOTS];
+static uint16_t _en_crowd_rpi_cnt;
+
+// Sightings of RPIs which did not fit in _en_crowd_rpis since boot. The
+//  number of distinct RPIs, and so the duplicates, are unknown when non-zero.
+static uint32_t _en_crowd_overflow;
+
+// Processing time of a GAEN advertisement. The system clock of the nRF52 is
+//  the 32 kHz RTC, too coarse for a single advertisement, so use the cycle
+//  counter of the CPU when available.
+#if defined(CONFIG_ARMV7_M_ARMV8_M_MAINLINE) && \
+        DT_NODE_HAS_PROP(DT_PATH(cpus, cpu_0), clock_frequency)
+#define EN_CROWD_DWT
+#define EN_CROWD_CPU_HZ         DT_PROP(DT_PATH(cpus, cpu_0), clock_frequency)
+#define en_crowd_cycles()       (DWT->CYCCNT)
+#define en_crowd_cyc_to_ns(c)   ((uint64_t)(c) * 1000000000ULL / EN_CROWD_CPU_HZ)
+#else
+#define en_crowd_cycles()       k_cycle_get_32()
+#define en_crowd_cyc_to_ns(c)   k_cyc_to_ns_floor64(c)
+#endif
+
+// Results of the current scan period
+static struct {
+    uint16_t scan;          // scan period number
+    uint16_t seen;          // distinct RPIs received
+    uint32_t sightings;     // received GAEN advertisements
+    uint32_t enomem;        // RPIs dropped on a full database
+    uint64_t cycles;        // cycles spent in en_bt_scan_cb
+    uint32_t cycles_max;
+} _en_crowd;
+
+static void en_crowd_sighting(const uint8_t *rpi, int ret, uint32_t cycles)
+{
+    uint32_t key = sys_get_le32(rpi);
+
+    _en_crowd.sightings++;
+    _en_crowd.cycles    += cycles;
+    _en_crowd.cycles_max = MAX(_en_crowd.cycles_max, cycles);
+    if (ret == -ENOMEM) {
+        _en_crowd.enomem++;
+    }
+
+    // Fibonacci hash, mapped onto the slots by the upper bits of the product.
+    uint32_t i = ((uint64_t)(key * 2654435769U) * EN_CROWD_SLOTS) >> 32;
+
+    while ((_en_crowd_rpis[i].scan != 0) && (_en_crowd_rpis[i].rpi != key)) {
+        i = (i + 1 < EN_CROWD_SLOTS) ? (i + 1) : 0;
+    }
+
+    if (_en_crowd_rpis[i].scan == 0) {
+        if (_en_crowd_rpi_cnt == CONFIG_CT_EN_CROWD_RPIS) {
+            _en_crowd_overflow++;
+            return;
+        }
+        _en_crowd_rpi_cnt++;
+        _en_crowd_rpis[i].rpi = key;
+    } else if (_en_crowd_rpis[i].scan == _en_crowd.scan) {
+        return;
+    }
+
+    _en_crowd_rpis[i].scan = _en_crowd.scan;
+    _en_crowd.seen++;
 }
 
+// Report results of a scan period. Each RPI ideally takes a single record, so
+//  records exceeding the number of distinct RPIs are duplicates. This only
+//  holds while all RPIs are tracked, i.e. overflow is 0.
+static void en_crowd_report(void)
+{
+    uint32_t records;
+    ct_db_rpi_get_cnt(&records);
+
+    uint32_t avg = (_en_crowd.sightings > 0) ?
+                        (uint32_t)(_en_crowd.cycles / _en_crowd.sightings) : 0;
+
+    LOG_INF("crowd: scan %u seen %u sightings %u rpis %u records %u dup %d "
+                    "overflow %u enomem %u cb %u/%u ns", _en_crowd.scan,
+                    _en_crowd.seen, _en_crowd.sightings, _en_crowd_rpi_cnt,
+                    records, (int)records - _en_crowd_rpi_cnt,
+                    _en_crowd_overflow, _en_crowd.enomem,
+                    (uint32_t)en_crowd_cyc_to_ns(avg),
+                    (uint32_t)en_crowd_cyc_to_ns(_en_crowd.cycles_max));
+
+    uint16_t scan = _en_crowd.scan + 1;
+    memset(&_en_crowd, 0, sizeof(_en_crowd));
+    _en_crowd.scan = scan;
+}
+
+// Crowds start with an unset clock, use a common time so EN starts directly.
+static void en_crowd_init(void)
+{
+    if (ct_time_get_source() == CT_TIME_NONE) {
+        struct timespec ts = { .tv_sec = CT_TIME_EPOCH_MIN, .tv_nsec = 0 };
+        ct_time_set(&ts);
+    }
+
+    // scan period 0 marks free slots of _en_crowd_rpis.
+    _en_crowd.scan = 1;
+
+#if defined(EN_CROWD_DWT)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+#endif
+
 static void en_bt_scan_cb(const bt_addr_le_t *addr, int8_t rssi,
             uint8_t adv_type, struct net_buf_simple *ad)
 {
     int ret;
-    char rpi_str[80];
+#if defined(CONFIG_CT_EN_CROWD_BENCH)
+    uint32_t cycles = en_crowd_cycles();
+#endif
 
     if (adv_type != BT_GAP_ADV_TYPE_ADV_NONCONN_IND) {
         return;
     }
 
-    while (ad->len > 1) {
-        uint8_t len = net_buf_simple_pull_u8(ad);
-        uint8_t type;
+    const uint8_t *rpi = en_adv_parse(ad->data, ad->len);
+    if (rpi == NULL) {
+        return;
+    }
 
-        // Check for early termination
-        if (len == 0U) {
-            LOG_DBG("AD len = 0");
-            return;
+    if (_en_debug) {
+        en_bt_rpi_log(addr, rssi, rpi);
+    }
+
+    _en_scan_contacts++;
+
+    // insert RPI into database
+    ret = ct_db_rpi_add((uint8_t *)rpi, (uint8_t *)&rpi[RPI_SIZE], rssi,
+                ct_crypto_intervalNumber_now());
+    ct_trace(CT_TRACE_EN_RPI, (uint8_t) rssi, (uint16_t) ret,
+                sys_get_le32(rpi));
+    if (ret == -ENOMEM) {
+        ct_app_event(CT_APP_EN, CT_EVENT_ENOMEM);
+    }
+
+#if defined(CONFIG_CT_EN_CROWD_BENCH)
+    en_crowd_sighting(rpi, ret, en_crowd_cycles() - cycles);
+#endif
+}
+
+#if defined(CONFIG_CT_EN_PARSER_BENCH)
+// Captured advertisement mix of a busy environment.
+static const uint8_t _en_bench_gaen[] = {
+    0x02, 0x01, 0x1A, 0x03, 0x03, 0x6F, 0xFD,
+    0x17, 0x16, 0x6F, 0xFD,
+    0x9A, 0x2B, 0x51, 0x07, 0xC4, 0x3E, 0x88, 0x10,
+    0x6D, 0xF2, 0x25, 0xB9, 0x41, 0x0C, 0xE7, 0x73,
+    0x5A, 0x40, 0x11, 0x8E };
+// GAEN without flags (as sent by some phones)
+static const uint8_t _en_bench_gaen_noflags[] = {
+    0x03, 0x03, 0x6F, 0xFD,
+    0x17, 0x16, 0x6F, 0xFD,
+    0x31, 0xD5, 0x0A, 0x7C, 0x92, 0x4F, 0xE0, 0x1B,
+    0x66, 0xAF, 0x38, 0xC1, 0x05, 0x5E, 0xBA, 0x27,
+    0x40, 0x00, 0x9C, 0x13 };
+// iBeacon
+static const uint8_t _en_bench_ibeacon[] = {
+    0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+    0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2,
+    0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+    0x00, 0x01, 0x00, 0x02, 0xC5 };
+// Eddystone-URL
+static const uint8_t _en_bench_eddystone[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE,
+    0x0F, 0x16, 0xAA, 0xFE, 0x10, 0xEB, 0x03,
+    'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x07, 0x00 };
+// Manufacturer data (short)
+static const uint8_t _en_bench_manuf[] = {
+    0x02, 0x01, 0x06, 0x07, 0xFF, 0x06, 0x00, 0x01, 0x09, 0x20, 0x02 };
+// Malformed (length exceeds frame)
+static const uint8_t _en_bench_malformed[] = {
+    0x02, 0x01, 0x1A, 0x1E, 0x16, 0x6F, 0xFD, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00 };
+
+#define EN_BENCH_FRAME(_f) { _f, sizeof(_f) }
+
+// Relative frequency of frames: mostly non-GAEN beacons.
+static const struct {
+    const uint8_t *data;
+    uint16_t len;
+} _en_bench_mix[] = {
+    EN_BENCH_FRAME(_en_bench_ibeacon),
+    EN_BENCH_FRAME(_en_bench_manuf),
+    EN_BENCH_FRAME(_en_bench_eddystone),
+    EN_BENCH_FRAME(_en_bench_gaen),
+    EN_BENCH_FRAME(_en_bench_ibeacon),
+    EN_BENCH_FRAME(_en_bench_manuf),
+    EN_BENCH_FRAME(_en_bench_malformed),
+    EN_BENCH_FRAME(_en_bench_gaen_noflags),
+};
+
+#define EN_BENCH_ROUNDS  1000
+
+static void en_adv_parse_bench(void)
+{
+    uint32_t found = 0;
+    uint32_t start = k_cycle_get_32();
+
+    for (int r = 0; r < EN_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < ARRAY_SIZE(_en_bench_mix); i++) {
+            if (en_adv_parse(_en_bench_mix[i].data,
+                        _en_bench_mix[i].len) != NULL) {
+                found++;
+            }
         }
+    }
 
-        if (len > ad->len) {
-            LOG_DBG("AD malformed");
-            return;
+    uint32_t cycles = k_cycle_get_32() - start;
+    uint32_t frames = EN_BENCH_ROUNDS * ARRAY_SIZE(_en_bench_mix);
+
+    LOG_INF("ADV parser: %u frames, %u GAEN, %u ns/frame", frames, found,
+                    (uint32_t)(k_cyc_to_ns_floor64(cycles) / frames));
+}
+#endif
+
+/************* EN_APP ADVERTISEMENT ***************/
+
+// Advertising is running, or paused for a battery sample.
+static bool _en_bt_adv_active;
+static bool _en_bt_adv_paused;
+
+// Legacy rotation: stop advertising, update address and data, restart.
+static void en_bt_adv_rotate_legacy(void)
+{
+    int err;
+
+    // Stop advertising so we can update all parameters
+    err = bt_le_adv_stop();
+    if (err) {
+        LOG_ERR("Advertising failed to stop (err %d)", err);
+    }
+
+    // reset BLE ID
+    bt_id_reset(_en_bt_adv_param.id, NULL, NULL);
+
+    // Force the usage of the identity address.
+    //  This address will change every time `bt_le_adv_start` is called.
+    _en_bt_adv_param.options      = (BT_LE_ADV_OPT_USE_IDENTITY);
+
+    // Update ADV interval.
+    _en_bt_adv_param.interval_min = ct_priv.adv_ival_min;
+    _en_bt_adv_param.interval_max = ct_priv.adv_ival_max;
+
+    // Start advertising
+    // ==> will generate a new mac address for the advertisement!
+    err = bt_le_adv_start(&_en_bt_adv_param, _en_bt_ad,
+                    ARRAY_SIZE(_en_bt_ad), NULL, 0);
+    if (err) {
+        LOG_ERR("Advertising failed to start (err %d)", err);
+    }
+    _en_bt_adv_active = (err == 0);
+}
+
+#if defined(CONFIG_CT_EN_EXT_ADV)
+// Two advertising sets are used alternately: the next set is prepared with a
+//  fresh non-resolvable private address and the new RPI/AEM while the active
+//  set keeps advertising. The old set is stopped before the new one starts,
+//  so two RPIs (and addresses) are never on air together and cannot be linked.
+//  Only the start of the prepared set remains in the (short) gap.
+static struct bt_le_ext_adv *_en_bt_adv_set[2];
+static uint8_t _en_bt_adv_idx;
+// Advertising sets are not available => use legacy rotation.
+static bool _en_bt_adv_legacy = false;
+
+static int en_bt_adv_rotate_ext(void)
+{
+    int err;
+    uint8_t next = _en_bt_adv_idx ^ 1;
+
+    // Non-connectable, no identity-address => new NRPA upon each (re)config.
+    struct bt_le_adv_param param = {
+        .id           = _en_bt_adv_param.id,
+        .options      = BT_LE_ADV_OPT_NONE,
+        .interval_min = ct_priv.adv_ival_min,
+        .interval_max = ct_priv.adv_ival_max,
+    };
+
+    if (_en_bt_adv_set[next] == NULL) {
+        err = bt_le_ext_adv_create(&param, NULL, &_en_bt_adv_set[next]);
+    } else {
+        err = bt_le_ext_adv_update_param(_en_bt_adv_set[next], &param);
+    }
+    if (err) {
+        return err;
+    }
+
+    err = bt_le_ext_adv_set_data(_en_bt_adv_set[next], _en_bt_ad,
+                    ARRAY_SIZE(_en_bt_ad), NULL, 0);
+    if (err) {
+        return err;
+    }
+
+    // New set is prepared ==> stop old set before the new one goes on air.
+    if (_en_bt_adv_set[_en_bt_adv_idx] != NULL) {
+        err = bt_le_ext_adv_stop(_en_bt_adv_set[_en_bt_adv_idx]);
+        if (err) {
+            return err;
         }
+    }
+    _en_bt_adv_idx = next;
 
-        type = net_buf_simple_pull_u8(ad);
+    err = bt_le_ext_adv_start(_en_bt_adv_set[next],
+                    BT_LE_EXT_ADV_START_DEFAULT);
+    if (err) {
+        return err;
+    }
 
-        if (type == BT_DATA_UUID16_ALL) {
-            if(ad->data[0] == 0x6F && ad->data[1] == 0xfd) {
-                LOG_INF("\tCT Service");
-            }
-        } else if (type == BT_DATA_SVC_DATA16) {
-            if(ad->data[0] == 0x6F && ad->data[1] == 0xfd) {
+    return 0;
+}
+#endif
+
+// Advertise the current RPI and AEM with a new address.
+static void en_bt_adv_rotate(void)
+{
+    for(int i = 0; i< RPI_SIZE; i++) {
+        _en_bt_service_data[i+2] = _en_key_rpi[i];
+    }
 
-                char le_addr[BT_ADDR_LE_STR_LEN];
-                bt_addr_le_to_str(addr, le_addr, sizeof(le_addr));
+    for(int i = 0; i< AEM_SIZE; i++) {
+        _en_bt_service_data[i+2+RPI_SIZE] = _en_key_aem[i];
+    }
 
-                memset(rpi_str, 0, sizeof(rpi_str));
-                for(int i = 0; i<20; i++) {
-                    snprintf(&rpi_str[i*3], sizeof(rpi_str) - i*3,
-                                " %02X", ad->data[i+2]);
-                }
-                LOG_INF("\tCT RPI %s @ %i [dB] from %s", log_strdup(rpi_str),
-                                rssi, log_strdup(le_addr));
-
-                // insert RPI into database
-                ret = ct_db_rpi_add(&ad->data[2], &ad->data[2+RPI_SIZE], rssi,
-                            ct_crypto_intervalNumber_now());
-                if (ret == ENOMEM) {
-                    ct_app_event(CT_APP_EN, CT_EVENT_ENOMEM);
-                }
+    // A rotation restarts advertising, also when paused.
+    _en_bt_adv_paused = false;
+
+#if defined(CONFIG_CT_EN_EXT_ADV)
+    if (!_en_bt_adv_legacy) {
+        int err = en_bt_adv_rotate_ext();
+        if (err == 0) {
+            _en_bt_adv_active = true;
+            return;
+        }
+        LOG_WRN("Advertising set rotation failed (err %d), use legacy", err);
+        _en_bt_adv_legacy = true;
+        for (int i = 0; i < ARRAY_SIZE(_en_bt_adv_set); i++) {
+            if (_en_bt_adv_set[i] != NULL) {
+                bt_le_ext_adv_stop(_en_bt_adv_set[i]);
+                bt_le_ext_adv_delete(_en_bt_adv_set[i]);
+                _en_bt_adv_set[i] = NULL;
             }
         }
-
-        net_buf_simple_pull(ad, len - 1);
     }
+#endif
+
+    en_bt_adv_rotate_legacy();
 }
 
-/************* EN_APP STATES ***************/
+// Stop all EN advertisements.
+static void en_bt_adv_stop(void)
+{
+#if defined(CONFIG_CT_EN_EXT_ADV)
+    for (int i = 0; i < ARRAY_SIZE(_en_bt_adv_set); i++) {
+        if (_en_bt_adv_set[i] != NULL) {
+            bt_le_ext_adv_stop(_en_bt_adv_set[i]);
+        }
+    }
+#endif
+    bt_le_adv_stop();
+    _en_bt_adv_active = false;
+    _en_bt_adv_paused = false;
+}
 
-static void app_en_state_start(struct k_work *work)
+// Pause the running advertisement, keeping its address and payload.
+static void en_bt_adv_pause(void)
 {
-    LOG_DBG("state: START");
-    ct_app_event(CT_APP_EN, CT_EVENT_START);
+    if (!_en_bt_adv_active || _en_bt_adv_paused) {
+        return;
+    }
 
-    // Stop all BT activity
+#if defined(CONFIG_CT_EN_EXT_ADV)
+    if (!_en_bt_adv_legacy) {
+        bt_le_ext_adv_stop(_en_bt_adv_set[_en_bt_adv_idx]);
+        _en_bt_adv_paused = true;
+        return;
+    }
+#endif
     bt_le_adv_stop();
-    bt_le_scan_stop();
+    _en_bt_adv_paused = true;
+}
 
-    // Setup advertisment data
-    APP_STATE_NOW_WQ(app_en_state_adv);
+// Resume a paused advertisement with the same address and payload.
+// => legacy: the identity is only reset upon rotation, so restarting with
+//    the same parameters keeps the address.
+static void en_bt_adv_resume(void)
+{
+    int err;
+
+    if (!_en_bt_adv_paused) {
+        return;
+    }
+    _en_bt_adv_paused = false;
+
+#if defined(CONFIG_CT_EN_EXT_ADV)
+    if (!_en_bt_adv_legacy) {
+        err = bt_le_ext_adv_start(_en_bt_adv_set[_en_bt_adv_idx],
+                        BT_LE_EXT_ADV_START_DEFAULT);
+        if (err) {
+            LOG_ERR("Advertising failed to resume (err %d)", err);
+        }
+        return;
+    }
+#endif
+    err = bt_le_adv_start(&_en_bt_adv_param, _en_bt_ad,
+                    ARRAY_SIZE(_en_bt_ad), NULL, 0);
+    if (err) {
+        LOG_ERR("Advertising failed to resume (err %d)", err);
+        _en_bt_adv_active = false;
+    }
+}
+
+/************* EN_APP THREAD ***************/
+
+// The EN states are driven by a dedicated thread, so phase transitions do not
+//  wait for (flash-)work on the shared system workqueue. Timers and external
+//  requests are posted as events; the thread executes them in order.
+
+typedef enum {
+    EN_EVT_TIMER = 0,   // phase timer expired => run next state
+    EN_EVT_START,       // start EN
+    EN_EVT_STOP,        // stop EN
+    EN_EVT_ROLL,        // rolling interval boundary => update TEK/RPI
+    EN_EVT_BATTERY,     // sample battery
+    EN_EVT_SAMPLED,     // battery sample done => resume advertising
+    EN_EVT_SYNCED,      // clock synced => resume when waiting for it
+    EN_EVT_CNT
+} en_evt_id_t;
+
+typedef struct {
+    uint8_t  id;
+    uint8_t  gen;       // phase generation (EN_EVT_TIMER only)
+    uint32_t stamp;     // cycle counter at which event is posted
+} en_evt_t;
+
+typedef void (*en_state_t)(void);
+
+// Events posted by timers and callbacks are coalesced: such an event is queued
+//  at most once and handling it covers all posts since. Start and stop are
+//  queued as posted, so the worst burst is one event of each kind plus a start
+//  or stop requested again before the first is handled.
+#define EN_EVT_COALESCED    (BIT(EN_EVT_TIMER) | BIT(EN_EVT_ROLL) | \
+                             BIT(EN_EVT_BATTERY) | BIT(EN_EVT_SAMPLED) | \
+                             BIT(EN_EVT_SYNCED))
+#define EN_EVT_QUEUE_LEN    (EN_EVT_CNT + 2)
+
+K_MSGQ_DEFINE(_en_evt_q, sizeof(en_evt_t), EN_EVT_QUEUE_LEN, 4);
+
+static void en_thread(void *p1, void *p2, void *p3);
+K_THREAD_DEFINE(_en_thread, CT_EN_THREAD_STACK_SIZE, en_thread,
+                NULL, NULL, NULL, CT_EN_THREAD_PRIO, 0, 0);
+
+#if defined(CONFIG_CT_DB_SCRUB)
+// Scrubbing reads whole flash sectors, so it runs from its own work queue at
+//  the lowest application priority, behind EN, BT and the system workqueue.
+K_THREAD_STACK_DEFINE(_en_scrub_stack, CT_DB_SCRUB_STACK_SIZE);
+static struct k_work_q _en_scrub_q;
+static struct k_work _en_scrub_work;
+
+static void en_scrub(struct k_work *work)
+{
+    (void) ct_db_scrub(CT_DB_SCRUB_SECTORS);
+}
+#endif
+
+// Phase timer and the state it triggers. A new phase increments the
+//  generation, so an already posted timer-event of a previous phase is ignored.
+//  The generation of the last expired phase is kept apart from the event, as a
+//  coalesced timer-event may have been posted by an earlier phase.
+static struct k_timer _en_phase_timer;
+static en_state_t _en_phase_next;
+static uint8_t _en_phase_gen;
+static atomic_t _en_phase_expired_gen;
+// Rolling interval boundary and battery sampling.
+static struct k_timer _en_roll_timer;
+static struct k_timer _en_batt_timer;
+// Waiting for a trusted clock: advertising and scanning are stopped.
+static bool _en_parked;
+// Battery sample requested, new sample delivered and number of consecutive
+//  samples below empty-level.
+static bool _en_batt_due;
+static atomic_t _en_batt_new;
+static uint8_t _en_batt_low;
+
+// Latency between posting and handling an event, per event type.
+// => bucket b holds latencies of [2^(b-1), 2^b) microseconds.
+#define EN_LAT_BUCKETS  12
+static struct {
+    uint32_t hist[EN_LAT_BUCKETS];
+    uint32_t max_us;
+} _en_lat[EN_EVT_CNT];
+// Coalesced events which are queued and not yet handled.
+static atomic_t _en_evt_pending;
+// Events dropped as the queue was full.
+static uint32_t _en_evt_dropped;
+
+static int en_evt_post(en_evt_id_t id, uint8_t gen)
+{
+    en_evt_t evt = {
+        .id    = id,
+        .gen   = gen,
+        .stamp = k_cycle_get_32(),
+    };
+
+    if ((EN_EVT_COALESCED & BIT(id)) &&
+            atomic_test_and_set_bit(&_en_evt_pending, id)) {
+        return 0;
+    }
+
+    if (k_msgq_put(&_en_evt_q, &evt, K_NO_WAIT) != 0) {
+        atomic_clear_bit(&_en_evt_pending, id);
+        _en_evt_dropped++;
+        return -ENOBUFS;
+    }
+
+    return 0;
 }
 
+static void en_phase_expired(struct k_timer *timer)
+{
+    atomic_set(&_en_phase_expired_gen, _en_phase_gen);
+    en_evt_post(EN_EVT_TIMER, 0);
+}
 
-static void app_en_state_adv(struct k_work *work)
+static void en_roll_expired(struct k_timer *timer)
 {
-    int err;
-    LOG_DBG("state: ADV");
-    ct_app_event(CT_APP_EN, CT_EVENT_START_ADV);
+    en_evt_post(EN_EVT_ROLL, 0);
+}
+
+static void en_batt_expired(struct k_timer *timer)
+{
+    en_evt_post(EN_EVT_BATTERY, 0);
+}
+
+// Clock synced, called from the context which set the clock.
+static void en_clock_synced(void)
+{
+    en_evt_post(EN_EVT_SYNCED, 0);
+}
+
+// Battery sample done, called from the system workqueue.
+static void en_batt_sampled(int mV)
+{
+    if (mV >= 0) {
+        atomic_set(&_en_batt_new, 1);
+    }
+    en_evt_post(EN_EVT_SAMPLED, 0);
+}
+
+// Sample the battery while the radio is idle: the receiver is off and the
+//  advertisement is paused until the sample is done.
+static void en_battery_sample(void)
+{
+    en_bt_adv_pause();
+    if (battery_sample_async(en_batt_sampled) != 0) {
+        en_bt_adv_resume();
+    }
+}
+
+// Schedule state 's' after 't'. Only to be called from the EN thread.
+static void en_state_next(en_state_t s, k_timeout_t t)
+{
+    k_timer_stop(&_en_phase_timer);
+    _en_phase_gen++;
+    _en_phase_next = s;
+    k_timer_start(&_en_phase_timer, t, K_NO_WAIT);
+}
+
+static void en_state_clear(void)
+{
+    k_timer_stop(&_en_phase_timer);
+    _en_phase_gen++;
+    _en_phase_next = NULL;
+}
+
+static void en_lat_record(uint8_t id, uint32_t cycles)
+{
+    uint32_t us = k_cyc_to_us_floor32(cycles);
+    uint8_t  b  = 0;
+
+    while ((b < (EN_LAT_BUCKETS - 1)) && ((us >> b) != 0)) {
+        b++;
+    }
+
+    _en_lat[id].hist[b]++;
+    _en_lat[id].max_us = MAX(_en_lat[id].max_us, us);
+}
 
-    // As the adv-state in the GAEN stack will run most often, check battery.
-    static uint8_t batt_sample_cnt = 0;
-    if (batt_sample_cnt++ > 10) {
-        batt_sample_cnt = 0;
-        int batt_mV = battery_sample();
-        if(batt_mV >= 0) {
-            int batt_percent = battery_level_pptt(batt_mV, CT_BATT_TYPE) / 100;
-            if (batt_percent < 5)
+static void en_lat_report(void)
+{
+    static const char * const name[EN_EVT_CNT] = {
+        "timer", "start", "stop", "roll", "batt", "sampled", "synced"
+    };
+
+    for (int id = 0; id < EN_EVT_CNT; id++) {
+        const uint32_t *h = _en_lat[id].hist;
+        LOG_INF("latency %s [us] <1:%u <2:%u <4:%u <8:%u <16:%u <32:%u",
+                        name[id], h[0], h[1], h[2], h[3], h[4], h[5]);
+        LOG_INF("latency %s [us] <64:%u <128:%u <256:%u <512:%u <1024:%u "
+                        ">=1024:%u max:%u", name[id], h[6], h[7], h[8], h[9],
+                        h[10], h[11], _en_lat[id].max_us);
+    }
+
+    if (_en_evt_dropped) {
+        LOG_WRN("%u events dropped", _en_evt_dropped);
+    }
+}
+
+// Report the filtered battery level to the scheduler, after a new sample has
+//  been added to it.
+static void en_battery_update(void)
+{
+    int batt_mV = battery_get_mV();
+    if(batt_mV >= 0) {
+        int batt_percent = battery_level_pptt(batt_mV, CT_BATT_TYPE) / 100;
+        ct_sched_battery(batt_percent);
+
+        // Signal once per discharge: re-arm after the level recovered.
+        if (batt_percent < CT_BATT_EMPTY_LEVEL) {
+            if ((_en_batt_low < CT_BATT_EMPTY_CNT) &&
+                    (++_en_batt_low == CT_BATT_EMPTY_CNT)) {
                 ct_app_event(CT_APP_EN, CT_EVENT_BATTERY_EMPTY);
+            }
+        } else if (batt_percent >= (CT_BATT_EMPTY_LEVEL + CT_BATT_EMPTY_HYST)) {
+            _en_batt_low = 0;
         }
     }
+}
 
-    // Stop scanning activity
-    bt_le_scan_stop();
+// Schedule an update of TEK/RPI at the start of the next rolling interval.
+static void en_roll_schedule(const struct timespec *now)
+{
+    uint32_t ival = MAX(ct_priv.tek_rolling_interval, 1);
+    uint32_t next = ival - (now->tv_sec % ival);
+
+    k_timer_start(&_en_roll_timer, K_SECONDS(next), K_NO_WAIT);
+}
 
+// Update TEK, RPI and AEM and restart advertisements when the RPI changed.
+// => returns -EINVAL when the clock is not set or not trusted.
+static int en_keys_update(void)
+{
     struct timespec now;
-    clock_gettime(CLOCK_REALTIME, &now);
+    ct_time_get(&now);
 
     // Ensure internal clock is set to a proper value as the EN depends
     // heavily on the concept of (a correct) time. Note that we cannot check
     // what the correct value should be, but we know that the value should be
     // aleast after 01-Jan-2020, 00:00 [epoch: 1577836800]
-    if (now.tv_sec < 1577836800) {
-        ct_app_event(CT_APP_EN, CT_EVENT_INVALID_CLOCK);
-        APP_STATE_NEXT_WQ(app_en_state_adv, K_MSEC(ct_priv.adv_period));
-        return;
+    if (now.tv_sec < CT_TIME_EPOCH_MIN) {
+        return -EINVAL;
+    }
+
+    // Wrong intervals would be advertised and stored: wait for a sync when the
+    //  clock was restored from NVM or ran too long without a sync.
+    if (!ct_time_is_trusted()) {
+        return -EINVAL;
     }
 
     uint8_t rpi_old[RPI_SIZE];
@@ -288,6 +919,8 @@ static void app_en_state_adv(struct k_work *work)
     // Sent tick to db.
     ct_db_tick( ival );
 
+    // Rotate exactly at the next interval boundary.
+    en_roll_schedule(&now);
 
     // Reset advertisment when RPI has changed
     if ( memcmp(rpi_old, _en_key_rpi, RPI_SIZE) != 0 ) {
@@ -296,67 +929,259 @@ static void app_en_state_adv(struct k_work *work)
         LOG_HEXDUMP_INF(_en_key_rpi, RPI_SIZE, " >> New RPI");
         LOG_HEXDUMP_INF(_en_key_aem, AEM_SIZE, " >> New AEM ");
 
-        // Stop advertising so we can update all parameters
-        err = bt_le_adv_stop();
-        if (err) {
-            LOG_ERR("Advertising failed to stop (err %d)", err);
-        }
+        en_bt_adv_rotate();
+    }
 
-        for(int i = 0; i< RPI_SIZE; i++) {
-            _en_bt_service_data[i+2] = _en_key_rpi[i];
-        }
+    return 0;
+}
+
+// The clock is not set or not trusted: stop advertising and scanning, so no
+//  RPI is advertised beyond its interval and no RPIs are stored against a
+//  wrong interval. EN resumes upon a clock sync (EN_EVT_SYNCED).
+static void en_park(void)
+{
+    if (!_en_parked) {
+        LOG_WRN("Clock not trusted, EN waits for a sync");
+        ct_app_event(CT_APP_EN, CT_EVENT_INVALID_CLOCK);
+    }
+    _en_parked = true;
+
+    en_state_clear();
+    k_timer_stop(&_en_roll_timer);
+    bt_le_scan_stop();
+    en_bt_adv_stop();
+    ct_energy_en_state(CT_ENERGY_EN_IDLE);
+
+    // Forget last RPI, so advertising restarts with a new RPI upon resume.
+    memset(_en_key_rpi, 0, RPI_SIZE);
+}
+
+static void en_evt_handle(const en_evt_t *evt)
+{
+    en_lat_record(evt->id, k_cycle_get_32() - evt->stamp);
 
-        for(int i = 0; i< AEM_SIZE; i++) {
-            _en_bt_service_data[i+2+RPI_SIZE] = _en_key_aem[i];
+    switch (evt->id) {
+        case EN_EVT_TIMER:
+        {
+            // ignore timer-events of cancelled phases.
+            if ((_en_state != APP_STATE_ACTIVE) ||
+                    (evt->gen != _en_phase_gen) || !_en_phase_next) {
+                break;
+            }
+            en_state_t state = _en_phase_next;
+            _en_phase_next = NULL;
+            state();
+            break;
         }
 
-        // reset BLE ID
-        bt_id_reset(_en_bt_adv_param.id, NULL, NULL);
+        case EN_EVT_START:
+            _en_state  = APP_STATE_ACTIVE;
+            _en_parked = false;
+            memset(_en_lat, 0, sizeof(_en_lat));
+            _en_evt_dropped = 0;
+            //delayed start to allow other apps to close down (open) BT connections
+            en_state_next(app_en_state_start, K_MSEC(2000));
+            k_timer_start(&_en_batt_timer, K_SECONDS(CT_EN_BATT_PERIOD),
+                            K_SECONDS(CT_EN_BATT_PERIOD));
+            break;
+
+        case EN_EVT_STOP:
+            _en_state  = APP_STATE_STOPPED;
+            _en_parked = false;
+            en_state_clear();
+            k_timer_stop(&_en_roll_timer);
+            k_timer_stop(&_en_batt_timer);
+
+            bt_le_scan_stop();
+            en_bt_adv_stop();
+            ct_energy_en_state(CT_ENERGY_EN_IDLE);
+
+            LOG_INF("EN APP stop");
+            en_lat_report();
+
+            ct_app_event(CT_APP_EN, CT_EVENT_STOP);
+            break;
+
+        case EN_EVT_ROLL:
+            if ((_en_state == APP_STATE_ACTIVE) && !_en_parked) {
+                if (en_keys_update() != 0) {
+                    en_park();
+                }
+            }
+            break;
 
-        // Force the usage of the identity address.
-        //  This address will change every time `bt_le_adv_start` is called.
-        _en_bt_adv_param.options      = (BT_LE_ADV_OPT_USE_IDENTITY);
+        case EN_EVT_BATTERY:
+            // Sampled at the start of the next advertisement period.
+            if (_en_state == APP_STATE_ACTIVE) {
+                _en_batt_due = true;
+            }
+            break;
 
-        // Update ADV interval.
-        _en_bt_adv_param.interval_min = ct_priv.adv_ival_min;
-        _en_bt_adv_param.interval_max = ct_priv.adv_ival_max;
+        case EN_EVT_SAMPLED:
+            if (_en_state == APP_STATE_ACTIVE) {
+                en_bt_adv_resume();
+                if (atomic_cas(&_en_batt_new, 1, 0)) {
+                    en_battery_update();
+                }
+            }
+            break;
 
-        // Start advertising
-        // ==> will generate a new mac address for the advertisement!
-        err = bt_le_adv_start(&_en_bt_adv_param, _en_bt_ad,
-                        ARRAY_SIZE(_en_bt_ad), NULL, 0);
-        if (err) {
-            LOG_ERR("Advertising failed to start (err %d)", err);
+        case EN_EVT_SYNCED:
+            if ((_en_state == APP_STATE_ACTIVE) && _en_parked) {
+                LOG_INF("Clock synced, EN resumes");
+                _en_parked = false;
+                app_en_state_adv();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void en_thread(void *p1, void *p2, void *p3)
+{
+    en_evt_t evt;
+
+    k_timer_init(&_en_phase_timer, en_phase_expired, NULL);
+    k_timer_init(&_en_roll_timer, en_roll_expired, NULL);
+    k_timer_init(&_en_batt_timer, en_batt_expired, NULL);
+
+    while (1) {
+        k_msgq_get(&_en_evt_q, &evt, K_FOREVER);
+        // Posts from here on queue the event again, posts before are covered.
+        atomic_clear_bit(&_en_evt_pending, evt.id);
+        if (evt.id == EN_EVT_TIMER) {
+            evt.gen = (uint8_t) atomic_get(&_en_phase_expired_gen);
         }
+        en_evt_handle(&evt);
     }
+}
+
+/************* EN_APP STATES ***************/
+
+static void app_en_state_start(void)
+{
+    LOG_DBG("state: START");
+    ct_app_event(CT_APP_EN, CT_EVENT_START);
 
-    APP_STATE_NEXT_WQ(app_en_state_scan, K_MSEC(ct_priv.adv_period));
+    // Stop all BT activity
+    en_bt_adv_stop();
+    bt_le_scan_stop();
+
+    // Forget last RPI, so advertising restarts in the adv-state.
+    memset(_en_key_rpi, 0, RPI_SIZE);
+
+    // Start at nominal duty-cycle
+    _en_scan_pending = false;
+    ct_sched_reset();
+
+    // Setup advertisment data
+    app_en_state_adv();
 }
 
 
-static void app_en_state_scan(struct k_work *work)
+static void app_en_state_adv(void)
+{
+    LOG_DBG("state: ADV");
+    ct_app_event(CT_APP_EN, CT_EVENT_START_ADV);
+    ct_trace(CT_TRACE_EN_STATE, CT_EVENT_START_ADV, 0,
+                ct_crypto_intervalNumber_now());
+
+    // Stop scanning activity
+    bt_le_scan_stop();
+    ct_energy_en_state(CT_ENERGY_EN_ADV);
+
+#if defined(CONFIG_CT_DB_SCRUB)
+    // Verify stored data in the background.
+    k_work_submit_to_queue(&_en_scrub_q, &_en_scrub_work);
+#endif
+
+    // Adapt duty-cycle to the results of the last scan period.
+    if (_en_scan_pending) {
+        uint32_t cnt;
+        _en_scan_pending = false;
+        ct_db_rpi_get_cnt(&cnt);
+        ct_sched_scan_done(
+                (cnt > _en_scan_rpi_cnt) ? (cnt - _en_scan_rpi_cnt) : 0,
+                _en_scan_contacts);
+#if defined(CONFIG_CT_EN_CROWD_BENCH)
+        en_crowd_report();
+#endif
+    }
+
+    ct_sched_param_t sched;
+    ct_sched_get(&sched);
+
+    // Update TEK/RPI/AEM and advertisement.
+    int err = en_keys_update();
+
+    // Sample battery while the receiver is off, after a possible rotation so
+    //  the advertisement stays paused until the sample is done.
+    if (_en_batt_due) {
+        _en_batt_due = false;
+        en_battery_sample();
+    }
+
+    if (err != 0) {
+        en_park();
+        return;
+    }
+
+    uint32_t adv_period = sched.adv_period;
+    if (_en_concurrent) {
+        adv_period *= CT_EN_CONCURRENT_ADV_FACTOR;
+    }
+
+    en_state_next(app_en_state_scan, K_MSEC(adv_period));
+}
+
+
+static void app_en_state_scan(void)
 {
     LOG_DBG("state: SCAN");
     ct_app_event(CT_APP_EN, CT_EVENT_START_SCAN);
+    ct_trace(CT_TRACE_EN_STATE, CT_EVENT_START_SCAN, 0,
+                ct_crypto_intervalNumber_now());
 
     // Do not stop Advertisemens as this will update the BT mac-address.
 
+    ct_sched_param_t sched;
+    ct_sched_get(&sched);
+
     // Setup of scan-paramets.
     // ==> Scan passivly, i.e. do not request scan-responses.
     _en_bt_scan_param.type       = BT_HCI_LE_SCAN_PASSIVE;
     // ==> Ignore duplicate advertisements during a single scan period.
     _en_bt_scan_param.options    = BT_LE_SCAN_OPT_FILTER_DUPLICATE;
-    _en_bt_scan_param.interval   = ct_priv.scan_ival;
-    _en_bt_scan_param.window     = ct_priv.scan_window;
+    _en_bt_scan_param.interval   = sched.scan_ival;
+    _en_bt_scan_param.window     = sched.scan_window;
+
+    // ==> Align with the connection events of ENC (1.25ms vs 0.625ms steps)
+    //     and leave half of each scan interval for the connection. Without a
+    //     connection the regular scan windows are used.
+    uint16_t conn_ival = _en_conn_ival;
+    if (_en_concurrent && (conn_ival > 0)) {
+        _en_bt_scan_param.interval = conn_ival * 2;
+        _en_bt_scan_param.window   = conn_ival;
+    }
+
+    // Track new RPIs and contacts during this scan-period.
+    ct_db_rpi_get_cnt(&_en_scan_rpi_cnt);
+    _en_scan_contacts = 0;
+    _en_scan_pending  = true;
 
     // Start scanning..
     int err = bt_le_scan_start(&_en_bt_scan_param, en_bt_scan_cb);
     if (err) {
         LOG_ERR("Scanning failed to start (err %d)", err);
+    } else {
+        ct_energy_en_scan(_en_bt_scan_param.interval,
+                        _en_bt_scan_param.window);
     }
 
     // Scanning ==> Advertising
-    APP_STATE_NEXT_WQ(app_en_state_adv, K_MSEC(ct_priv.scan_period));
+    en_state_next(app_en_state_adv, K_MSEC(sched.scan_period));
 }
 
 
@@ -375,14 +1200,31 @@ int ct_app_en_init(void)
         _en_bt_adv_param.id = 1;
     }
 
+    ct_time_set_sync_callback(en_clock_synced);
+
+#if defined(CONFIG_CT_EN_PARSER_BENCH)
+    en_adv_parse_bench();
+#endif
+#if defined(CONFIG_CT_EN_CROWD_BENCH)
+    en_crowd_init();
+#endif
+#if defined(CONFIG_CT_DB_SCRUB)
+    k_work_q_start(&_en_scrub_q, _en_scrub_stack,
+                    K_THREAD_STACK_SIZEOF(_en_scrub_stack),
+                    K_LOWEST_APPLICATION_THREAD_PRIO);
+    k_work_init(&_en_scrub_work, en_scrub);
+#endif
+
     return 0;
 }
 
 int ct_app_en_start(void)
 {
-    _en_state = APP_STATE_ACTIVE;
-    //delayed start to allow other apps to close down (open) BT connections
-    APP_STATE_NEXT(&_en_state_work, app_en_state_start, K_MSEC(2000));
+    int err = en_evt_post(EN_EVT_START, 0);
+    if (err) {
+        LOG_ERR("EN APP start dropped");
+        return err;
+    }
 
     LOG_INF("EN APP start");
 
@@ -391,15 +1233,37 @@ int ct_app_en_start(void)
 
 int ct_app_en_stop(void)
 {
-    _en_state = APP_STATE_STOPPED;
-    APP_STATE_CLEAR(&_en_state_work);
+    // Stop is handled by the EN thread, which notifies CT_EVENT_STOP.
+    int err = en_evt_post(EN_EVT_STOP, 0);
+    if (err) {
+        LOG_ERR("EN APP stop dropped");
+    }
 
-    bt_le_scan_stop();
-    bt_le_adv_stop();
+    return err;
+}
 
-    LOG_INF("EN APP stop");
+int ct_app_en_set_concurrent(bool enable)
+{
+    _en_concurrent = enable;
 
-    ct_app_event(CT_APP_EN, CT_EVENT_STOP);
+    LOG_INF("EN APP concurrent mode %s", enable ? "on" : "off");
 
     return 0;
 }
+
+int ct_app_en_set_conn_ival(uint16_t ival)
+{
+    _en_conn_ival = ival;
+    return 0;
+}
+
+int ct_app_en_set_debug(bool enable)
+{
+    _en_debug = enable;
+    return 0;
+}
+
+bool ct_app_en_get_debug(void)
+{
+    return _en_debug;
+}
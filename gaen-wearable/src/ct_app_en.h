@@ -59,4 +59,44 @@ int ct_app_en_start(void);
  */
 int ct_app_en_stop(void);
 
+/**
+ * @brief Run the EN-application next to the ENC-application.
+ *
+ * When enabled, EN keeps advertising and scanning at a reduced rate, with
+ * scan windows aligned to the ENC connection interval while connected.
+ *
+ * @param [in] enable : true to enter, false to leave concurrent mode.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_app_en_set_concurrent(bool enable);
+
+/**
+ * @brief Report the connection interval of the ENC-application.
+ *
+ * In concurrent mode, the scan windows of the next scan periods are aligned
+ * to this interval. Without ENC connection the regular scan windows are used.
+ *
+ * @param [in] ival : connection interval in steps of 1.25ms, 0 when ENC has
+ *                    no connection.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_app_en_set_conn_ival(uint16_t ival);
+
+/**
+ * @brief Enable or disable logging of each received RPI.
+ *
+ * Formatting RPIs is relatively expensive in a busy environment, so received
+ * RPIs are only logged when explicitly enabled.
+ *
+ * @param [in] enable : true to log received RPIs.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_app_en_set_debug(bool enable);
+
+/**
+ * @brief Retrieve whether received RPIs are logged.
+ * @return true when logging of received RPIs is enabled.
+ */
+bool ct_app_en_get_debug(void);
+
 #endif /* __CT_APP_EN_H */
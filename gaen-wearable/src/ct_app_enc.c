@@ -24,6 +24,7 @@
 
 #include <sys/printk.h>
 #include <sys/util.h>
+#include <sys/byteorder.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -34,11 +35,16 @@
 #include <settings/settings.h>
 
 #include "ct.h"
+#include "ct_app_en.h"
 #include "ct_app_enc.h"
 #include "ct_app_state.h"
 #include "ct_settings.h"
 #include "ct_db.h"
 #include "ct_crypto.h"
+#include "ct_sched.h"
+#include "ct_energy.h"
+#include "ct_time.h"
+#include "ct_trace.h"
 
 #include "ctsa.h"
 #include "disa.h"
@@ -61,13 +67,8 @@ typedef struct __attribute__((__packed__)){
 } bt_tek_t;
 
 // RPI structure which is communicated with BLE offloading.
-typedef struct __attribute__((__packed__)) {
-    uint8_t rpi[RPI_SIZE];
-    uint8_t aem[AEM_SIZE];
-    uint32_t ival_last;
-    int8_t rssi;
-    uint8_t cnt;
-} bt_rpi_t;
+// => provided by the database so RPIs can be exported in bulk.
+typedef ct_db_rpi_export_t bt_rpi_t;
 
 // App states and worker queue
 static app_state_t _enc_state = APP_STATE_UNDEF; // active/stopped indicator
@@ -91,6 +92,18 @@ static void app_enc_state_finish(struct k_work *work);
 #define CMD_SET_TEK_IDX      (0x06)
 #define CMD_GET_TEK_IDX      (0x07)
 
+// Batch of TLV-encoded GET/SET commands
+// >> n * [cmd (1 byte)][len (1 byte)][payload (len bytes)]
+#define CMD_BATCH            (0x08)
+
+// Version of the header of TEK/RPI readout chunks
+// >> 1 byte, unsigned, per connection
+#define CMD_SET_READOUT_VER  (0x0A)
+#define CMD_GET_READOUT_VER  (0x0B)
+// Format of RPI readout items, follows the readout version
+// >> 3 bytes: version, size of an item, capability flags (CT_DB_EXPORT_xx)
+#define CMD_GET_RPI_FORMAT   (0x0C)
+
 // Bluetooth settings
 // >> 4 bytes, unsigned, milliseconds
 #define CMD_SET_ADV_PERIOD   (0x10)
@@ -104,30 +117,112 @@ static void app_enc_state_finish(struct k_work *work);
 // >> 2 bytes, unsigned, 0.625 millisecond steps
 #define CMD_SET_ADV_IVAL_MAX (0x16)
 #define CMD_GET_ADV_IVAL_MAX (0x17)
+// >> 26 bytes, adaptive scan scheduler state (ct_sched_stats_t)
+#define CMD_GET_SCHED_STATS  (0x19)
+// >> energy accounting, see ct_energy.h
+#define CMD_GET_ENERGY       (0x1A)
+#define CMD_GET_ENERGY_IO    (0x1B)
+// >> 18 bytes, clock drift estimate (ct_time_drift_t)
+#define CMD_GET_CLOCK_DRIFT  (0x1C)
+// >> 24 bytes, flash integrity summary (ct_db_integrity_t)
+#define CMD_GET_DB_INTEGRITY (0x1D)
+// >> 18 bytes, flash wear summary (ct_db_wear_t)
+#define CMD_GET_DB_WEAR      (0x1E)
+// >> 16 bytes, RPI export benchmark of the session (enc_export_stats_t)
+#define CMD_GET_EXPORT_STATS (0x1F)
 
 // EN settings
 #define CMD_SET_TEK_IVAL     (0x20)
 #define CMD_GET_TEK_IVAL     (0x21)
 #define CMD_SET_TEK_PERIOD   (0x22)
 #define CMD_GET_TEK_PERIOD   (0x23)
+// >> CT_ATT_BUCKETS-1 bytes, unsigned, ascending, dB
+#define CMD_SET_ATT_THRESH   (0x24)
+#define CMD_GET_ATT_THRESH   (0x25)
 
 // Device name
 #define CMD_SET_DEVICENAME   (0x30)
 #define CMD_GET_DEVICENAME   (0x31)
 
+// Debugging (not stored in NVM)
+// >> 1 byte, 0 = off, 1 = log each received RPI
+#define CMD_SET_DEBUG        (0x40)
+#define CMD_GET_DEBUG        (0x41)
+// >> request: 4 bytes, sequence number of first record
+// >> response: 4 bytes, sequence number of first record + n trace records
+#define CMD_GET_TRACE        (0x42)
+
 // Status masks.
 #define CMD_MASK_OK          (0x80)
 #define CMD_MASK_ERR         (0x40)
 
+// Maximum length of a response on a single command
+#define CMD_RESP_LEN_MAX     (30)
+// Maximum length of a response on a batch-command (limited by ATT MTU)
+#define CMD_BATCH_LEN_MAX    (CONFIG_BT_L2CAP_TX_MTU - 3)
+
+BUILD_ASSERT(sizeof(ct_sched_stats_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Scheduler statistics do not fit in a command response");
+BUILD_ASSERT(sizeof(ct_energy_stats_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Energy statistics do not fit in a command response");
+BUILD_ASSERT(sizeof(ct_energy_io_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Energy counters do not fit in a command response");
+BUILD_ASSERT(sizeof(ct_time_drift_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Clock drift does not fit in a command response");
+BUILD_ASSERT(sizeof(ct_db_integrity_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Flash integrity does not fit in a command response");
+BUILD_ASSERT(sizeof(ct_db_wear_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Flash wear does not fit in a command response");
+
+// RPI export benchmark: bytes served to centrals vs. cpu-time spent doing so,
+//  since ENC started.
+typedef struct __attribute__((__packed__)) {
+    uint32_t bytes;     // bytes of RPIs served
+    uint32_t fills;     // (re)fills of the export window
+    uint32_t cpu_us;    // cpu-time of the fills and reads
+    uint32_t rate;      // bytes per ms of cpu-time
+} enc_export_stats_t;
+
+BUILD_ASSERT(sizeof(enc_export_stats_t) + 1 <= CMD_RESP_LEN_MAX,
+             "Export statistics do not fit in a command response");
+// get the export benchmark, see RPI EXPORT WINDOW
+static void enc_export_get_stats(enc_export_stats_t *stats);
+
+// Number of trace records in a GET_TRACE response
+#define CMD_TRACE_RECS       ((CMD_RESP_LEN_MAX - 1 - 4) / sizeof(ct_trace_rec_t))
+BUILD_ASSERT(CMD_TRACE_RECS > 0, "Trace records do not fit in a command response");
+
 /************* BT CONNECTION ***************/
 
 // connection structure to track amount of RPI/TEKs which have been read
+// ==> each connected central has its own session: subscription state, read
+//     cursors and command responses are never shared between connections.
 typedef struct {
     struct bt_conn *conn;
-    uint16_t idx_rpi;
+    bool notify_enabled;
+    uint8_t readout_ver;
+    uint32_t idx_rpi;
     uint16_t idx_tek;
 } enc_conn_t;
 
+// Header of TEK/RPI readout chunks, see README.md
+// > version 0: 16-bit index, count and remaining items
+// > version 1: version, header length, 16-bit count, 32-bit index and
+//   remaining items
+#define ENC_READOUT_V0         (0)
+#define ENC_READOUT_V1         (1)
+#define ENC_READOUT_HDR_LEN(v) (((v) == ENC_READOUT_V1) ? 12 : 6)
+
+// Version 0 is the default, so centrals of the first firmware keep working.
+//  It can only address the first 65535 items; larger databases require a
+//  central which selects version 1.
+#define ENC_READOUT_CNT_MAX(v) (((v) == ENC_READOUT_V1) ? UINT32_MAX : UINT16_MAX)
+
+// Version 0 serves RPIs in the item format of version 0, without the fields
+//  appended since (see CT_DB_EXPORT_VERSION).
+#define ENC_READOUT_RPI_SIZE(v) (((v) == ENC_READOUT_V1) ? sizeof(bt_rpi_t) \
+                                    : CT_DB_EXPORT_V0_SIZE)
+
 static enc_conn_t _enc_bt_conn[CONFIG_BT_MAX_PAIRED];
 
 static int enc_bt_conn_get(struct bt_conn *conn, enc_conn_t** enc_conn)
@@ -170,10 +265,18 @@ static int enc_bt_conn_new(enc_conn_t** enc_conn)
     return -ENOMEM;
 }
 
-/************* BT DEFINITIONS ***************/
+static int enc_bt_conn_active_cnt(void)
+{
+    int cnt = 0;
+    for(int i=0;i<CONFIG_BT_MAX_PAIRED;i++) {
+        if (_enc_bt_conn[i].conn != NULL) {
+            cnt++;
+        }
+    }
+    return cnt;
+}
 
-// notification-function enabled by connected device
-static volatile bool _enc_bt_notify_enabled = false;
+/************* BT DEFINITIONS ***************/
 
 static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
                 const struct bt_gatt_attr *attr,
@@ -197,6 +300,10 @@ static ssize_t enc_bt_tek_on_read(struct bt_conn *conn,
 static void enc_bt_resp_ccc_cfg_changed(const struct bt_gatt_attr *attr,
                 uint16_t value);
 
+static ssize_t enc_bt_resp_ccc_cfg_write(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr,
+                uint16_t value);
+
 #define ENC_BT_UUID_SERVICE_PRIMARY \
     BT_UUID_128_ENCODE(0xb3c04e98, 0x82b5, 0x4587, 0x84b6, 0x6179a66a079f)
 #define ENC_BT_UUID_CMD_CHAR \
@@ -228,6 +335,11 @@ static const struct bt_data _enc_bt_sd[] = {
     BT_DATA(BT_DATA_NAME_COMPLETE, ct_priv.device_name, sizeof(ct_priv.device_name)),
 };
 
+// Managed CCC so subscriptions can be tracked per connection.
+static struct _bt_gatt_ccc _enc_bt_resp_ccc =
+    BT_GATT_CCC_INITIALIZER(enc_bt_resp_ccc_cfg_changed,
+                            enc_bt_resp_ccc_cfg_write, NULL);
+
 static struct bt_gatt_attr _enc_bt_service_attrs[] = {
     BT_GATT_PRIMARY_SERVICE(ENC_BT_UUID_SERVICE),
     BT_GATT_CHARACTERISTIC(ENC_BT_UUID_CMD,
@@ -238,7 +350,7 @@ static struct bt_gatt_attr _enc_bt_service_attrs[] = {
         BT_GATT_CHRC_NOTIFY,
         BT_GATT_PERM_NONE,
         NULL, NULL, NULL),
-    BT_GATT_CCC(enc_bt_resp_ccc_cfg_changed,
+    BT_GATT_CCC_MANAGED(&_enc_bt_resp_ccc,
         BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
     BT_GATT_CHARACTERISTIC(ENC_BT_UUID_READ_RPI,
         BT_GATT_CHRC_READ,
@@ -255,44 +367,121 @@ static struct bt_gatt_service _enc_bt_service =
 
 /************* BT NOTIFICATION ***************/
 
+// Called with the aggregated CCC value of all connections.
 static void enc_bt_resp_ccc_cfg_changed(const struct bt_gatt_attr *attr,
                 uint16_t value)
 {
     ARG_UNUSED(attr);
 
-    _enc_bt_notify_enabled = (value == BT_GATT_CCC_NOTIFY);
-
-    LOG_INF("ENC APP Notifications %s",
-        _enc_bt_notify_enabled ? log_strdup("enabled") : log_strdup("disabled"));
+    LOG_DBG("ENC APP Notifications (any connection) %s",
+        (value == BT_GATT_CCC_NOTIFY) ? "enabled" : "disabled");
 }
 
-static void enc_app_notify(struct bt_conn *conn, uint8_t mask,
-                const uint8_t *data, uint8_t data_len)
+// Called for each CCC write, so the subscription is stored on the session of
+//  the connection that wrote it.
+static ssize_t enc_bt_resp_ccc_cfg_write(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr,
+                uint16_t value)
 {
-    if (_enc_bt_notify_enabled == false) {
-        LOG_ERR("user did not enable notification");
-        return;
+    ARG_UNUSED(attr);
+
+    enc_conn_t* enc_conn;
+    if (enc_bt_conn_get(conn, &enc_conn) != 0) {
+        LOG_ERR("Unknown connection");
+        return BT_GATT_ERR(BT_ATT_ERR_AUTHORIZATION);
     }
 
+    enc_conn->notify_enabled = (value == BT_GATT_CCC_NOTIFY);
+
+    LOG_INF("ENC APP Notifications %s [%p]",
+        enc_conn->notify_enabled ? "enabled" : "disabled", conn);
+
+    return sizeof(value);
+}
+
+static void enc_app_notify(struct bt_conn *conn,
+                const uint8_t *resp, uint16_t resp_len)
+{
     enc_conn_t* enc_conn;
     if (enc_bt_conn_get(conn, &enc_conn) != 0) {
         LOG_ERR("Unknown connection");
         return;
     }
 
-    uint8_t cmd_idx   = 0;
+    if (enc_conn->notify_enabled == false) {
+        LOG_ERR("user did not enable notification");
+        return;
+    }
 
-    // response array ==> 30 bytes is only to ensure we have enough data.
-    //  It is a quick fix and works as long as "data_len" will not exceed "30".
-    uint8_t resp[30] = {0};
+    // Only respond to the connection which sent the command.
+    bt_gatt_notify(conn, &_enc_bt_service.attrs[2], resp, resp_len);
+}
+
+// Settings which can be set over EN-Config. Commands are executed on a staged
+//  copy, of which only these fields are committed to ct_priv. Other fields of
+//  ct_priv are owned by other modules (e.g. the clock checkpoint of ct_time
+//  and the database generations of ct_db) and are never written back.
+typedef struct {
+    uint32_t adv_period;
+    uint32_t scan_period;
+    uint16_t adv_ival_min;
+    uint16_t adv_ival_max;
+    uint32_t tek_rolling_interval;
+    uint32_t tek_rolling_period;
+    uint8_t  att_thresholds[CT_ATT_BUCKETS - 1];
+    unsigned char device_name[sizeof(ct_priv.device_name)];
+} enc_cfg_t;
+
+static void enc_cfg_get(enc_cfg_t *cfg)
+{
+    k_sched_lock();
+    cfg->adv_period           = ct_priv.adv_period;
+    cfg->scan_period          = ct_priv.scan_period;
+    cfg->adv_ival_min         = ct_priv.adv_ival_min;
+    cfg->adv_ival_max         = ct_priv.adv_ival_max;
+    cfg->tek_rolling_interval = ct_priv.tek_rolling_interval;
+    cfg->tek_rolling_period   = ct_priv.tek_rolling_period;
+    memcpy(cfg->att_thresholds, ct_priv.att_thresholds,
+                    sizeof(cfg->att_thresholds));
+    memcpy(cfg->device_name, ct_priv.device_name, sizeof(cfg->device_name));
+    k_sched_unlock();
+}
+
+// Commit staged settings, without being interleaved with other threads, so
+//  EN never sees a partly applied batch.
+static void enc_cfg_commit(const enc_cfg_t *cfg)
+{
+    k_sched_lock();
+    ct_priv.adv_period           = cfg->adv_period;
+    ct_priv.scan_period          = cfg->scan_period;
+    ct_priv.adv_ival_min         = cfg->adv_ival_min;
+    ct_priv.adv_ival_max         = cfg->adv_ival_max;
+    ct_priv.tek_rolling_interval = cfg->tek_rolling_interval;
+    ct_priv.tek_rolling_period   = cfg->tek_rolling_period;
+    memcpy(ct_priv.att_thresholds, cfg->att_thresholds,
+                    sizeof(ct_priv.att_thresholds));
+    memcpy(ct_priv.device_name, cfg->device_name, sizeof(ct_priv.device_name));
+    k_sched_unlock();
+}
+
+// Compose response on a command, based on settings 'cfg' and session
+//  'enc_conn'. 'resp' should be able to hold CMD_RESP_LEN_MAX bytes.
+// => returns length of the response.
+static uint8_t enc_app_resp(const enc_cfg_t *cfg,
+                const enc_conn_t *enc_conn, uint8_t mask,
+                const uint8_t *data, uint16_t data_len, uint8_t *resp)
+{
+    uint8_t cmd_idx   = 0;
     uint8_t resp_len = 0;
 
     // in most cases we want to copy data to response and signal if all
     //  is ok or not. The next "if" and "switch" - statements will correct
     //  the response where needed.
     //  This is just a lazy (but functioning) approach.
-    memcpy(resp, data, data_len);
-    resp_len = data_len;
+    // => an invalid command is truncated to the response size.
+    memset(resp, 0, CMD_RESP_LEN_MAX);
+    resp_len = MIN(data_len, CMD_RESP_LEN_MAX);
+    memcpy(resp, data, resp_len);
 
     //Upon error: mask CMD with error and responde with provided data
     if (mask == CMD_MASK_ERR) {
@@ -322,8 +511,13 @@ static void enc_app_notify(struct bt_conn *conn, uint8_t mask,
             // Data Management : RPI
             case CMD_SET_RPI_IDX:
             case CMD_GET_RPI_IDX:
-                *resp_u16 = enc_conn->idx_rpi;
-                resp_len  = 2 + 1;
+                if (enc_conn->readout_ver == ENC_READOUT_V1) {
+                    *resp_u32 = enc_conn->idx_rpi;
+                    resp_len  = 4 + 1;
+                } else {
+                    *resp_u16 = enc_conn->idx_rpi;
+                    resp_len  = 2 + 1;
+                }
                 break;
 
             // Data Management : TEK
@@ -333,57 +527,171 @@ static void enc_app_notify(struct bt_conn *conn, uint8_t mask,
                 resp_len  = 2 + 1;
                 break;
 
+            // Data Management : readout header
+            case CMD_SET_READOUT_VER:
+            case CMD_GET_READOUT_VER:
+                *resp_u8  = enc_conn->readout_ver;
+                resp_len  = 1 + 1;
+                break;
+
+            case CMD_GET_RPI_FORMAT:
+                if (enc_conn->readout_ver == ENC_READOUT_V1) {
+                    resp_u8[0] = CT_DB_EXPORT_VERSION;
+                    resp_u8[1] = sizeof(bt_rpi_t);
+                    resp_u8[2] = CT_DB_EXPORT_FLAGS;
+                } else {
+                    resp_u8[0] = 0;
+                    resp_u8[1] = CT_DB_EXPORT_V0_SIZE;
+                    resp_u8[2] = 0;
+                }
+                resp_len   = 3 + 1;
+                break;
+
             // Bluetooth settings : Advertisement period [ms]
             case CMD_SET_ADV_PERIOD:
             case CMD_GET_ADV_PERIOD:
-                *resp_u32 = ct_priv.adv_period;
+                *resp_u32 = cfg->adv_period;
                 resp_len  = 4 + 1;
                 break;
 
             // Bluetooth settings : Scan period [ms]
             case CMD_SET_SCAN_PERIOD:
             case CMD_GET_SCAN_PERIOD:
-                *resp_u32 = ct_priv.scan_period;
+                *resp_u32 = cfg->scan_period;
                 resp_len  = 4 + 1;
                 break;
 
             // Bluetooth settings : Minimum Advertisement Interval [0.625 ms]
             case CMD_SET_ADV_IVAL_MIN:
             case CMD_GET_ADV_IVAL_MIN:
-                *resp_u16 = ct_priv.adv_ival_min;
+                *resp_u16 = cfg->adv_ival_min;
                 resp_len  = 2 + 1;
                 break;
 
             // Bluetooth settings : Maximum Advertisement Interval [0.625 ms]
             case CMD_SET_ADV_IVAL_MAX:
             case CMD_GET_ADV_IVAL_MAX:
-                *resp_u16 = ct_priv.adv_ival_max;
+                *resp_u16 = cfg->adv_ival_max;
                 resp_len  = 2 + 1;
                 break;
 
+            // Bluetooth settings : Adaptive scan scheduler
+            case CMD_GET_SCHED_STATS:
+            {
+                ct_sched_stats_t stats;
+                ct_sched_get_stats(&stats);
+                memcpy(resp_u8, &stats, sizeof(stats));
+                resp_len  = sizeof(stats) + 1;
+                break;
+            }
+
+            // Energy accounting
+            case CMD_GET_ENERGY:
+            {
+                ct_energy_stats_t stats;
+                ct_energy_get_stats(&stats);
+                memcpy(resp_u8, &stats, sizeof(stats));
+                resp_len  = sizeof(stats) + 1;
+                break;
+            }
+
+            case CMD_GET_ENERGY_IO:
+            {
+                ct_energy_io_t io;
+                ct_energy_get_io(&io);
+                memcpy(resp_u8, &io, sizeof(io));
+                resp_len  = sizeof(io) + 1;
+                break;
+            }
+
+            // Clock drift estimate
+            case CMD_GET_CLOCK_DRIFT:
+            {
+                ct_time_drift_t drift;
+                ct_time_get_drift(&drift);
+                memcpy(resp_u8, &drift, sizeof(drift));
+                resp_len  = sizeof(drift) + 1;
+                break;
+            }
+
+            // Flash integrity summary
+            case CMD_GET_DB_INTEGRITY:
+            {
+                ct_db_integrity_t integrity;
+                ct_db_get_integrity(&integrity);
+                memcpy(resp_u8, &integrity, sizeof(integrity));
+                resp_len  = sizeof(integrity) + 1;
+                break;
+            }
+
+            // Flash wear summary
+            case CMD_GET_DB_WEAR:
+            {
+                ct_db_wear_t wear;
+                ct_db_get_wear(&wear);
+                memcpy(resp_u8, &wear, sizeof(wear));
+                resp_len  = sizeof(wear) + 1;
+                break;
+            }
+
+            // RPI export benchmark
+            case CMD_GET_EXPORT_STATS:
+            {
+                enc_export_stats_t stats;
+                enc_export_get_stats(&stats);
+                memcpy(resp_u8, &stats, sizeof(stats));
+                resp_len  = sizeof(stats) + 1;
+                break;
+            }
+
             // GAEN : TEK rolling Interval
             case CMD_SET_TEK_IVAL:
             case CMD_GET_TEK_IVAL:
-                *resp_u32 = ct_priv.tek_rolling_interval;
+                *resp_u32 = cfg->tek_rolling_interval;
                 resp_len  = 4 + 1;
                 break;
 
             // GAEN : TEK rolling period
             case CMD_SET_TEK_PERIOD:
             case CMD_GET_TEK_PERIOD:
-                *resp_u32 = ct_priv.tek_rolling_period;
+                *resp_u32 = cfg->tek_rolling_period;
                 resp_len  = 4 + 1;
                 break;
 
+            // GAEN : Attenuation thresholds
+            case CMD_SET_ATT_THRESH:
+            case CMD_GET_ATT_THRESH:
+                memcpy(resp_u8, cfg->att_thresholds, sizeof(cfg->att_thresholds));
+                resp_len  = sizeof(cfg->att_thresholds) + 1;
+                break;
+
             // System : Device name
             case CMD_SET_DEVICENAME:
             case CMD_GET_DEVICENAME:
-                memcpy(resp_u8, ct_priv.device_name, sizeof(ct_priv.device_name));
-                resp_u8[sizeof(ct_priv.device_name)] = '\0';
-                resp_len  = sizeof(ct_priv.device_name) + 1;
-                LOG_INF("DeviceName: %s/%s", resp_u8, ct_priv.device_name);
+                memcpy(resp_u8, cfg->device_name, sizeof(cfg->device_name));
+                resp_u8[sizeof(cfg->device_name)] = '\0';
+                resp_len  = sizeof(cfg->device_name) + 1;
+                LOG_INF("DeviceName: %s/%s", resp_u8, cfg->device_name);
                 break;
 
+            // Debug : log received RPIs
+            case CMD_SET_DEBUG:
+            case CMD_GET_DEBUG:
+                *resp_u8  = ct_app_en_get_debug() ? 1 : 0;
+                resp_len  = 1 + 1;
+                break;
+
+            // Debugging : trace records following the requested record
+            case CMD_GET_TRACE:
+            {
+                uint32_t seq = sys_get_le32(&data[1]);
+                uint8_t n = ct_trace_read(&seq,
+                                (ct_trace_rec_t *) &resp_u8[4], CMD_TRACE_RECS);
+                sys_put_le32(seq, resp_u8);
+                resp_len  = 4 + (n * sizeof(ct_trace_rec_t)) + 1;
+                break;
+            }
+
             // unknown command..
             default:
                 LOG_ERR("unknown cmd: %02x",data[cmd_idx]);
@@ -397,13 +705,122 @@ static void enc_app_notify(struct bt_conn *conn, uint8_t mask,
         resp[cmd_idx] |= CMD_MASK_ERR;
     }
 
-    bt_gatt_notify(NULL, &_enc_bt_service.attrs[2], resp, resp_len);
+    return resp_len;
+}
+
+
+
+/************* RPI EXPORT WINDOW ***************/
+
+// Staging window holding consecutive RPIs in export-format. The window is
+//  (re)filled by the database in bulk, so read-requests only need to copy
+//  bytes from this window.
+// ==> one offload at a time: the window is owned by the connection reading
+//     RPIs until its readout completes or it disconnects. Reads of other
+//     connections are rejected meanwhile, so they can not thrash the window.
+static uint8_t  _enc_export_buf[CT_DB_EXPORT_BUF_SIZE];
+static struct bt_conn *_enc_export_conn;
+// database-index of first RPI in window
+static uint32_t _enc_export_first;
+// number of RPIs in window
+static uint16_t _enc_export_cnt;
+
+// Number of RPIs which are part of the database snapshot
+// ==> RPIs observed during the session (EN concurrent) are not exported.
+static uint32_t _enc_export_rpi_cnt;
+
+// Export benchmark, see enc_export_get_stats.
+static struct {
+    uint32_t bytes;
+    uint32_t cycles;
+    uint32_t fills;
+} _enc_export_stats;
+
+static void enc_export_invalidate(void)
+{
+    _enc_export_first = 0;
+    _enc_export_cnt   = 0;
 }
 
+// Ensure the n'th RPI is available in the export window.
+static int enc_export_fetch(uint32_t n)
+{
+    if ((n >= _enc_export_first) &&
+            (n < (_enc_export_first + _enc_export_cnt))) {
+        return 0;
+    }
 
+    int err = ct_db_rpi_export(n, _enc_export_buf, sizeof(_enc_export_buf),
+                    &_enc_export_cnt);
+    if (err != 0 || _enc_export_cnt == 0) {
+        enc_export_invalidate();
+        return (err != 0) ? err : -EINVAL;
+    }
+
+    _enc_export_first = n;
+    _enc_export_stats.fills++;
+    return 0;
+}
+
+// Freeze RPI indices in the database, so EN can continue to add RPIs.
+static void enc_export_snapshot(void)
+{
+    ct_db_snapshot_begin();
+    ct_db_rpi_get_cnt(&_enc_export_rpi_cnt);
+    enc_export_invalidate();
+}
+
+// Build the first export window and reset the benchmark.
+static void enc_export_start(void)
+{
+    memset(&_enc_export_stats, 0, sizeof(_enc_export_stats));
+    _enc_export_conn = NULL;
+    enc_export_snapshot();
+
+    uint32_t start = k_cycle_get_32();
+    (void) enc_export_fetch(0);
+    _enc_export_stats.cycles += k_cycle_get_32() - start;
+}
+
+static void enc_export_get_stats(enc_export_stats_t *stats)
+{
+    stats->bytes  = _enc_export_stats.bytes;
+    stats->fills  = _enc_export_stats.fills;
+    stats->cpu_us = k_cyc_to_us_floor32(_enc_export_stats.cycles);
+    stats->rate   = (stats->cpu_us > 0) ?
+                (uint32_t)((1000ULL * stats->bytes) / stats->cpu_us) : 0;
+}
+
+static void enc_export_report(void)
+{
+    enc_export_stats_t stats;
+    enc_export_get_stats(&stats);
+
+    LOG_INF("RPI export: %u bytes, %u fills, %u us cpu, %u bytes/ms",
+                    stats.bytes, stats.fills, stats.cpu_us, stats.rate);
+}
 
 /************* BT READ RPI AND TEK  ***************/
 
+// Write the header of a readout chunk in the version of 'enc_conn'.
+// > 'idx' is the index of the first item, 'cnt' the number of items in the
+//   chunk and 'rem' the number of items remaining after the chunk.
+static void enc_readout_hdr(const enc_conn_t *enc_conn, uint8_t *buf,
+                uint32_t idx, uint16_t cnt, uint32_t rem)
+{
+    if (enc_conn->readout_ver == ENC_READOUT_V1) {
+        buf[0] = ENC_READOUT_V1;
+        buf[1] = ENC_READOUT_HDR_LEN(ENC_READOUT_V1);
+        sys_put_le16(cnt, &buf[2]);
+        sys_put_le32(idx, &buf[4]);
+        sys_put_le32(rem, &buf[8]);
+    } else {
+        sys_put_le16(idx, &buf[0]);
+        sys_put_le16(cnt, &buf[2]);
+        sys_put_le16(rem, &buf[4]);
+    }
+}
+
 static ssize_t enc_bt_rpi_on_read(struct bt_conn *conn,
                 const struct bt_gatt_attr *attr,
                 void *b,
@@ -412,6 +829,7 @@ static ssize_t enc_bt_rpi_on_read(struct bt_conn *conn,
 {
     LOG_DBG("Attribute read, handle: %u, conn: %p", attr->handle, conn );
     uint8_t *buf = (uint8_t*)b;
+    uint32_t cycles = k_cycle_get_32();
 
     // Does connection exists? approved by user
     enc_conn_t* enc_conn;
@@ -428,17 +846,25 @@ static ssize_t enc_bt_rpi_on_read(struct bt_conn *conn,
     //  As we cannot push all data at once, we need to recompute on each request
     //  which (part of which) RPI needs to be copied to the provided buffer.
 
-    // 1) Compute number of RPIs in DB
-    uint16_t cnt;
-    ct_db_rpi_get_cnt(&cnt);
+    // 1) Number of RPIs in DB-snapshot (addressable by the readout header)
+    uint32_t cnt = MIN(_enc_export_rpi_cnt,
+                        ENC_READOUT_CNT_MAX(enc_conn->readout_ver));
 
     // Do we have data?
     if (cnt == 0) {
         return 0;
     }
 
-    // 2) Total amount fo data to be transferred.
-    int value_len = cnt * sizeof(bt_rpi_t);
+    // Another connection is offloading, see _enc_export_conn.
+    if ((_enc_export_conn != NULL) && (_enc_export_conn != conn)) {
+        return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+    }
+    _enc_export_conn = conn;
+
+    // 2) Total amount fo data to be transferred, in the item format of the
+    //    readout version.
+    const uint16_t rpi_size = ENC_READOUT_RPI_SIZE(enc_conn->readout_ver);
+    int value_len = cnt * rpi_size;
 
     LOG_DBG(">> cnt:%d, val_len:%d\n", cnt, value_len );
 
@@ -449,20 +875,22 @@ static ssize_t enc_bt_rpi_on_read(struct bt_conn *conn,
 
     // max read-limit in BLE = 512 bytes
     const uint16_t limit     = 512;
-    const uint16_t header    = 6;
+    const uint16_t header    = ENC_READOUT_HDR_LEN(enc_conn->readout_ver);
     // number of 'full' readouts we can do. (floored!)
     const uint8_t  readouts  = limit/buf_len;
+    // read within the current block (for tracing).
+    const uint8_t  blk_read  = MIN(offset/buf_len, UINT8_MAX);
     // number of bytes we can transfer in these readouts
     const uint16_t max_bytes = readouts*buf_len;
     // number of RPI's we can read in these readouts (floored!)
-    const uint16_t max_rpis  = (max_bytes - header) / sizeof(bt_rpi_t);
+    const uint16_t max_rpis  = (max_bytes - header) / rpi_size;
 
     // remaining number of RPI's which still need to be transferred
     // => when no RPI's remain, start over again
     if (enc_conn->idx_rpi >= cnt) {
         enc_conn->idx_rpi = 0;
     }
-    uint16_t rem_rpis  = cnt - enc_conn->idx_rpi;
+    uint32_t rem_rpis  = cnt - enc_conn->idx_rpi;
 
     // number of RPI's which are read in read-limit
     // (limited by remaining number of RPI's)
@@ -474,52 +902,70 @@ static ssize_t enc_bt_rpi_on_read(struct bt_conn *conn,
     if (offset > 0) {
         offset -= header;
     }
-    uint16_t rpi_idx = offset % sizeof(bt_rpi_t);
-    uint16_t rpi_num = (offset - rpi_idx) / sizeof(bt_rpi_t);
+    uint16_t rpi_idx = offset % rpi_size;
+    uint16_t rpi_num = (offset - rpi_idx) / rpi_size;
 
     // 5) Compute number of bytes which will be transferred [in this read-out].
-    const int read_len = MIN(buf_len, (read_rpis*sizeof(bt_rpi_t)) - offset);
+    const int read_len = MIN(buf_len, (read_rpis*rpi_size) - offset);
 
     LOG_DBG(">> lim:%d ro:%d mx-b:%d mx-rpi:%d rem-rpi:%d rd-rpi:%d\n",
                 limit, readouts, max_bytes, max_rpis, rem_rpis, read_rpis);
     LOG_DBG(">> idx:%d num:%d read:%d\n", rpi_idx, rpi_num, read_len);
 
-    bt_rpi_t bt_rpi;
     int i = 0;
 
     //6) For first read of block we need to add header!
     if (offset == 0) {
         i += header;
-        // Starting index of first RPI
-        memcpy( &buf[0], (uint8_t*)&enc_conn->idx_rpi, 2);
-        // Number of RPI's in this readout
-        memcpy( &buf[2], (uint8_t*)&read_rpis, 2);
-        // Remaining RPI's (after current readout is completed)
+        // Starting index of first RPI, number of RPI's in this readout and
+        //  remaining RPI's (after current readout is completed)
         rem_rpis -= read_rpis;
-        memcpy( &buf[4], (uint8_t*)&rem_rpis, 2);
+        enc_readout_hdr(enc_conn, buf, enc_conn->idx_rpi, read_rpis, rem_rpis);
     }
 
-    // 7) Copy RPI data..
+    // 7) Copy RPI data from export window..
+    uint32_t rpi = enc_conn->idx_rpi + rpi_num;
     do {
         uint16_t len;
 
-        // Get RPI
-        ct_db_rpi_get(rpi_num + enc_conn->idx_rpi, bt_rpi.rpi, bt_rpi.aem,
-                        &bt_rpi.rssi, &bt_rpi.cnt, &bt_rpi.ival_last);
+        // Ensure RPI is available in export window
+        if (enc_export_fetch(rpi) != 0) {
+            LOG_ERR("RPI export failed @ %d", rpi);
+            return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+        }
 
-        // Compute and Copy RPI-remainer
-        len = MIN(sizeof(bt_rpi_t) - rpi_idx, read_len - i);
-        uint8_t *p = (uint8_t*) &bt_rpi;
-        memcpy( &buf[i], &p[rpi_idx], len);
+        // Copy as many bytes as possible from window, starting at RPI-remainder
+        // >> Smaller items (version 0) are copied one by one.
+        uint32_t win_idx = (rpi - _enc_export_first) * sizeof(bt_rpi_t) + rpi_idx;
+        uint32_t win_len = _enc_export_cnt * sizeof(bt_rpi_t);
+        if (rpi_size < sizeof(bt_rpi_t)) {
+            win_len = win_idx + (rpi_size - rpi_idx);
+        }
+        len = MIN(win_len - win_idx, read_len - i);
+        memcpy( &buf[i], &_enc_export_buf[win_idx], len);
         i+=len;      // Amount of data copied..
-        rpi_idx = 0; // Start at first byte for next RPI
-        rpi_num++;   // Copy next RPI
+
+        // Move to first RPI which has not been (fully) copied.
+        rpi_idx += len;
+        rpi     += rpi_idx / rpi_size;
+        rpi_idx  = rpi_idx % rpi_size;
     } while (i<read_len);
 
+    // number of RPIs (partially) copied in this read-block.
+    rpi_num = (rpi - enc_conn->idx_rpi) + ((rpi_idx > 0) ? 1 : 0);
     if (read_rpis == rpi_num)
         enc_conn->idx_rpi += rpi_num;
 
-    LOG_INF("RPI [off:%d buf:%d db:%d][read:%d==%d][%d]\n", offset, buf_len,
+    // Readout completed, another connection may offload.
+    if (enc_conn->idx_rpi >= cnt) {
+        _enc_export_conn = NULL;
+    }
+
+    _enc_export_stats.bytes  += read_len;
+    _enc_export_stats.cycles += k_cycle_get_32() - cycles;
+
+    ct_trace(CT_TRACE_ENC_RPI_READ, blk_read, read_len, enc_conn->idx_rpi);
+    LOG_DBG("RPI [off:%d buf:%d db:%d][read:%d==%d][%d]\n", offset, buf_len,
                     value_len, i, read_len, enc_conn->idx_rpi);
 
     // return amount of data which has been pushed to the provided buffer.
@@ -573,7 +1019,7 @@ static ssize_t enc_bt_tek_on_read(struct bt_conn *conn,
 
     // max read-limit in BLE = 512 bytes
     const uint16_t limit     = 512;
-    const uint16_t header    = 6;
+    const uint16_t header    = ENC_READOUT_HDR_LEN(enc_conn->readout_ver);
     // number of 'full' readouts we can do. (floored!)
     const uint8_t  readouts  = limit/buf_len;
     // number of bytes we can transfer in these readouts
@@ -607,13 +1053,10 @@ static ssize_t enc_bt_tek_on_read(struct bt_conn *conn,
     //6) For first read of block we need to add header!
     if (offset == 0) {
         i += header;
-        // Starting index of first TEK
-        memcpy( &buf[0], (uint8_t*)&enc_conn->idx_tek, 2);
-        // Number of TEK's in this readout
-        memcpy( &buf[2], (uint8_t*)&read_teks, 2);
-        // Remaining TEK's (after current readout is completed)
+        // Starting index of first TEK, number of TEK's in this readout and
+        //  remaining TEK's (after current readout is completed)
         rem_teks -= read_teks;
-        memcpy( &buf[4], (uint8_t*)&rem_teks, 2);
+        enc_readout_hdr(enc_conn, buf, enc_conn->idx_tek, read_teks, rem_teks);
     }
 
     // 7) Copy TEK data..
@@ -644,29 +1087,44 @@ static ssize_t enc_bt_tek_on_read(struct bt_conn *conn,
 
 /************* BT CMD HANDLING  ***************/
 
-
-static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
-                const struct bt_gatt_attr *attr,
-                const void *buf,
-                uint16_t len,
-                uint16_t offset,
-                uint8_t flags)
+// Clear the database as requested by a CMD_CLEAR_DB_xx command. The export
+//  continues on a new snapshot of the remaining RPIs.
+static int enc_db_clear(uint8_t cmd)
 {
-    LOG_DBG("Received cmd data, handle %d, conn %p", attr->handle, conn);
+    int err;
 
-    // Does connection exists? approved by user
-    enc_conn_t* enc_conn;
-    if (enc_bt_conn_get(conn, &enc_conn) != 0) {
-        LOG_ERR("Unknown connection");
-        return len;
+    enc_export_invalidate();
+    switch (cmd) {
+        case CMD_CLEAR_DB_ALL:
+            err = ct_db_clear();
+            break;
+        case CMD_CLEAR_DB_RPI:
+            err = ct_db_rpi_clear();
+            break;
+        case CMD_CLEAR_DB_TEK:
+            err = ct_db_tek_clear();
+            break;
+        default:
+            err = -EINVAL;
+            break;
     }
+    enc_export_snapshot();
 
-    if(len < 1) {
-        LOG_ERR("ENC_APP: Empty command received");
-        return len;
-    }
+    return err;
+}
 
-    const uint8_t *b = (uint8_t*) buf;
+
+// Compose response of the command which is executed in 'enc_cmd_exec'
+#define ENC_CMD_RESP(_mask) \
+    enc_app_resp(cfg, enc_conn, (_mask), buf, len, resp)
+
+// Execute a single command on settings 'cfg' and session 'enc_conn'.
+// => response is stored in 'resp' (CMD_RESP_LEN_MAX bytes), returns its length.
+static uint8_t enc_cmd_exec(enc_cfg_t *cfg, enc_conn_t *enc_conn,
+                const uint8_t *buf, uint16_t len, uint8_t *resp)
+{
+    const uint8_t *b = buf;
+    uint8_t resp_len = 0;
 
     //different value representation
     uint8_t  *buf_u8  = (uint8_t *) &b[1];
@@ -680,60 +1138,39 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         case CMD_PING:
         case CMD_GET_RPI_IDX:
         case CMD_GET_TEK_IDX:
+        case CMD_GET_READOUT_VER:
+        case CMD_GET_RPI_FORMAT:
         case CMD_GET_ADV_PERIOD:
         case CMD_GET_SCAN_PERIOD:
         case CMD_GET_ADV_IVAL_MIN:
         case CMD_GET_ADV_IVAL_MAX:
+        case CMD_GET_SCHED_STATS:
+        case CMD_GET_ENERGY:
+        case CMD_GET_ENERGY_IO:
+        case CMD_GET_CLOCK_DRIFT:
+        case CMD_GET_DB_INTEGRITY:
+        case CMD_GET_DB_WEAR:
+        case CMD_GET_EXPORT_STATS:
         case CMD_GET_TEK_IVAL:
         case CMD_GET_TEK_PERIOD:
+        case CMD_GET_ATT_THRESH:
         case CMD_GET_DEVICENAME:
+        case CMD_GET_DEBUG:
         {
             LOG_DBG("CMD_GET: %02x",b[0]);
-            enc_app_notify(conn, CMD_MASK_OK, buf, len);
+            resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             break;
         }
 
         case CMD_CLEAR_DB_ALL:
-        {
-            LOG_DBG("CMD_CLEAR_DB_ALL, %d", len);
-            if(len != 1) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-            } else {
-                if (ct_db_clear() != 0) {
-                    enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-                } else {
-                    enc_app_notify(conn, CMD_MASK_OK, buf, len);
-                }
-            }
-            break;
-        }
-
         case CMD_CLEAR_DB_RPI:
-        {
-            LOG_DBG("CMD_CLEAR_DB_RPI, %d", len);
-            if(len != 1) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-            } else {
-                if (ct_db_rpi_clear() != 0) {
-                    enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-                } else {
-                    enc_app_notify(conn, CMD_MASK_OK, buf, len);
-                }
-            }
-            break;
-        }
-
         case CMD_CLEAR_DB_TEK:
         {
-            LOG_DBG("CMD_CLEAR_DB_TEK, %d", len);
-            if(len != 1) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+            LOG_DBG("CMD_CLEAR_DB: %02x, %d", b[0], len);
+            if ((len != 1) || (enc_db_clear(b[0]) != 0)) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                if (ct_db_tek_clear() != 0) {
-                    enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-                } else {
-                    enc_app_notify(conn, CMD_MASK_OK, buf, len);
-                }
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -741,11 +1178,15 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         case CMD_SET_RPI_IDX:
         {
             LOG_DBG("CMD_SET_RPI_IDX");
-            if(len != 3) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
-            } else {
+            if(len == 3) {
                 enc_conn->idx_rpi = *buf_u16;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            } else if ((len == 5) &&
+                        (enc_conn->readout_ver == ENC_READOUT_V1)) {
+                enc_conn->idx_rpi = *buf_u32;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            } else {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             }
             break;
         }
@@ -754,10 +1195,22 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_TEK_IDX");
             if(len != 3) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
                 enc_conn->idx_tek = *buf_u16;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            }
+            break;
+        }
+
+        case CMD_SET_READOUT_VER:
+        {
+            LOG_DBG("CMD_SET_READOUT_VER");
+            if((len != 2) || (*buf_u8 > ENC_READOUT_V1)) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
+            } else {
+                enc_conn->readout_ver = *buf_u8;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -766,10 +1219,10 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_ADV_PERIOD");
             if(len != 5) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.adv_period = *buf_u32;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->adv_period = *buf_u32;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -778,10 +1231,10 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_SCAN_PERIOD");
             if(len != 5) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.scan_period = *buf_u32;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->scan_period = *buf_u32;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -790,10 +1243,10 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_ADV_IVAL_MIN");
             if(len != 3) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.adv_ival_min = *buf_u16;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->adv_ival_min = *buf_u16;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -802,10 +1255,10 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_ADV_IVAL_MAX");
             if(len != 3) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.adv_ival_max = *buf_u16;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->adv_ival_max = *buf_u16;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -814,10 +1267,10 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_TEK_IVAL");
             if(len != 5) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.tek_rolling_interval = *buf_u32;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->tek_rolling_interval = *buf_u32;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -826,10 +1279,27 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         {
             LOG_DBG("CMD_SET_TEK_PERIOD");
             if(len != 5) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                ct_priv.tek_rolling_period = *buf_u32;
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                cfg->tek_rolling_period = *buf_u32;
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            }
+            break;
+        }
+
+        case CMD_SET_ATT_THRESH:
+        {
+            LOG_DBG("CMD_SET_ATT_THRESH");
+            bool valid = (len == (sizeof(cfg->att_thresholds) + 1));
+            // thresholds should be ascending
+            for (int i = 1; valid && (i < sizeof(cfg->att_thresholds)); i++) {
+                valid = (buf_u8[i] > buf_u8[i - 1]);
+            }
+            if(!valid) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
+            } else {
+                memcpy(cfg->att_thresholds, buf_u8, sizeof(cfg->att_thresholds));
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
@@ -837,24 +1307,263 @@ static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
         case CMD_SET_DEVICENAME:
         {
             LOG_DBG("CMD_SET_DEVICENAME");
-            if(len != (sizeof(ct_priv.device_name) + 1 )) {
-                enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+            if(len != (sizeof(cfg->device_name) + 1 )) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
             } else {
-                memcpy(ct_priv.device_name, buf_u8, sizeof(ct_priv.device_name));
-                enc_app_notify(conn, CMD_MASK_OK, buf, len);
+                memcpy(cfg->device_name, buf_u8, sizeof(cfg->device_name));
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            }
+            break;
+        }
+
+        case CMD_GET_TRACE:
+        {
+            LOG_DBG("CMD_GET_TRACE");
+            if(len != 5) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
+            } else {
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
+            }
+            break;
+        }
+
+        case CMD_SET_DEBUG:
+        {
+            LOG_DBG("CMD_SET_DEBUG");
+            if(len != 2 || buf_u8[0] > 1) {
+                resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
+            } else {
+                ct_app_en_set_debug(buf_u8[0] == 1);
+                resp_len = ENC_CMD_RESP(CMD_MASK_OK);
             }
             break;
         }
 
         default:
             LOG_WRN("unknown CMD received");
-            enc_app_notify(conn, CMD_MASK_ERR, buf, len);
+            resp_len = ENC_CMD_RESP(CMD_MASK_ERR);
+            break;
+    }
+
+    return resp_len;
+}
+
+// Commands which are allowed in a batch: PING and all GET/SET commands, except
+//  SET_DEBUG which takes effect immediately and can not be rolled back.
+static bool enc_cmd_batch_allowed(uint8_t cmd)
+{
+    switch (cmd) {
+        case CMD_CLEAR_DB_ALL:
+        case CMD_CLEAR_DB_RPI:
+        case CMD_CLEAR_DB_TEK:
+        case CMD_SET_DEBUG:
+        case CMD_BATCH:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Commands which modify settings that are stored in NVM.
+static bool enc_cmd_is_setting(uint8_t cmd)
+{
+    switch (cmd) {
+        case CMD_SET_ADV_PERIOD:
+        case CMD_SET_SCAN_PERIOD:
+        case CMD_SET_ADV_IVAL_MIN:
+        case CMD_SET_ADV_IVAL_MAX:
+        case CMD_SET_TEK_IVAL:
+        case CMD_SET_TEK_PERIOD:
+        case CMD_SET_ATT_THRESH:
+        case CMD_SET_DEVICENAME:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Execute a batch of commands and respond with a single notification.
+// Request  : [CMD_BATCH] n * [cmd][len][payload]
+// Response : [CMD_BATCH | mask] n * [cmd | mask][len][value]
+//
+// All commands are executed on a staged copy of the settings and the session.
+// Only when all commands succeed the copies are applied and the settings are
+// stored with a single settings_save(). Otherwise, nothing is applied.
+static void enc_cmd_batch(struct bt_conn *conn, enc_conn_t *enc_conn,
+                const uint8_t *b, uint16_t len)
+{
+    enc_cfg_t cfg;
+    enc_cfg_get(&cfg);
+    enc_conn_t session = *enc_conn;
+
+    uint8_t resp[CMD_BATCH_LEN_MAX];
+    uint16_t resp_len = 1;
+    const uint16_t resp_max = MIN(sizeof(resp), bt_gatt_get_mtu(conn) - 3);
+
+    bool ok   = true;
+    bool save = false;
+
+    uint16_t i = 1;
+    while (i < len) {
+        // Malformed TLV?
+        if (((len - i) < 2) || ((len - i - 2) < b[i+1])) {
+            LOG_ERR("CMD_BATCH: malformed @ %d", i);
+            ok = false;
             break;
+        }
+
+        const uint8_t cmd     = b[i];
+        const uint8_t cmd_len = b[i+1];
+
+        // Single command representation: [cmd][payload]
+        uint8_t req[CMD_RESP_LEN_MAX];
+        uint8_t sub[CMD_RESP_LEN_MAX];
+        uint8_t sub_len;
+
+        if (enc_cmd_batch_allowed(cmd) && (cmd_len < sizeof(req))) {
+            req[0] = cmd;
+            memcpy(&req[1], &b[i+2], cmd_len);
+            sub_len = enc_cmd_exec(&cfg, &session, req, cmd_len + 1, sub);
+        } else {
+            sub[0]  = cmd | CMD_MASK_ERR;
+            sub_len = 1;
+        }
+
+        if (sub[0] & CMD_MASK_ERR) {
+            ok = false;
+        } else if (enc_cmd_is_setting(cmd)) {
+            save = true;
+        }
+
+        // Append response: [cmd|mask][len][value]
+        if ((resp_len + 1 + sub_len) > resp_max) {
+            LOG_ERR("CMD_BATCH: response exceeds %d bytes", resp_max);
+            ok = false;
+            break;
+        }
+        resp[resp_len++] = sub[0];
+        resp[resp_len++] = sub_len - 1;
+        memcpy(&resp[resp_len], &sub[1], sub_len - 1);
+        resp_len += sub_len - 1;
+
+        i += 2 + cmd_len;
+    }
+
+    resp[0] = CMD_BATCH | (ok ? CMD_MASK_OK : CMD_MASK_ERR);
+
+    // Apply all or nothing..
+    if (ok) {
+        *enc_conn = session;
+        if (save) {
+            enc_cfg_commit(&cfg);
+            settings_save();
+        }
+    }
+
+    enc_app_notify(conn, resp, resp_len);
+}
+
+static ssize_t enc_bt_cmd_on_receive(struct bt_conn *conn,
+                const struct bt_gatt_attr *attr,
+                const void *buf,
+                uint16_t len,
+                uint16_t offset,
+                uint8_t flags)
+{
+    LOG_DBG("Received cmd data, handle %d, conn %p", attr->handle, conn);
+
+    // Does connection exists? approved by user
+    enc_conn_t* enc_conn;
+    if (enc_bt_conn_get(conn, &enc_conn) != 0) {
+        LOG_ERR("Unknown connection");
+        return len;
+    }
+
+    if(len < 1) {
+        LOG_ERR("ENC_APP: Empty command received");
+        return len;
+    }
+
+    const uint8_t *b = (uint8_t*) buf;
+
+    if (b[0] == CMD_BATCH) {
+        enc_cmd_batch(conn, enc_conn, b, len);
+    } else {
+        uint8_t resp[CMD_RESP_LEN_MAX];
+        enc_cfg_t cfg;
+        enc_cfg_get(&cfg);
+        uint8_t resp_len = enc_cmd_exec(&cfg, enc_conn, b, len, resp);
+        if (enc_cmd_is_setting(b[0]) && !(resp[0] & CMD_MASK_ERR)) {
+            enc_cfg_commit(&cfg);
+        }
+        enc_app_notify(conn, resp, resp_len);
     }
 
     return len;
 }
 
+/************* BT ADVERTISEMENT ***************/
+
+#if defined(CONFIG_CT_EN_CONCURRENT)
+// EN keeps using the legacy advertiser, ENC uses its own advertising set.
+static struct bt_le_ext_adv *_enc_bt_adv;
+#endif
+
+static int enc_bt_adv_start(void)
+{
+#if defined(CONFIG_CT_EN_CONCURRENT)
+    int err;
+    if (_enc_bt_adv == NULL) {
+        err = bt_le_ext_adv_create(BT_LE_ADV_CONN, NULL, &_enc_bt_adv);
+        if (err) {
+            return err;
+        }
+    }
+
+    err = bt_le_ext_adv_set_data(_enc_bt_adv,
+                _enc_bt_ad, ARRAY_SIZE(_enc_bt_ad),
+                _enc_bt_sd, ARRAY_SIZE(_enc_bt_sd));
+    if (err) {
+        return err;
+    }
+
+    return bt_le_ext_adv_start(_enc_bt_adv, BT_LE_EXT_ADV_START_DEFAULT);
+#else
+    return bt_le_adv_start(BT_LE_ADV_CONN,
+                _enc_bt_ad, ARRAY_SIZE(_enc_bt_ad),
+                _enc_bt_sd, ARRAY_SIZE(_enc_bt_sd));
+#endif
+}
+
+static int enc_bt_adv_stop(void)
+{
+#if defined(CONFIG_CT_EN_CONCURRENT)
+    if (_enc_bt_adv == NULL) {
+        return 0;
+    }
+    return bt_le_ext_adv_stop(_enc_bt_adv);
+#else
+    return bt_le_adv_stop();
+#endif
+}
+
+// An advertising set stops once a connection is made, whereas the legacy
+// advertiser is resumed by the stack.
+static void enc_bt_adv_resume(void)
+{
+#if defined(CONFIG_CT_EN_CONCURRENT)
+    if (_enc_state != APP_STATE_ACTIVE ||
+            enc_bt_conn_active_cnt() >= CONFIG_BT_MAX_PAIRED) {
+        return;
+    }
+
+    int err = bt_le_ext_adv_start(_enc_bt_adv, BT_LE_EXT_ADV_START_DEFAULT);
+    if (err && err != -EALREADY) {
+        LOG_ERR("Advertising failed to resume for config (err %d)", err);
+    }
+#endif
+}
+
 /************* BT SERVICES AND SETUP  ***************/
 
 static void connected(struct bt_conn *conn, uint8_t err)
@@ -872,6 +1581,8 @@ static void connected(struct bt_conn *conn, uint8_t err)
         }
 
         enc_conn->conn    = bt_conn_ref(conn);
+        enc_conn->notify_enabled = false;
+        enc_conn->readout_ver = ENC_READOUT_V0;
         enc_conn->idx_rpi = 0;
         enc_conn->idx_tek = 0;
 
@@ -883,6 +1594,23 @@ static void connected(struct bt_conn *conn, uint8_t err)
         if (bt_conn_set_security(conn, BT_SECURITY_L4 | BT_SECURITY_FORCE_PAIR)) {
             LOG_ERR("Failed to set security\n");
         }
+
+#if defined(CONFIG_CT_EN_CONCURRENT)
+        // EN aligns its scan windows to the interval in use, until the
+        //  central accepts the requested interval.
+        struct bt_conn_info info;
+        if (bt_conn_get_info(conn, &info) == 0) {
+            ct_app_en_set_conn_ival(info.le.interval);
+        }
+
+        struct bt_le_conn_param param = BT_LE_CONN_PARAM_INIT(
+                    CT_ENC_CONN_IVAL, CT_ENC_CONN_IVAL, 0, 400);
+        if (bt_conn_le_param_update(conn, &param)) {
+            LOG_WRN("Failed to update connection parameters");
+        }
+#endif
+
+        enc_bt_adv_resume();
     }
 }
 
@@ -890,6 +1618,11 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
     LOG_DBG("Disconnected (reason %u)", reason);
 
+    // Release the export window, see _enc_export_conn.
+    if (_enc_export_conn == conn) {
+        _enc_export_conn = NULL;
+    }
+
     enc_conn_t* enc_conn;
     if (enc_bt_conn_get(conn, &enc_conn) == 0) {
         bt_conn_unref(enc_conn->conn);
@@ -899,7 +1632,17 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
     }
 
     // extend ENC-APP timeout so there is more time to (re)connect
-    APP_STATE_EXTEND(&_enc_state_work,K_SECONDS(30));
+    // => only when no other session is still active, as the connected-state
+    //     has cleared the timeout.
+    if (enc_bt_conn_active_cnt() == 0) {
+        APP_STATE_EXTEND(&_enc_state_work,K_SECONDS(30));
+#if defined(CONFIG_CT_EN_CONCURRENT)
+        // EN can use its regular scan windows again.
+        ct_app_en_set_conn_ival(0);
+#endif
+    }
+
+    enc_bt_adv_resume();
 
     ct_app_event(CT_APP_ENC, CT_EVENT_DISCONNECTED);
 
@@ -950,7 +1693,6 @@ static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
 {
     LOG_ERR("Pairing Failed (%d). Disconnecting.\n", reason);
     bt_conn_disconnect(conn, BT_HCI_ERR_AUTH_FAIL);
-    APP_STATE_EXTEND(&_enc_state_work,K_SECONDS(30));
 }
 
 static struct bt_conn_auth_cb auth_cb_display = {
@@ -962,9 +1704,21 @@ static struct bt_conn_auth_cb auth_cb_display = {
 };
 
 
+#if defined(CONFIG_CT_EN_CONCURRENT)
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+                uint16_t latency, uint16_t timeout)
+{
+    LOG_DBG("Connection interval %u, latency %u", interval, latency);
+    ct_app_en_set_conn_ival(interval);
+}
+#endif
+
 static struct bt_conn_cb _conn_callbacks = {
     .connected = connected,
     .disconnected = disconnected,
+#if defined(CONFIG_CT_EN_CONCURRENT)
+    .le_param_updated = le_param_updated,
+#endif
 #if defined(CONFIG_BT_SMP)
     .identity_resolved = identity_resolved,
     .security_changed = security_changed,
@@ -976,16 +1730,21 @@ static struct bt_conn_cb _conn_callbacks = {
 
 static void app_enc_state_start(struct k_work *work)
 {
+#if !defined(CONFIG_CT_EN_CONCURRENT)
     bt_le_scan_stop();
     bt_le_adv_stop();
+#endif
 
-    //clear notifcation flag
-    _enc_bt_notify_enabled = false;
+    //clear notifcation flags
+    for(int i=0;i<CONFIG_BT_MAX_PAIRED;i++) {
+        _enc_bt_conn[i].notify_enabled = false;
+    }
 
     LOG_INF("ENC APP start");
+    ct_energy_enc(true);
 
-    // Sample battery.
-    int batt_mV = battery_sample();
+    // Filtered battery voltage, sampled by EN or at boot.
+    int batt_mV = battery_get_mV();
     LOG_DBG("BATT: %d [mV]", batt_mV);
     if(batt_mV >= 0) {
         int batt_pptt = battery_level_pptt(batt_mV, CT_BATT_TYPE);
@@ -993,15 +1752,17 @@ static void app_enc_state_start(struct k_work *work)
         LOG_DBG("BATT: %d [pptt]\n", batt_pptt);
     }
 
+    // Snapshot the database and fetch the first block of RPIs so the first
+    //  read can be served directly.
+    enc_export_start();
+
     // start config advertisement (connect-able)
     bt_gatt_service_register(&_enc_bt_service);
     bt_gatt_ctsa_start();
     bt_gatt_disa_start();
     bt_gatt_basa_start();
 
-    int err = bt_le_adv_start(BT_LE_ADV_CONN,
-                _enc_bt_ad, ARRAY_SIZE(_enc_bt_ad),
-                _enc_bt_sd, ARRAY_SIZE(_enc_bt_sd));
+    int err = enc_bt_adv_start();
     if (err) {
         LOG_ERR("Advertising failed to start for config (err %d)", err);
     }
@@ -1018,7 +1779,7 @@ static void app_enc_state_finish(struct k_work *work)
     LOG_INF("ENC APP stop");
     _enc_state = APP_STATE_STOPPED;
 
-    bt_le_adv_stop();
+    enc_bt_adv_stop();
     bt_gatt_service_unregister(&_enc_bt_service);
     bt_gatt_ctsa_stop();
     bt_gatt_disa_stop();
@@ -1027,6 +1788,13 @@ static void app_enc_state_finish(struct k_work *work)
     //store any pending settings
     settings_save();
 
+    enc_export_report();
+
+    // release database, allowing postponed flash-operations.
+    ct_db_snapshot_end();
+
+    ct_energy_enc(false);
+
     ct_app_event(CT_APP_ENC, CT_EVENT_STOP);
 }
 
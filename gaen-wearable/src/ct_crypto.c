@@ -22,8 +22,6 @@
 #include <tinycrypt/hmac.h>
 #include <tinycrypt/hmac_prng.h>
 #include <tinycrypt/sha256.h>
-#include <tinycrypt/aes.h>
-#include <tinycrypt/ctr_mode.h>
 #include <tinycrypt/constants.h>
 
 #include <stdio.h>
@@ -43,7 +41,13 @@
 
 #include "ct.h"
 #include "ct_crypto.h"
+#include "ct_crypto_backend.h"
 #include "ct_settings.h"
+#include "ct_time.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(ct_crypto, LOG_LEVEL_INF);
 
 static uint8_t psk_rpik[] = "EN-RPIK";
 static uint8_t psk_rpi[]  = "EN-RPI";
@@ -60,7 +64,7 @@ static uint32_t ct_crypto_intervalNumber(uint64_t time) {
 uint32_t ct_crypto_intervalNumber_now(void)
 {
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
+    ct_time_get(&ts);
     return ct_crypto_intervalNumber(ts.tv_sec);
 }
 
@@ -164,7 +168,6 @@ int ct_crypto_calc_rpik(uint8_t *tek, uint8_t *rpik)
 int ct_crypto_calc_rpi(uint32_t enin_j, uint8_t *rpik, uint8_t *rpi)
 {
     uint8_t padding[16];
-    struct tc_aes_key_sched_struct s;
 
     for(int i=0;i<6;i++)
         padding[i] = psk_rpi[i];
@@ -183,10 +186,7 @@ int ct_crypto_calc_rpi(uint32_t enin_j, uint8_t *rpik, uint8_t *rpi)
     padding[12] = (enin_j & 0xFF000000) >> 24;
 #endif
 
-    (void) tc_aes128_set_encrypt_key(&s, rpik);
-    (void) tc_aes_encrypt(rpi, padding, &s);
-
-    return 0;
+    return ct_crypto_aes128_ecb(rpik, padding, rpi);
 }
 
 
@@ -202,20 +202,22 @@ int ct_crypto_calc_aemk(uint8_t *tek, uint8_t *aemk)
 
 
 
-int ct_crypto_calc_aem(uint8_t *aemk, uint8_t *rpi, uint8_t *metadata,
+int ct_crypto_calc_aem(uint8_t *aemk, const uint8_t *rpi, uint8_t *metadata,
                     uint8_t *aem)
 {
-    struct tc_aes_key_sched_struct sched;
-
-    (void) tc_aes128_set_encrypt_key(&sched, aemk);
-    (void) tc_ctr_mode(aem, AEM_SIZE, metadata, META_SIZE, rpi, &sched);
-
-    return 0;
+    // AEM <== AES128-CTR(AEMK, RPI, Metadata)
+    // ==> the RPI is the initial counter block, it is not incremented in place.
+    return ct_crypto_aes128_ctr(aemk, rpi, metadata, aem, META_SIZE);
 }
 
 
 
 int ct_crypto_init(void)
 {
+    int err = ct_crypto_backend_init();
+    if (err) {
+        return err;
+    }
+
     return 0;
 }
@@ -100,11 +100,13 @@ int ct_crypto_calc_aemk(uint8_t *tek, uint8_t *aemk);
 * @brief Generate a new AEM
 *
 * @param [in]  aemk : pointer to a AEMK_SIZE-byte array containing the AEM-Key.
-* @param [in]  rpi  : pointer to a RPI_SIZE-byte array containing the RPI.
+* @param [in]  rpi  : pointer to a RPI_SIZE-byte array containing the RPI, used
+*                     as initial counter block (not modified).
 * @param [in]  meta : pointer to a META_SIZE-byte array containing the meta-data.
 * @param [out] aem  : pointer to a AEM_SIZE-byte array in which the AEM will be stored
 * @return 0 on success, negative errno code on failure.
 */
-int ct_crypto_calc_aem(uint8_t *aemk, uint8_t *rpi, uint8_t *meta, uint8_t *aem);
+int ct_crypto_calc_aem(uint8_t *aemk, const uint8_t *rpi, uint8_t *meta,
+                uint8_t *aem);
 
 #endif /* __CT_CRYPTO_H */
@@ -0,0 +1,271 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <device.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/byteorder.h>
+
+#if defined(CONFIG_CT_CRYPTO_AES_DRIVER)
+#include <crypto/cipher.h>
+#else
+#include <tinycrypt/aes.h>
+#include <tinycrypt/constants.h>
+#endif
+
+#include "ct_crypto_backend.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(ct_crypto_backend, LOG_LEVEL_INF);
+
+#define AES_BLOCK_SIZE   16
+#define HMAC_SHA256_SIZE 32
+
+/************* AES-128 ***************/
+
+#if defined(CONFIG_CT_CRYPTO_AES_DRIVER)
+
+#define AES_DRV_FLAGS (CAP_RAW_KEY | CAP_SEPARATE_IO_BUFS | CAP_SYNC_OPS)
+
+static const struct device *_aes_dev;
+
+// The cipher session of the last key. A key is used for many blocks (the
+//  RPIK for 144 RPIs, the AEMK for each AEM), so its session is kept open
+//  until another key is used.
+static struct cipher_ctx _aes_ctx;
+static uint8_t _aes_key[AES_BLOCK_SIZE];
+static bool _aes_session;
+K_MUTEX_DEFINE(_aes_lock);
+
+static int aes_init(void)
+{
+    _aes_dev = device_get_binding(CONFIG_CT_CRYPTO_AES_DRV_NAME);
+    if (!_aes_dev) {
+        LOG_ERR("Crypto driver %s not found", CONFIG_CT_CRYPTO_AES_DRV_NAME);
+        return -ENODEV;
+    }
+
+    if ((cipher_query_hwcaps(_aes_dev) & AES_DRV_FLAGS) != AES_DRV_FLAGS) {
+        LOG_ERR("Crypto driver %s lacks synchronous raw-key operations",
+                        CONFIG_CT_CRYPTO_AES_DRV_NAME);
+        _aes_dev = NULL;
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+// Open a session for 'key', unless it is the key of the current session.
+static int aes_session(const uint8_t *key)
+{
+    int err;
+
+    if (_aes_session && (memcmp(_aes_key, key, AES_BLOCK_SIZE) == 0)) {
+        return 0;
+    }
+
+    if (_aes_session) {
+        cipher_free_session(_aes_dev, &_aes_ctx);
+        _aes_session = false;
+    }
+
+    // The driver may refer to the key during the session: keep a copy.
+    memcpy(_aes_key, key, AES_BLOCK_SIZE);
+    memset(&_aes_ctx, 0, sizeof(_aes_ctx));
+    _aes_ctx.keylen         = AES_BLOCK_SIZE;
+    _aes_ctx.key.bit_stream = _aes_key;
+    _aes_ctx.flags          = AES_DRV_FLAGS;
+
+    err = cipher_begin_session(_aes_dev, &_aes_ctx, CRYPTO_CIPHER_ALGO_AES,
+                    CRYPTO_CIPHER_MODE_ECB, CRYPTO_CIPHER_OP_ENCRYPT);
+    if (err) {
+        memset(_aes_key, 0, sizeof(_aes_key));
+        return err;
+    }
+
+    _aes_session = true;
+    return 0;
+}
+
+int ct_crypto_aes128_ecb(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    int err;
+    struct cipher_pkt pkt = {
+        .in_buf      = (uint8_t *) in,
+        .in_len      = AES_BLOCK_SIZE,
+        .out_buf     = out,
+        .out_buf_max = AES_BLOCK_SIZE,
+    };
+
+    if (!_aes_dev) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&_aes_lock, K_FOREVER);
+    err = aes_session(key);
+    if (err == 0) {
+        err = cipher_block_op(&_aes_ctx, &pkt);
+    }
+    k_mutex_unlock(&_aes_lock);
+
+    return err;
+}
+
+#else
+
+static int aes_init(void)
+{
+    return 0;
+}
+
+int ct_crypto_aes128_ecb(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    int err = 0;
+    struct tc_aes_key_sched_struct s;
+
+    if ((tc_aes128_set_encrypt_key(&s, key) != TC_CRYPTO_SUCCESS) ||
+            (tc_aes_encrypt(out, in, &s) != TC_CRYPTO_SUCCESS)) {
+        err = -EINVAL;
+    }
+
+    memset(&s, 0, sizeof(s));
+    return err;
+}
+
+#endif
+
+int ct_crypto_aes128_ctr(const uint8_t *key, const uint8_t *ctr,
+                const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t block[AES_BLOCK_SIZE];
+    uint8_t stream[AES_BLOCK_SIZE];
+    int err = 0;
+
+    memcpy(block, ctr, AES_BLOCK_SIZE);
+    uint32_t cnt = sys_get_be32(&block[12]);
+
+    for (size_t i = 0; i < len; i++) {
+        if ((i % AES_BLOCK_SIZE) == 0) {
+            err = ct_crypto_aes128_ecb(key, block, stream);
+            if (err) {
+                break;
+            }
+            sys_put_be32(++cnt, &block[12]);
+        }
+        out[i] = in[i] ^ stream[i % AES_BLOCK_SIZE];
+    }
+
+    memset(stream, 0, sizeof(stream));
+    return err;
+}
+
+/************* HMAC-SHA256 ***************/
+
+#if defined(CONFIG_CT_CRYPTO_HMAC_MBEDTLS)
+
+int ct_crypto_hmac_init(ct_crypto_hmac_t *h, const uint8_t *key,
+                size_t key_len)
+{
+    mbedtls_md_init(&h->md);
+
+    if ((mbedtls_md_setup(&h->md,
+                mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) ||
+            (mbedtls_md_hmac_starts(&h->md, key, key_len) != 0)) {
+        mbedtls_md_free(&h->md);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int ct_crypto_hmac_update(ct_crypto_hmac_t *h, const uint8_t *data,
+                size_t data_len)
+{
+    return (mbedtls_md_hmac_update(&h->md, data, data_len) == 0) ? 0 : -EINVAL;
+}
+
+int ct_crypto_hmac_final(ct_crypto_hmac_t *h, uint8_t *out)
+{
+    int err = mbedtls_md_hmac_finish(&h->md, out);
+
+    mbedtls_md_free(&h->md);
+    return (err == 0) ? 0 : -EINVAL;
+}
+
+#else
+
+int ct_crypto_hmac_init(ct_crypto_hmac_t *h, const uint8_t *key,
+                size_t key_len)
+{
+    memset(&h->tc, 0, sizeof(h->tc));
+
+    if (!tc_hmac_set_key(&h->tc, key, key_len) || !tc_hmac_init(&h->tc)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int ct_crypto_hmac_update(ct_crypto_hmac_t *h, const uint8_t *data,
+                size_t data_len)
+{
+    return tc_hmac_update(&h->tc, data, data_len) ? 0 : -EINVAL;
+}
+
+int ct_crypto_hmac_final(ct_crypto_hmac_t *h, uint8_t *out)
+{
+    int ok = tc_hmac_final(out, HMAC_SHA256_SIZE, &h->tc);
+
+    memset(&h->tc, 0, sizeof(h->tc));
+    return ok ? 0 : -EINVAL;
+}
+
+#endif
+
+/************* BACKEND ***************/
+
+const char *ct_crypto_backend_name(void)
+{
+#if defined(CONFIG_CT_CRYPTO_AES_DRIVER)
+#define AES_NAME CONFIG_CT_CRYPTO_AES_DRV_NAME
+#else
+#define AES_NAME "tinycrypt"
+#endif
+#if defined(CONFIG_CT_CRYPTO_HMAC_MBEDTLS)
+#define HMAC_NAME "mbedtls"
+#else
+#define HMAC_NAME "tinycrypt"
+#endif
+    return AES_NAME " / " HMAC_NAME;
+}
+
+int ct_crypto_backend_init(void)
+{
+    int err = aes_init();
+
+    LOG_INF("crypto backend: %s", ct_crypto_backend_name());
+    return err;
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+
+/**
+ * @file
+ * @brief Crypto primitives of the GAEN key derivation.
+ *
+ * AES-128 is served by TinyCrypt (default) or by a Zephyr crypto driver, such
+ * as a hardware AES engine or the mbedTLS shim (CONFIG_CT_CRYPTO_AES_xx).
+ * Drivers only need to provide AES-128 ECB, CTR mode is derived from it.
+ * HMAC-SHA256 is served by TinyCrypt (default) or mbedTLS
+ * (CONFIG_CT_CRYPTO_HMAC_xx).
+ */
+
+#ifndef __CT_CRYPTO_BACKEND_H
+#define __CT_CRYPTO_BACKEND_H
+
+#include <stddef.h>
+#include <zephyr/types.h>
+
+#if defined(CONFIG_CT_CRYPTO_HMAC_MBEDTLS)
+#include <mbedtls/md.h>
+#else
+#include <tinycrypt/hmac.h>
+#endif
+
+/**
+ * @typedef ct_crypto_hmac_t
+ * @brief HMAC-SHA256 state.
+ */
+typedef struct {
+#if defined(CONFIG_CT_CRYPTO_HMAC_MBEDTLS)
+    mbedtls_md_context_t md;
+#else
+    struct tc_hmac_state_struct tc;
+#endif
+} ct_crypto_hmac_t;
+
+/**
+ * @brief Initialise the crypto backend.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_backend_init(void);
+
+/**
+ * @brief Name of the active backend, e.g. for benchmarks.
+ * @return backend name ("AES backend / HMAC backend").
+ */
+const char *ct_crypto_backend_name(void);
+
+/**
+ * @brief Encrypt a single block with AES-128 in ECB mode.
+ * @param [in]  key : pointer to a 16-byte key.
+ * @param [in]  in  : pointer to a 16-byte plaintext block.
+ * @param [out] out : pointer to a 16-byte array for the ciphertext.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_aes128_ecb(const uint8_t *key, const uint8_t *in, uint8_t *out);
+
+/**
+ * @brief Encrypt data with AES-128 in CTR mode.
+ *
+ * The last 4 bytes of the counter block are incremented (big endian) for
+ * each block, compatible with TinyCrypt. 'ctr' is not modified.
+ *
+ * @param [in]  key : pointer to a 16-byte key.
+ * @param [in]  ctr : pointer to the 16-byte initial counter block.
+ * @param [in]  in  : pointer to 'len' bytes of plaintext.
+ * @param [out] out : pointer to a 'len'-byte array for the ciphertext.
+ * @param [in]  len : length of the data.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_aes128_ctr(const uint8_t *key, const uint8_t *ctr,
+                const uint8_t *in, uint8_t *out, size_t len);
+
+/**
+ * @brief Start a HMAC-SHA256 computation.
+ * @param [out] h       : HMAC state.
+ * @param [in]  key     : pointer to the key.
+ * @param [in]  key_len : length of the key.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_hmac_init(ct_crypto_hmac_t *h, const uint8_t *key,
+                size_t key_len);
+
+/**
+ * @brief Add data to a HMAC-SHA256 computation.
+ * @param [inout] h        : HMAC state.
+ * @param [in]    data     : pointer to the data.
+ * @param [in]    data_len : length of the data.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_hmac_update(ct_crypto_hmac_t *h, const uint8_t *data,
+                size_t data_len);
+
+/**
+ * @brief Finish a HMAC-SHA256 computation. The state is cleared.
+ * @param [inout] h   : HMAC state.
+ * @param [out]   out : pointer to a 32-byte array for the MAC.
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_crypto_hmac_final(ct_crypto_hmac_t *h, uint8_t *out);
+
+#endif /* __CT_CRYPTO_BACKEND_H */
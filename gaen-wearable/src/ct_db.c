@@ -27,6 +27,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -37,9 +38,12 @@
 #include <logging/log.h>
 
 #include <settings/settings.h>
+#include <sys/crc.h>
 
 #include "ct.h"
 #include "ct_db.h"
+#include "ct_settings.h"
+#include "ct_energy.h"
 
 
 LOG_MODULE_REGISTER(ct_db, LOG_LEVEL_INF);
@@ -64,35 +68,109 @@ typedef struct {
     uint8_t tek[TEK_SIZE];
 } db_tek_t;
 
-// size = 4+4+16+4+1+padding+1+padding = 32 bytes
+// size = 4+4+16+4+1+1+2+4 = 36 bytes (+4 bytes with encounters)
 typedef struct {
     uint32_t ival_first; // initial ival at which RPI is observed
     uint32_t ival_last;  // last ival at which RPI was observerd
     uint8_t rpi[RPI_SIZE]; // 16 bytes
     uint8_t aem[AEM_SIZE]; // 4 bytes
-    int8_t rssi;
-    uint8_t cnt;
+    uint8_t cnt;         // number of observations (saturates)
+    int8_t rssi_max;     // strongest observation (minimum attenuation)
+    int16_t rssi_sum;    // sum of RSSI of 'cnt' observations
+    uint8_t att[CT_ATT_BUCKETS]; // observations per attenuation bucket
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    uint32_t enc;        // encounter, see ct_db_enc_id
+#endif
 } db_rpi_t;
 
 //Use external flash?
 #define CT_FLASH_NODE DT_INST(0, jedec_spi_nor)
 #if DT_NODE_HAS_STATUS(CT_FLASH_NODE, okay)
 #define DB_USE_EXTERNAL_FLASH
+#elif defined(CONFIG_CT_DB_FLASH_SIM)
+// Flash simulator in place of the SPI NOR: the flash node of the simulator
+//  is chosen by 'ct,db-flash', e.g. boards/nrf52_bsim.overlay.
+#define CT_FLASH_SIM_NODE DT_CHOSEN(ct_db_flash)
+#define DB_USE_EXTERNAL_FLASH
 #endif
 
 // Layout of single sector of external flash
-// ==> a sector consists of 4094 bytes.
-// -    4 bytes ival    (total:    4 bytes) - 1x starting interval of all RPI's
+// ==> a sector consists of 4096 bytes.
+// -    4 bytes format  (total:    4 bytes) - 1x format of sector (magic and
+//                                                  version, DB_FLASH_FORMAT)
+// -    4 bytes ival    (total:    8 bytes) - 1x starting interval of all RPI's
 //                                                  and TEK in sector
+// -    4 bytes seq     (total:   12 bytes) - 1x sequence number of sector
+// -    4 bytes erase   (total:   16 bytes) - 1x erase count of sector
+// -    8 bytes gen     (total:   24 bytes) - 2x current generation of RPIs
+//                                                  and of TEKs
+// -   20 bytes tek     (total:   44 bytes) - 1x active TEK at this interval
+// -    4 bytes crc     (total:   48 bytes) - 1x CRC32 of the header
+// - 4040 bytes rpi     (total: 4088 bytes) - 101x observered RPI's, each
+//                                                  followed by its CRC32
+// -    4 bytes padding (total: 4092 bytes)
+// -    4 bytes mark    (total: 4096 bytes) - quarantine mark
+// With CONFIG_CT_DB_ENCOUNTERS, an RPI holds its encounter as well:
+// - 4004 bytes rpi     (total: 4052 bytes) - 91x observered RPI's, each
+//                                                  followed by its CRC32
+// -   40 bytes padding (total: 4092 bytes)
+// -    4 bytes mark    (total: 4096 bytes) - quarantine mark
+
+// Format
+// The layout of a sector is versioned by the first word of its header.
+//  Sectors of an unknown format, e.g. written by an older firmware, can not be
+//  interpreted: they are erased when loading the flash, dropping their data.
+//  DB_FLASH_FORMAT is to be incremented on each change of the layout.
+// Sectors of the layout with (or without) encounters, DB_FLASH_FORMAT_ALT, are
+//  written by a firmware built with CONFIG_CT_DB_ENCOUNTERS toggled. Their
+//  header is the same, their RPIs are converted when read: an RPI gets its own
+//  encounter, or its encounter is dropped. They are kept until they are reused
+//  or expire, as version 0 sectors, and are not scrubbed.
+// Sectors of the first firmware (version 0) have no format: their first word
+//  is the interval of the sector. They are read as they are, until they are
+//  reused or expire, so their RPIs are kept:
+// -    4 bytes ival    (total:    4 bytes) - 1x starting interval of sector
 // -   20 bytes tek     (total:   24 bytes) - 1x active TEK at this interval
-// - 4064 bytes rpi     (total: 4075 bytes) - 127x observered RPI's
+// - 4064 bytes rpi     (total: 4088 bytes) - 127x observered RPI's
 // -    8 bytes padding (total: 4096 bytes)
+// Version 0 sectors precede all others, in order of their interval, and have
+//  no CRCs: they are not scrubbed.
+
+// Power-fail safety
+// A header or RPI is written with a single flash write, its CRC last. A write
+//  torn by a brown-out therefore leaves a record with an invalid CRC, which is
+//  detected when loading the flash:
+// - a sector with an invalid header is considered empty.
+// - a sector ends at the first RPI slot which is invalid or not fully erased.
+// After loading, data is always appended to a new sector. So a torn RPI is
+//  never followed by valid RPIs in its sector, and RPIs can still be located
+//  by their slot in the sector.
+
+// Scrubbing
+// Sectors holding data are verified in the background (ct_db_scrub). Errors
+//  are confirmed by a second read. The valid RPIs of a sector with errors are
+//  written again to the newest sector and the sector is quarantined by
+//  clearing its mark. Quarantined sectors are skipped when
+//  loading the flash and when starting a new sector. As the database is
+//  cleared without erasing the flash, quarantine is permanent.
+
+// Generations
+// Clearing RPIs and/or TEKs starts a new generation of them: the sequence
+//  number of the next sector. Each header holds the current generations, so
+//  they are stored by starting a new sector. Data in sectors of an older
+//  generation is ignored when loading the flash, and a sector without RPIs and
+//  TEK of the current generations is free. Free sectors are erased when reused.
+// The new sector is started right away, also during a snapshot. The
+//  generations are also saved in settings, so a clear is kept when starting
+//  the sector fails. When loading the flash the newest of both is used.
 
 // A new sector is allocated/started iff:
 // - TEK updates. All local/received RPI data is first flushed,
 //                  followed by new allocation of sector
 // - RPI count exceeds sector sector size. New sector is started with
 //                  current ival and current active TEK
+// - RPIs and/or TEKs are cleared. New sector is started with current ival
+//                  and current active TEK, if any
 
 // RPI's are pushed from local to flash, when:
 // - TEK is updated => flushing of all RPI's
@@ -112,9 +190,43 @@ static db_rpi_t _db_rpi_list[CT_DB_RPI_CNT_LOCAL];
 static uint16_t _db_rpi_idx;
 static uint16_t _db_rpi_cnt;
 
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+// Linking state of the corresponding record in the local buffer. RPIs are
+//  linked while both are local, and a record is never pushed to flash before
+//  a newer record, so 'next' stays valid while the record is local.
+// > 'seen' and 'start' are kept at full width, so they do not wrap while a
+//   record is local (32-bit uptime in seconds wraps after 136 years).
+typedef struct {
+    uint32_t seen;  // uptime [s] of the last observation
+    uint32_t start; // interval at which the encounter started
+    uint16_t next;  // local index of the linked RPI, DB_ENC_NONE if none
+} db_enc_t;
+#define DB_ENC_NONE  (0xFFFF)
+
+BUILD_ASSERT(CT_DB_RPI_CNT_LOCAL < DB_ENC_NONE,
+                "local index does not fit db_enc_t");
+
+static db_enc_t _db_enc[CT_DB_RPI_CNT_LOCAL];
+#endif
+
 // Current active interval on which DB works.
 static uint32_t _db_ival = 0;
 
+// Snapshot management (see ct_db_snapshot_begin)
+static bool _db_snap_active = false;
+// number of RPIs removed from the start of the database since the snapshot
+//  began, when the flash ring wrapped or the RPIs were cleared
+static uint32_t _db_snap_dropped;
+
+// The database is used by the EN thread, the BT RX thread (scan results and
+//  ENC commands) and the system workqueue (ENC, scrubbing). Each function of
+//  the API holds this lock, which is recursive so API functions can be used
+//  internally as well.
+K_MUTEX_DEFINE(_db_lock);
+
+// Results of scrubbing the flash (see ct_db_scrub)
+static ct_db_integrity_t _db_integrity;
+
 // Circular-buffer index calculations.
 // > assumes that: "skip" < "array-size"
 // > i = current index
@@ -127,6 +239,81 @@ static uint32_t _db_ival = 0;
 #define IDX_PREV(i,a)   IDX_SKIP_PREV(i,1,a)
 
 
+// Typical RSSI of an RPI: mean of all observations, rounded to nearest.
+static int8_t ct_db_rpi_rssi_typ(const db_rpi_t *rpi)
+{
+    if (rpi->cnt == 0) {
+        return rpi->rssi_max;
+    }
+    return (rpi->rssi_sum - (rpi->cnt / 2)) / rpi->cnt;
+}
+
+// Attenuation bucket of an observation (attenuation relative to 0 dBm).
+static uint8_t ct_db_att_bucket(int8_t rssi)
+{
+    int att = -rssi;
+    uint8_t b = 0;
+
+    while ((b < (CT_ATT_BUCKETS - 1)) && (att >= ct_priv.att_thresholds[b])) {
+        b++;
+    }
+    return b;
+}
+
+// Add an observation to the statistics of an RPI.
+static void ct_db_rpi_observe(db_rpi_t *rpi, int8_t rssi)
+{
+    uint8_t b = ct_db_att_bucket(rssi);
+
+    // 'cnt' and 'rssi_sum' are updated together, so the mean is exact.
+    if (rpi->cnt < UINT8_MAX) {
+        rpi->cnt++;
+        rpi->rssi_sum += rssi;
+    }
+    if (rpi->att[b] < UINT8_MAX) {
+        rpi->att[b]++;
+    }
+    rpi->rssi_max = MAX(rpi->rssi_max, rssi);
+}
+
+// Convert a database RPI into its export representation.
+static void ct_db_rpi_to_export(const db_rpi_t *rpi, ct_db_rpi_export_t *exp)
+{
+    memcpy(exp->rpi, rpi->rpi, RPI_SIZE);
+    memcpy(exp->aem, rpi->aem, AEM_SIZE);
+    exp->ival_last = rpi->ival_last;
+    exp->rssi      = ct_db_rpi_rssi_typ(rpi);
+    exp->cnt       = rpi->cnt;
+    exp->rssi_max  = rpi->rssi_max;
+    memcpy(exp->att, rpi->att, sizeof(exp->att));
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    exp->enc       = rpi->enc;
+#endif
+}
+
+
+
+// Clear local TEK buffer.
+static void ct_db_tek_reset(void)
+{
+    memset(_db_tek_list, CT_DB_EMPTY, sizeof(_db_tek_list));
+    _db_tek_idx = 0;
+    _db_tek_cnt = 0;
+}
+
+// Clear local RPI buffer.
+static void ct_db_rpi_reset(void)
+{
+    memset(_db_rpi_list, CT_DB_EMPTY, sizeof(_db_rpi_list));
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    // No links: 'next' is DB_ENC_NONE.
+    memset(_db_enc, CT_DB_EMPTY, sizeof(_db_enc));
+#endif
+    _db_rpi_idx = 0;
+    _db_rpi_cnt = 0;
+}
+
+
 
 #ifdef DB_USE_EXTERNAL_FLASH
 
@@ -135,43 +322,226 @@ static uint32_t _db_ival = 0;
 #define CT_FLASH_SPI_BUS       DT_BUS_LABEL(CT_FLASH_NODE)
 #define CT_FLASH_LABEL         DT_LABEL(CT_FLASH_NODE)
 #define CT_FLASH_DEVICE        DT_LABEL(CT_FLASH_NODE)
+// 'size' of a SPI NOR flash is in bits
+#define CT_FLASH_DT_SIZE       (DT_PROP(CT_FLASH_NODE, size) / 8)
+#elif defined(CT_FLASH_SIM_NODE)
+#define CT_FLASH_SPI_BUS       "-"
+#define CT_FLASH_LABEL         "Simulated"
+// The flash device is the controller of the chosen flash node.
+#define CT_FLASH_DEVICE        DT_LABEL(DT_PARENT(CT_FLASH_SIM_NODE))
+#define CT_FLASH_DT_SIZE       DT_REG_SIZE(CT_FLASH_SIM_NODE)
+BUILD_ASSERT(DT_PROP(CT_FLASH_SIM_NODE, erase_block_size) == 4096,
+                "flash simulator should have 4 KiB erase blocks");
 #else
 #warning Unsupported flash driver
 #define CT_FLASH_SPI_BUS       ""
 #define CT_FLASH_LABEL         ""
 #define CT_FLASH_DEVICE        ""
+#define CT_FLASH_DT_SIZE       0
 #endif
 
+// A sector is the 4 KiB erase sector of a SPI NOR flash. The number of
+//  sectors follows from the size of the flash in the devicetree, limited by
+//  CONFIG_CT_DB_FLASH_SECTORS_MAX as the TOC takes RAM for each sector.
 #define CT_FLASH_SECTOR_SIZE   (4096)
-#define CT_FLASH_SECTOR_COUNT  (256)
-//#define CT_FLASH_SECTOR_COUNT  (16)
+#define CT_FLASH_SECTOR_COUNT  MIN(CT_FLASH_DT_SIZE / CT_FLASH_SECTOR_SIZE, \
+                                    CONFIG_CT_DB_FLASH_SECTORS_MAX)
 #define CT_FLASH_MEMORY_SIZE   (CT_FLASH_SECTOR_SIZE*CT_FLASH_SECTOR_COUNT)
 
-// Read full RPI when loading data from flash.
-// 0: only ival is read and checked (fast)
-// 1: full RPI is read and printed (slow)
-#define CT_FLASH_LOAD_RPI_FULL 0
+// The newest sector is never reused, so a new sector needs a second one.
+BUILD_ASSERT(CT_FLASH_SECTOR_COUNT >= 2, "flash holds less than 2 sectors");
+// Sectors are stored as 16 bits in the order of the sectors.
+BUILD_ASSERT(CT_FLASH_SECTOR_COUNT <= 0xFFFF, "too many flash sectors");
+
+// Sector header, written at once when a sector is started.
+// > 'format' identifies the layout of the sector (see Format).
+// > 'seq' orders the sectors in time, as they are not allocated as a ring.
+// > 'erase_cnt' counts the erases of the sector.
+// > 'gen_rpi' and 'gen_tek' are the current generations (see Generations).
+// > 'tek' is empty when there was no TEK.
+typedef struct {
+    uint32_t format;
+    uint32_t ival;
+    uint32_t seq;
+    uint32_t erase_cnt;
+    uint32_t gen_rpi;
+    uint32_t gen_tek;
+    db_tek_t tek;
+    uint32_t crc;
+} db_flash_hdr_t;
+
+// RPI as stored in flash.
+typedef struct {
+    db_rpi_t rpi;
+    uint32_t crc;
+} db_flash_rpi_t;
+
+// 'C' 'T' 'D' followed by the version of the layout. RPIs of encounters
+//  (CONFIG_CT_DB_ENCOUNTERS) are stored in another layout: 'C' 'T' 'E'.
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+#define DB_FLASH_FORMAT      (0x43544501)
+#define DB_FLASH_FORMAT_ALT  (0x43544401)
+#else
+#define DB_FLASH_FORMAT      (0x43544401)
+#define DB_FLASH_FORMAT_ALT  (0x43544501)
+#endif
+
+#define DB_FLASH_HDR_CRC(h)  crc32_ieee((const uint8_t*)(h), \
+                                    offsetof(db_flash_hdr_t, crc))
+#define DB_FLASH_RPI_CRC(r)  crc32_ieee((const uint8_t*)(r), \
+                                    offsetof(db_flash_rpi_t, crc))
+
+// Header and RPI of a version 0 sector (see Format). The RPI only kept a
+//  running average of the RSSI.
+typedef struct {
+    uint32_t ival;
+    db_tek_t tek;
+} db_flash_v0_hdr_t;
+
+typedef struct {
+    uint32_t ival_first;
+    uint32_t ival_last;
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    int8_t rssi;
+    uint8_t cnt;
+} db_flash_v0_rpi_t;
+
+// RPI as stored in DB_FLASH_FORMAT_ALT (see Format): the RPI without or with
+//  the encounter, as the encounter is its last member.
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+#define DB_RPI_ALT_SIZE      offsetof(db_rpi_t, enc)
+#else
+#define DB_RPI_ALT_SIZE      (sizeof(db_rpi_t) + sizeof(uint32_t))
+#endif
+
+typedef struct {
+    uint8_t rpi[DB_RPI_ALT_SIZE];
+    uint32_t crc;
+} db_flash_alt_rpi_t;
+
+#define DB_FLASH_ALT_RPI_CRC(r)  crc32_ieee((r)->rpi, DB_RPI_ALT_SIZE)
+
+// The first word of a version 0 sector is an interval, which is far below
+//  any DB_FLASH_FORMAT (or a torn one).
+#define DB_FLASH_V0_IVAL_MAX   (0x01000000)
+
+// Number of RPIs in a version 0 sector and address of the RPI in 'slot'
+#define CT_FLASH_V0_RPIS       ((CT_FLASH_SECTOR_SIZE - \
+                sizeof(db_flash_v0_hdr_t)) / sizeof(db_flash_v0_rpi_t))
+#define CT_FLASH_V0_RPI_ADDR(sector, slot) (((sector) * CT_FLASH_SECTOR_SIZE) \
+            + sizeof(db_flash_v0_hdr_t) + ((slot) * sizeof(db_flash_v0_rpi_t)))
+
+// Number of RPIs in a sector, in front of the quarantine mark
+#define CT_FLASH_SECTOR_RPIS   ((CT_FLASH_SECTOR_SIZE - sizeof(db_flash_hdr_t) \
+                                    - sizeof(uint32_t)) / sizeof(db_flash_rpi_t))
+
+// Address of the RPI in 'slot' of 'sector'
+#define CT_FLASH_RPI_ADDR(sector, slot) (((sector) * CT_FLASH_SECTOR_SIZE) \
+            + sizeof(db_flash_hdr_t) + ((slot) * sizeof(db_flash_rpi_t)))
+
+// Number of RPIs in a sector of DB_FLASH_FORMAT_ALT and address of the RPI
+//  in 'slot'
+#define CT_FLASH_ALT_RPIS      ((CT_FLASH_SECTOR_SIZE - sizeof(db_flash_hdr_t) \
+                                - sizeof(uint32_t)) / sizeof(db_flash_alt_rpi_t))
+#define CT_FLASH_ALT_RPI_ADDR(sector, slot) (((sector) * CT_FLASH_SECTOR_SIZE) \
+            + sizeof(db_flash_hdr_t) + ((slot) * sizeof(db_flash_alt_rpi_t)))
+
+// Address of the quarantine mark of 'sector', its last word.
+#define CT_FLASH_MARK_ADDR(sector) ((((sector) + 1) * CT_FLASH_SECTOR_SIZE) \
+            - sizeof(uint32_t))
+#define DB_FLASH_MARK_QUARANTINE (0x00000000)
+
+BUILD_ASSERT(CT_FLASH_RPI_ADDR(0, CT_FLASH_SECTOR_RPIS) <= CT_FLASH_MARK_ADDR(0),
+                "RPIs overlap with quarantine mark");
+BUILD_ASSERT((sizeof(db_flash_alt_rpi_t) + sizeof(db_flash_rpi_t) == 84) &&
+                (CT_FLASH_ALT_RPIS + CT_FLASH_SECTOR_RPIS == 192),
+                "layout of the RPIs with and without encounters changed");
+BUILD_ASSERT((sizeof(db_flash_v0_rpi_t) == 32) && (CT_FLASH_V0_RPIS == 127),
+                "layout of version 0 sectors changed");
+BUILD_ASSERT(CT_FLASH_V0_RPI_ADDR(0, CT_FLASH_V0_RPIS) <= CT_FLASH_MARK_ADDR(0),
+                "version 0 RPIs overlap with quarantine mark");
+
+// A full sector should fit in an export staging buffer.
+BUILD_ASSERT(CT_FLASH_SECTOR_SIZE <= CT_DB_EXPORT_BUF_SIZE,
+                "export buffer is smaller then a flash sector");
+// RPIs are converted in place into their export representation.
+BUILD_ASSERT(sizeof(ct_db_rpi_export_t) <= sizeof(db_flash_rpi_t),
+                "export representation is larger then database RPI");
 
 
 
 const static struct device *_db_flash_dev  = NULL;
 static const uint32_t _db_ival_empty = -1; //0xFFFFFFFF
-static const uint16_t _db_cnt_empty  = -1; //0xFFFF
+
+// Flash access, accounted by ct_energy.
+static int db_flash_read(off_t addr, void *data, size_t len)
+{
+    uint32_t start = ct_energy_op_start();
+    int err = flash_read(_db_flash_dev, addr, data, len);
+    ct_energy_op_end(CT_ENERGY_FLASH_READ, start);
+    return err;
+}
+
+static int db_flash_write(off_t addr, const void *data, size_t len)
+{
+    uint32_t start = ct_energy_op_start();
+    int err = flash_write(_db_flash_dev, addr, data, len);
+    ct_energy_op_end(CT_ENERGY_FLASH_WRITE, start);
+    return err;
+}
+
+static int db_flash_erase(off_t addr, size_t size)
+{
+    uint32_t start = ct_energy_op_start();
+    int err = flash_erase(_db_flash_dev, addr, size);
+    ct_energy_op_end(CT_ENERGY_FLASH_ERASE, start);
+    return err;
+}
 
 typedef struct {
     uint32_t ival;
+    uint32_t seq;
+    uint32_t erase_cnt;
     uint16_t cnt;
+    bool v0;            // sector of version 0, see Format
+    bool alt;           // sector of DB_FLASH_FORMAT_ALT, see Format
 } db_flash_toc_page_t;
 
+// RAM per sector: its TOC page, its place in the order and its quarantine
+//  bit, as documented by CONFIG_CT_DB_FLASH_SECTORS_MAX.
+BUILD_ASSERT(sizeof(db_flash_toc_page_t) + sizeof(uint16_t) <= 18,
+                "RAM per sector grew, update CONFIG_CT_DB_FLASH_SECTORS_MAX");
+
 // Structure / Table of Contents, representing data in flash.
 static db_flash_toc_page_t _db_flash_toc[CT_FLASH_SECTOR_COUNT];
 // Number of RPI's in flash
 static uint32_t _db_flash_rpi_cnt       = 0;
 
+// Sectors holding data, ordered from oldest..newest
+static uint16_t _db_flash_order[CT_FLASH_SECTOR_COUNT];
+static uint32_t _db_flash_order_cnt     = 0;
+// Sequence number of the next sector
+static uint32_t _db_flash_seq           = 0;
+// Number of sector erases since boot
+static uint32_t _db_flash_erases        = 0;
+// Current generations: data in sectors with a lower sequence number is cleared
+static uint32_t _db_flash_gen_rpi       = 0;
+static uint32_t _db_flash_gen_tek       = 0;
+
 // Index of sector in which we push data
 static uint32_t _db_flash_sector_idx    = 0;
-// addr-offset in sector in which we write data
+// addr-offset in sector in which we write data, 0 when no sector is started
 static uint32_t _db_flash_sector_offset = 0;
+// Number of torn headers and RPIs skipped while loading the flash
+static uint32_t _db_flash_torn          = 0;
+
+// Quarantined sectors
+static ATOMIC_DEFINE(_db_flash_quar, CT_FLASH_SECTOR_COUNT);
+static uint16_t _db_flash_quar_cnt      = 0;
+
+// Next sector to verify by the scrubber
+static uint32_t _db_scrub_sector        = 0;
 
 
 int ct_db_flash_init(void)
@@ -188,168 +558,495 @@ int ct_db_flash_init(void)
         return -ENODEV;
     }
 
+    if ((CT_FLASH_DT_SIZE / CT_FLASH_SECTOR_SIZE) > CT_FLASH_SECTOR_COUNT) {
+        LOG_WRN("Flash: %u of %u sectors used, see "
+                        "CONFIG_CT_DB_FLASH_SECTORS_MAX",
+                        (uint32_t)CT_FLASH_SECTOR_COUNT,
+                        (uint32_t)(CT_FLASH_DT_SIZE / CT_FLASH_SECTOR_SIZE));
+    }
+
+    LOG_INF("Size: %u sectors of %u bytes", CT_FLASH_SECTOR_COUNT,
+                    CT_FLASH_SECTOR_SIZE);
+
+#if defined(CONFIG_FLASH_PAGE_LAYOUT)
+    // The devicetree should not claim more flash than the device provides.
+    struct flash_pages_info info;
+    if (flash_get_page_info_by_offs(_db_flash_dev, CT_FLASH_MEMORY_SIZE - 1,
+                    &info) != 0) {
+        LOG_ERR("Flash is smaller than %u bytes", CT_FLASH_MEMORY_SIZE);
+        return -EINVAL;
+    }
+#endif
+
     return 0;
 }
 
-int ct_db_flash_clear(void) {
-    flash_write_protection_set(_db_flash_dev, false);
-    int err = flash_erase(_db_flash_dev, 0x0, CT_FLASH_MEMORY_SIZE);
+static bool db_flash_is_empty(const void *data, size_t len)
+{
+    const uint8_t *d = data;
+    for (size_t i = 0; i < len; i++) {
+        if (d[i] != CT_DB_EMPTY) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read and validate the header of 'sector', of DB_FLASH_FORMAT or
+//  DB_FLASH_FORMAT_ALT.
+// > returns -ENOENT for a sector without data, -ENOMSG for a sector of
+//   another format and -EBADMSG for a torn header.
+static int ct_db_flash_hdr_read(uint32_t sector, db_flash_hdr_t *hdr)
+{
+    int err = db_flash_read(sector*CT_FLASH_SECTOR_SIZE, hdr, sizeof(*hdr));
     if (err != 0) {
-        LOG_ERR("Flash erase failed! %d\n", err);
+        LOG_ERR("Flash read failed! %d [HDR]\n", err);
         return err;
     }
+
+    if (db_flash_is_empty(hdr, sizeof(*hdr))) {
+        return -ENOENT;
+    }
+    if ((hdr->format != DB_FLASH_FORMAT) &&
+            (hdr->format != DB_FLASH_FORMAT_ALT)) {
+        // A write only clears bits: the format is torn when it has no bits
+        //  cleared which are set in DB_FLASH_FORMAT, else it is another one.
+        return ((~hdr->format & DB_FLASH_FORMAT) == 0) ? -EBADMSG : -ENOMSG;
+    }
+    if (hdr->crc != DB_FLASH_HDR_CRC(hdr)) {
+        return -EBADMSG;
+    }
     return 0;
 }
 
-int ct_db_flash_load(void) {
+// Read the header of version 0 'sector' (see Format) as a header.
+static int ct_db_flash_v0_hdr_read(uint32_t sector, db_flash_hdr_t *hdr)
+{
+    db_flash_v0_hdr_t v0;
+    int err = db_flash_read(sector*CT_FLASH_SECTOR_SIZE, &v0, sizeof(v0));
+    if (err != 0) {
+        LOG_ERR("Flash read failed! %d [HDR]\n", err);
+        return err;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->ival      = v0.ival;
+    hdr->seq       = _db_flash_toc[sector].seq;
+    hdr->erase_cnt = _db_flash_toc[sector].erase_cnt;
+    hdr->tek       = v0.tek;
+    return 0;
+}
+
+// Convert an RPI of a version 0 sector. All its observations are counted
+//  at its average RSSI.
+static void ct_db_rpi_from_v0(const db_flash_v0_rpi_t *v0, db_rpi_t *rpi)
+{
+    memset(rpi, 0, sizeof(*rpi));
+    rpi->ival_first = v0->ival_first;
+    rpi->ival_last  = v0->ival_last;
+    memcpy(rpi->rpi, v0->rpi, RPI_SIZE);
+    memcpy(rpi->aem, v0->aem, AEM_SIZE);
+    rpi->cnt        = v0->cnt;
+    rpi->rssi_max   = v0->rssi;
+    rpi->rssi_sum   = v0->rssi * v0->cnt;
+    rpi->att[ct_db_att_bucket(v0->rssi)] = v0->cnt;
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    // Not linked: its own encounter, see ct_db_enc_id.
+    memcpy(&rpi->enc, v0->rpi, sizeof(rpi->enc));
+#endif
+}
+
+// Convert an RPI of DB_FLASH_FORMAT_ALT. With encounters the RPI is not
+//  linked, without the encounter is dropped.
+static void ct_db_rpi_from_alt(const db_flash_alt_rpi_t *alt, db_rpi_t *rpi)
+{
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    memset(rpi, 0, sizeof(*rpi));
+    memcpy(rpi, alt->rpi, DB_RPI_ALT_SIZE);
+    memcpy(&rpi->enc, rpi->rpi, sizeof(rpi->enc));
+#else
+    memcpy(rpi, alt->rpi, sizeof(*rpi));
+#endif
+}
+
+// Count the RPIs in 'sector' of DB_FLASH_FORMAT_ALT, up to the first empty or
+//  torn slot.
+static int ct_db_flash_alt_rpi_count(uint32_t sector, uint16_t *cnt)
+{
+    db_flash_alt_rpi_t rec;
+    uint32_t addr;
     int err;
 
+    *cnt = 0;
+    for (uint32_t slot = 0; slot < CT_FLASH_ALT_RPIS; slot++) {
+        addr = CT_FLASH_ALT_RPI_ADDR(sector, slot);
+        err  = db_flash_read(addr, &rec, sizeof(rec));
+        if (err != 0) {
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
+            return err;
+        }
+
+        if (rec.crc != DB_FLASH_ALT_RPI_CRC(&rec)) {
+            if (!db_flash_is_empty(&rec, sizeof(rec))) {
+                LOG_WRN("Flash: torn RPI @ 0x%06x skipped", addr);
+                _db_flash_torn++;
+            }
+            break;
+        }
+        (*cnt)++;
+    }
+
+    return 0;
+}
+
+// Count the RPIs in version 0 'sector', up to the first empty slot.
+static int ct_db_flash_v0_rpi_count(uint32_t sector, uint16_t *cnt)
+{
     uint32_t ival;
+    int err;
+
+    *cnt = 0;
+    for (uint32_t slot = 0; slot < CT_FLASH_V0_RPIS; slot++) {
+        err = db_flash_read(CT_FLASH_V0_RPI_ADDR(sector, slot), &ival,
+                        sizeof(ival));
+        if (err != 0) {
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
+            return err;
+        }
+        if (ival == _db_ival_empty) {
+            break;
+        }
+        (*cnt)++;
+    }
+
+    return 0;
+}
+
+// Count the RPIs in 'sector', up to the first empty or torn slot.
+static int ct_db_flash_rpi_count(uint32_t sector, uint16_t *cnt)
+{
+    db_flash_rpi_t rec;
     uint32_t addr;
-    db_flash_toc_page_t *toc_page;
-    uint32_t sector;
-    uint32_t sector_addr;
+    int err;
 
-    // Setting up TOC and local buffers is done in several steps:
-    // 1.0) Find sector in flash containing newest data
-    //      => sector to which we write is the sector following this one.
-    // 2.1) Setup TOC (counting number of RPI's in each sector)
-    // 2.2) Copy last "TEK_ROLLING_PERIOD" number of TEKS from flash to buffer.
-
-    // Scan flash find which sector contains the "newest" data / highest ival.
-    uint32_t target_sector = 0;
-    uint32_t target_ival   = 0;
-    for (sector = 0; sector<CT_FLASH_SECTOR_COUNT; sector++) {
-        //Read ival from sector.
-        ival = 0;
-        addr = sector*CT_FLASH_SECTOR_SIZE;
-        err  = flash_read(_db_flash_dev, addr, (uint8_t*)&ival, sizeof(ival));
+    if (_db_flash_toc[sector].v0) {
+        return ct_db_flash_v0_rpi_count(sector, cnt);
+    }
+    if (_db_flash_toc[sector].alt) {
+        return ct_db_flash_alt_rpi_count(sector, cnt);
+    }
+
+    *cnt = 0;
+    for (uint32_t slot = 0; slot < CT_FLASH_SECTOR_RPIS; slot++) {
+        addr = CT_FLASH_RPI_ADDR(sector, slot);
+        err  = db_flash_read(addr, &rec, sizeof(rec));
         if (err != 0) {
-            LOG_ERR("Flash read failed! %d [IVAL]\n", err);
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
             return err;
         }
-        //printk("Flash: ival %d @ 0x%08x\n", ival, addr);
 
-        // We need to find the sector with the highest ival.
-        if ((ival != _db_ival_empty) && (ival >= target_ival)){
-            target_sector = sector;
-            target_ival   = ival;
+        if (rec.crc != DB_FLASH_RPI_CRC(&rec)) {
+            // Not erased => torn write, RPIs are never written after it.
+            if (!db_flash_is_empty(&rec, sizeof(rec))) {
+                LOG_WRN("Flash: torn RPI @ 0x%06x skipped", addr);
+                _db_flash_torn++;
+            }
+            break;
         }
+
+        LOG_DBG(" >> [%04d] addr:%06x - ival:%010d",
+                        _db_flash_rpi_cnt + *cnt, addr, rec.rpi.ival_first);
+        (*cnt)++;
+    }
+
+    return 0;
+}
+
+// Remove the RPIs of 'sector' from the database, the sector becomes free.
+static void ct_db_flash_drop(uint32_t sector)
+{
+    db_flash_toc_page_t *toc_page = &_db_flash_toc[sector];
+    uint32_t i;
+
+    for (i = 0; i < _db_flash_order_cnt; i++) {
+        if (_db_flash_order[i] == sector) {
+            break;
+        }
+    }
+    if (i == _db_flash_order_cnt) {
+        return;
     }
 
+    // RPIs in front of a snapshot are removed, see ct_db_rpi_snap_idx.
+    if (_db_snap_active && (i == 0)) {
+        _db_snap_dropped += toc_page->cnt;
+    }
+
+    _db_flash_order_cnt--;
+    memmove(&_db_flash_order[i], &_db_flash_order[i + 1],
+                    (_db_flash_order_cnt - i) * sizeof(_db_flash_order[0]));
+
+    _db_flash_rpi_cnt -= toc_page->cnt;
+    toc_page->ival = _db_ival_empty;
+    toc_page->seq  = _db_ival_empty;
+    toc_page->cnt  = 0;
+}
+
+// Drop the oldest sectors which only hold data beyond the retention period
+//  (CT_DB_RETAIN_PERIODS), they are erased when reused.
+// > A sector holds data up to the start of the next sector, so the newest
+//   sector is never dropped.
+static void ct_db_flash_expire(void)
+{
+    uint32_t retain = CT_DB_RETAIN_PERIODS * ct_priv.tek_rolling_period;
+    if ((retain == 0) || (_db_ival <= retain)) {
+        return;
+    }
+
+    uint32_t cutoff = _db_ival - retain;
+    while ((_db_flash_order_cnt > 1) &&
+            (_db_flash_toc[_db_flash_order[1]].ival <= cutoff)) {
+        LOG_DBG("Flash: sector %u expired", _db_flash_order[0]);
+        ct_db_flash_drop(_db_flash_order[0]);
+    }
+}
+
+int ct_db_flash_load(void) {
+    int err;
+
+    db_flash_hdr_t hdr;
+    db_flash_toc_page_t *toc_page;
+    uint32_t sector;
+    uint32_t erase_max = 0;
+    uint32_t foreign   = 0;
+    uint32_t v0_cnt    = 0;
+    uint32_t alt_cnt   = 0;
+
+    // Setting up TOC and local buffers is done in several steps:
+    // 1.0) Read the sector headers, finding the current generations.
+    // 2.0) Setup TOC (counting number of RPI's in each sector) and order the
+    //      sectors holding data of the current generations by sequence number.
+    // 3.0) Copy last "TEK_ROLLING_PERIOD" number of TEKS from flash to buffer.
+
     // Clear TOC, local TEK and local RPI
     memset(_db_flash_toc, CT_DB_EMPTY, sizeof(_db_flash_toc));
-    _db_flash_rpi_cnt = 0;
-    ct_db_tek_clear();
-    ct_db_rpi_clear();
-
-    // Load TOC & external TEK
-    // => starting at "newest sector", working backwards, scanning sectors and
-    //     retrieving data until all sectors are loaded or when an empty
-    //     sector is encounterd.
-    for (uint32_t offset = 0; offset<CT_FLASH_SECTOR_COUNT; offset++) {
-        sector      = IDX_SKIP_PREV(target_sector,offset,CT_FLASH_SECTOR_COUNT);
-        sector_addr = sector*CT_FLASH_SECTOR_SIZE;
-        addr        = sector_addr;
-
-        // Read ival from sector.
-        ival = 0;
-        err  = flash_read(_db_flash_dev, addr, (uint8_t*)&ival, sizeof(ival));
+    _db_flash_rpi_cnt   = 0;
+    _db_flash_order_cnt = 0;
+    _db_flash_seq       = 0;
+    // Generations which are not yet stored in flash, see Generations.
+    _db_flash_gen_rpi   = ct_priv.db_gen_rpi;
+    _db_flash_gen_tek   = ct_priv.db_gen_tek;
+    _db_flash_torn      = 0;
+    _db_flash_quar_cnt  = 0;
+    memset(_db_flash_quar, 0, sizeof(_db_flash_quar));
+    ct_db_tek_reset();
+    ct_db_rpi_reset();
+
+    for (sector = 0; sector<CT_FLASH_SECTOR_COUNT; sector++) {
+        // Initialize corresponding toc-page
+        toc_page            = &_db_flash_toc[sector];
+        toc_page->cnt       = 0;
+        toc_page->erase_cnt = 0;
+        toc_page->v0        = false;
+        toc_page->alt       = false;
+
+        uint32_t mark;
+        err = db_flash_read(CT_FLASH_MARK_ADDR(sector), &mark, sizeof(mark));
         if (err != 0) {
-            LOG_ERR("Flash read failed! %d [IVAL]\n", err);
+            LOG_ERR("Flash read failed! %d [MARK]\n", err);
             return err;
         }
 
-        // When no valid ival is found, we are done : sector is empty.
-        if (ival == _db_ival_empty)
-            break;
+        err = ct_db_flash_hdr_read(sector, &hdr);
+        if ((err != 0) && (err != -ENOENT) && (err != -EBADMSG) &&
+                (err != -ENOMSG)) {
+            return err;
+        }
 
-        // Initialize corresponding toc-page
-        toc_page       = &_db_flash_toc[sector];
-        toc_page->ival = ival;
-        toc_page->cnt  = 0;
+        // Each header holds the generations at the time it was written.
+        if (err == 0) {
+            _db_flash_gen_rpi = MAX(_db_flash_gen_rpi, hdr.gen_rpi);
+            _db_flash_gen_tek = MAX(_db_flash_gen_tek, hdr.gen_tek);
+            _db_flash_seq     = MAX(_db_flash_seq, hdr.seq + 1);
+        }
 
-        // Offset read-address with "ival" number,
-        addr += sizeof(ival);
+        if (mark == DB_FLASH_MARK_QUARANTINE) {
+            atomic_set_bit(_db_flash_quar, sector);
+            _db_flash_quar_cnt++;
+            continue;
+        }
 
-        // Fetch TEK from flash
-        // ==> Copy when there is still space available in our local-buffer
-        // ==> Only the last "CT_DB_TEK_CNT_LOCAL" TEK's should be copied.
-        if (_db_tek_cnt < CT_DB_TEK_CNT_LOCAL) {
-            db_tek_t tek;
-            err  = flash_read(_db_flash_dev, addr, (uint8_t*)&tek, sizeof(tek));
+        if (err == -EBADMSG) {
+            LOG_WRN("Flash: torn header @ 0x%06x skipped",
+                            sector*CT_FLASH_SECTOR_SIZE);
+            _db_flash_torn++;
+            // Erase count is lost, resolved below.
+            toc_page->erase_cnt = UINT32_MAX;
+            continue;
+        } else if ((err == -ENOMSG) && (hdr.format < DB_FLASH_V0_IVAL_MAX)) {
+            // Version 0, its 'seq' follows from the order of the intervals.
+            toc_page->ival      = hdr.format;
+            toc_page->v0        = true;
+            toc_page->erase_cnt = UINT32_MAX;
+            v0_cnt++;
+            continue;
+        } else if (err == -ENOMSG) {
+            // Data of another format can not be read: erase it, so the sector
+            //  is free and does not appear as torn data.
+            flash_write_protection_set(_db_flash_dev, false);
+            err = db_flash_erase(sector*CT_FLASH_SECTOR_SIZE,
+                            CT_FLASH_SECTOR_SIZE);
             if (err != 0) {
-                LOG_ERR("Flash read failed! %d [TEK]\n", err);
+                LOG_ERR("Flash erase failed! %d\n", err);
                 return err;
             }
+            _db_flash_erases++;
+            foreign++;
+            // Erase count is lost, resolved below.
+            toc_page->erase_cnt = UINT32_MAX;
+            continue;
+        } else if (err == -ENOENT) {
+            continue;
+        }
 
-            // TEK not yet added? ==> add TEK!
-            // > shift "prev" because we add from new...old!
-            // > after "flash_load", new TEK will be insterted at idx=0!
-            // > 'ival' is used to validate as this should be unique to the TEK
-            if (_db_tek_list[_db_tek_idx].ival != tek.ival) {
-                _db_tek_cnt++;
-                _db_tek_idx = IDX_PREV(_db_tek_idx, CT_DB_TEK_CNT_LOCAL);
-                memcpy(&_db_tek_list[_db_tek_idx], &tek, sizeof(tek) );
+        toc_page->ival      = hdr.ival;
+        toc_page->seq       = hdr.seq;
+        toc_page->erase_cnt = hdr.erase_cnt;
+        toc_page->alt       = (hdr.format == DB_FLASH_FORMAT_ALT);
+        erase_max           = MAX(erase_max, hdr.erase_cnt);
+        alt_cnt            += toc_page->alt ? 1 : 0;
+    }
+
+    if (foreign > 0) {
+        LOG_WRN("Flash: %u sectors of another format erased (format %08x)",
+                        foreign, DB_FLASH_FORMAT);
+    }
+    if (alt_cnt > 0) {
+        LOG_WRN("Flash: %u sectors of format %08x", alt_cnt,
+                        DB_FLASH_FORMAT_ALT);
+    }
+
+    // Version 0 sectors precede all others, see Format. Sectors started with
+    //  the same interval are taken in the order of the sectors.
+    if (v0_cnt > 0) {
+        LOG_WRN("Flash: %u sectors of version 0", v0_cnt);
+    }
+    for (sector = 0; sector<CT_FLASH_SECTOR_COUNT; sector++) {
+        toc_page = &_db_flash_toc[sector];
+        if (!toc_page->v0) {
+            continue;
+        }
+        toc_page->seq = 0;
+        for (uint32_t s = 0; s<CT_FLASH_SECTOR_COUNT; s++) {
+            if (_db_flash_toc[s].v0 &&
+                    ((_db_flash_toc[s].ival < toc_page->ival) ||
+                    ((_db_flash_toc[s].ival == toc_page->ival) && (s < sector)))) {
+                toc_page->seq++;
             }
         }
+    }
 
-        // Offset address with "tek"
-        addr += sizeof(db_tek_t);
+    // A new generation starts at the next sector.
+    _db_flash_seq = MAX(_db_flash_seq, v0_cnt);
+    _db_flash_seq = MAX(_db_flash_seq, MAX(_db_flash_gen_rpi, _db_flash_gen_tek));
 
-        // Count RPI's
-        do {
-#if defined(CT_FLASH_LOAD_RPI_FULL) && (CT_FLASH_LOAD_RPI_FULL==1)
-            db_rpi_t rpi;
-            err  = flash_read(_db_flash_dev, addr, (uint8_t*) &rpi, sizeof(rpi));
-#else
-            ival = 0;
-            err  = flash_read(_db_flash_dev, addr, (uint8_t*) &ival, sizeof(ival));
-#endif
+    for (sector = 0; sector<CT_FLASH_SECTOR_COUNT; sector++) {
+        toc_page = &_db_flash_toc[sector];
+
+        // Assume the highest erase count for sectors with a torn header, so
+        //  they are not preferred by ct_db_flash_alloc.
+        if (toc_page->erase_cnt == UINT32_MAX) {
+            toc_page->erase_cnt = erase_max;
+        }
+
+        if (toc_page->ival == _db_ival_empty) {
+            continue;
+        }
+
+        // Sectors with RPIs and TEK of older generations are free.
+        if ((toc_page->seq < _db_flash_gen_rpi) &&
+                (toc_page->seq < _db_flash_gen_tek)) {
+            toc_page->ival = _db_ival_empty;
+            toc_page->seq  = _db_ival_empty;
+            toc_page->v0   = false;
+            toc_page->alt  = false;
+            continue;
+        }
+
+        // Count RPI's of the current generation
+        if (toc_page->seq >= _db_flash_gen_rpi) {
+            err = ct_db_flash_rpi_count(sector, &toc_page->cnt);
             if (err != 0) {
-                LOG_ERR("Flash read failed! %d [RPI]\n", err);
                 return err;
             }
+            _db_flash_rpi_cnt += toc_page->cnt;
+        }
 
-#if defined(CT_FLASH_LOAD_RPI_FULL) && (CT_FLASH_LOAD_RPI_FULL==1)
-            ival = rpi.ival_first;
-#endif
-            // No more RPI's
-            if (ival == _db_ival_empty)
-                break;
-
-#if defined(CT_FLASH_LOAD_RPI_FULL) && (CT_FLASH_LOAD_RPI_FULL==1)
-            LOG_DBG(" >> [%04d] addr:%06x - ival:%010d",
-                            _db_flash_rpi_cnt, addr, ival);
-            LOG_HEXDUMP_DBG((uint8_t*)&rpi.rpi, RPI_SIZE, "RPI");
-#endif
+        // Insert sector in order of sequence number
+        uint32_t i = _db_flash_order_cnt++;
+        while ((i > 0) &&
+                (_db_flash_toc[_db_flash_order[i - 1]].seq > toc_page->seq)) {
+            _db_flash_order[i] = _db_flash_order[i - 1];
+            i--;
+        }
+        _db_flash_order[i] = sector;
+    }
 
-            // Foud valid RPI
-            toc_page->cnt++;
-            _db_flash_rpi_cnt++;
+    // Load external TEK
+    // => starting at "newest sector", working backwards, until all sectors
+    //     are loaded or the local buffer is full.
+    for (uint32_t i = _db_flash_order_cnt;
+                    (i > 0) && (_db_tek_cnt < CT_DB_TEK_CNT_LOCAL); i--) {
+        sector = _db_flash_order[i - 1];
+
+        if (_db_flash_toc[sector].v0) {
+            err = ct_db_flash_v0_hdr_read(sector, &hdr);
+        } else {
+            err = ct_db_flash_hdr_read(sector, &hdr);
+        }
+        if (err != 0) {
+            return err;
+        }
 
-            // Point to next RPI
-            addr += sizeof(db_rpi_t);
+        // No TEK, or TEK of an older generation
+        if ((hdr.tek.ival == _db_ival_empty) || (hdr.seq < _db_flash_gen_tek)) {
+            continue;
+        }
 
-        // Stop when there isn't valid data or when we reached end of sector.
-        } while ( (ival != _db_ival_empty) &&
-                    (addr < (sector_addr + CT_FLASH_SECTOR_SIZE)));
+        // Fetch TEK from header
+        // ==> Copy when there is still space available in our local-buffer
+        // ==> Only the last "CT_DB_TEK_CNT_LOCAL" TEK's should be copied.
+        // > 'ival' is used to validate as this should be unique to the TEK
+        if (_db_tek_list[_db_tek_idx].ival != hdr.tek.ival) {
+            // TEK not yet added? ==> add TEK!
+            // > shift "prev" because we add from new...old!
+            // > after "flash_load", new TEK will be insterted at idx=0!
+            _db_tek_cnt++;
+            _db_tek_idx = IDX_PREV(_db_tek_idx, CT_DB_TEK_CNT_LOCAL);
+            memcpy(&_db_tek_list[_db_tek_idx], &hdr.tek, sizeof(hdr.tek));
+        }
     }
 
     //New TEK's should be added at idx=0
     _db_tek_idx = 0;
 
-    // New data should be pushed to the sector following the sector with the
-    //      highest ival
-    _db_flash_sector_idx    = IDX_NEXT(target_sector, CT_FLASH_SECTOR_COUNT);
-    _db_flash_sector_offset = 0; //write at first addr.
+    // Loaded sectors may have expired since they were last written, this is
+    //  only known once the current interval is: the first ct_db_tick() expires
+    //  them.
+
+    // New data should be pushed to a newly allocated sector, following the
+    //      newest sector. This also moves appending past torn records.
+    _db_flash_sector_idx    = (_db_flash_order_cnt > 0) ?
+                    _db_flash_order[_db_flash_order_cnt - 1] : 0;
+    _db_flash_sector_offset = 0; //no sector started.
 #if 0
     // Print TOC
     for (sector = 0; sector<CT_FLASH_SECTOR_COUNT; sector++) {
         toc_page = &_db_flash_toc[sector];
-        printk("ToC[%04d] addr:0x%06x ival:%010d rpi-cnt:%03d %s\n",
-            sector, sector*CT_FLASH_SECTOR_SIZE, toc_page->ival, toc_page->cnt,
-                ((sector==_db_flash_sector_idx) ? "<< target" : ""));
+        printk("ToC[%04d] addr:0x%06x ival:%010d seq:%010d erase-cnt:%06d "
+            "rpi-cnt:%03d %s\n", sector, sector*CT_FLASH_SECTOR_SIZE,
+                toc_page->ival, toc_page->seq, toc_page->erase_cnt,
+                toc_page->cnt, ((sector==_db_flash_sector_idx) ? "<< newest" : ""));
     }
 #endif
 
@@ -371,74 +1068,154 @@ int ct_db_flash_load(void) {
     return 0;
 }
 
+// Select the sector to start: the free sector with the lowest erase count or,
+//  when all sectors hold data, the sector holding the oldest data.
+// > Equally worn sectors are taken in ring order after the current sector.
+// > Terminates as at most CT_DB_QUARANTINE_MAX sectors are quarantined.
+static uint32_t ct_db_flash_alloc(void)
+{
+    uint32_t best = CT_FLASH_SECTOR_COUNT;
+
+    for (uint32_t n = 1; n <= CT_FLASH_SECTOR_COUNT; n++) {
+        uint32_t sector = IDX_SKIP_NEXT(_db_flash_sector_idx, n,
+                                CT_FLASH_SECTOR_COUNT);
+
+        if (atomic_test_bit(_db_flash_quar, sector) ||
+                (_db_flash_toc[sector].ival != _db_ival_empty)) {
+            continue;
+        }
+        if ((best == CT_FLASH_SECTOR_COUNT) ||
+                (_db_flash_toc[sector].erase_cnt < _db_flash_toc[best].erase_cnt)) {
+            best = sector;
+        }
+    }
+
+    if (best == CT_FLASH_SECTOR_COUNT) {
+        best = _db_flash_order[0];
+    }
+    return best;
+}
+
 int ct_db_flash_tek(db_tek_t* tek)
 {
     int err;
     uint32_t addr;
     db_flash_toc_page_t *toc_page;
 
-    //determine address of next sector
-    // => Only start new sector if data has been written in current.
-    if (_db_flash_sector_offset != 0)
-        _db_flash_sector_idx = IDX_NEXT(_db_flash_sector_idx,CT_FLASH_SECTOR_COUNT);
+    // Write of a new TEK should always be aligned to the start of a sector.
+    // => Allocate a new sector, also when none was written in the current.
+    _db_flash_sector_idx    = ct_db_flash_alloc();
+    _db_flash_sector_offset = 0;
+    addr = _db_flash_sector_idx*CT_FLASH_SECTOR_SIZE;
 
     // TOC page containing corresponding data.
     toc_page = &_db_flash_toc[_db_flash_sector_idx];
 
-    // Write of a new TEK should always be aligned to the start of a sector.
-    _db_flash_sector_offset = 0;
-    addr = _db_flash_sector_idx*CT_FLASH_SECTOR_SIZE + _db_flash_sector_offset;
-
     // Erase sector to enable us to write data.
     // ==> a "write" can only write "0" !
     flash_write_protection_set(_db_flash_dev, false);
-    err = flash_erase(_db_flash_dev, addr, CT_FLASH_SECTOR_SIZE);
+    err = db_flash_erase(addr, CT_FLASH_SECTOR_SIZE);
     if (err != 0) {
         LOG_ERR("Flash erase failed! %d\n", err);
         return err;
     }
 
     // Erase succesfull, so we need to clear ival & RPI's from TOC
-    // 1) Decrease RPI-count if TOC-page contains data.
-    if (toc_page->cnt != _db_cnt_empty) {
-        _db_flash_rpi_cnt -= toc_page->cnt;
-    }
-    // 2) Clear TOC-page
-    memset(toc_page, CT_DB_EMPTY, sizeof(db_flash_toc_page_t));
+    ct_db_flash_drop(_db_flash_sector_idx);
+    toc_page->erase_cnt++;
+    _db_flash_erases++;
+
+    // Write current ival and tek at once ==> always at start of sector!
+    db_flash_hdr_t hdr = {
+        .format    = DB_FLASH_FORMAT,
+        .ival      = _db_ival,
+        .seq       = _db_flash_seq,
+        .erase_cnt = toc_page->erase_cnt,
+        .gen_rpi   = _db_flash_gen_rpi,
+        .gen_tek   = _db_flash_gen_tek,
+        .tek       = *tek,
+    };
+    hdr.crc = DB_FLASH_HDR_CRC(&hdr);
 
-    // Write current ival ==> always at start of sector!
     flash_write_protection_set(_db_flash_dev, false);
-    err = flash_write(_db_flash_dev, addr, (uint8_t*)&_db_ival, sizeof(uint32_t));
+    err = db_flash_write(addr, (uint8_t*)&hdr, sizeof(hdr));
     if (err != 0) {
-        LOG_ERR("Flash write (ival) failed! %d\n", err);
-        //reset offset so new sector will be written upon next db-update
-        _db_flash_sector_offset = 0;
-        return err;
-    }
-
-    _db_flash_sector_offset += sizeof(uint32_t);
-    addr = _db_flash_sector_idx*CT_FLASH_SECTOR_SIZE + _db_flash_sector_offset;
-
-    // Write tek
-    flash_write_protection_set(_db_flash_dev, false);
-    err = flash_write(_db_flash_dev, addr, (uint8_t*)tek, sizeof(db_tek_t));
-    if (err != 0) {
-        LOG_ERR("Flash write (tek) failed! %d\n", err);
-        //reset offset so this sector will be re-written upon next db-update
-        _db_flash_sector_offset = 0;
+        LOG_ERR("Flash write (hdr) failed! %d\n", err);
+        //offset remains 0, so a sector will be allocated upon next db-update
         return err;
     }
 
     //printf("Flash write succes! 0x%06x : %d [tek]\n", addr, tek->ival);
-    _db_flash_sector_offset += sizeof(db_tek_t);
+    _db_flash_sector_offset += sizeof(db_flash_hdr_t);
 
     //ival and TEK written succesfully to Flash, update TOC
     toc_page->ival = _db_ival;
+    toc_page->seq  = _db_flash_seq++;
     toc_page->cnt  = 0;
+    toc_page->v0   = false;
+    toc_page->alt  = false;
+    _db_flash_order[_db_flash_order_cnt++] = _db_flash_sector_idx;
 
     return 0;
 }
 
+// Start a new sector with the last TEK, or without TEK when there is none.
+static int ct_db_flash_tek_last(void)
+{
+    db_tek_t tek;
+    memset(&tek, CT_DB_EMPTY, sizeof(tek));
+    ct_db_tek_get_last(tek.tek, &tek.ival);
+    return ct_db_flash_tek(&tek);
+}
+
+// Save the generations in settings, see Generations.
+static void ct_db_flash_gen_save(void)
+{
+    ct_priv.db_gen_rpi = _db_flash_gen_rpi;
+    ct_priv.db_gen_tek = _db_flash_gen_tek;
+    if (!IS_ENABLED(CONFIG_SETTINGS)) {
+        return;
+    }
+
+    int err = settings_save_one("ct/db_gen_rpi", &ct_priv.db_gen_rpi,
+                    sizeof(ct_priv.db_gen_rpi));
+    if (!err) {
+        err = settings_save_one("ct/db_gen_tek", &ct_priv.db_gen_tek,
+                    sizeof(ct_priv.db_gen_tek));
+    }
+    if (err) {
+        LOG_ERR("Saving generations failed (err %d)", err);
+    }
+}
+
+// Start a new generation of RPIs and/or TEKs, clearing them in flash.
+// > The generation is saved in settings, and stored in flash by the next
+//   sector which is started.
+static void ct_db_flash_gen(bool rpi, bool tek)
+{
+    if (rpi) {
+        _db_flash_gen_rpi = _db_flash_seq;
+    }
+    if (tek) {
+        _db_flash_gen_tek = _db_flash_seq;
+    }
+    ct_db_flash_gen_save();
+
+    // Update TOC, from new..old as sectors may be removed from the order.
+    for (uint32_t i = _db_flash_order_cnt; i > 0; i--) {
+        uint32_t sector = _db_flash_order[i - 1];
+        db_flash_toc_page_t *toc_page = &_db_flash_toc[sector];
+
+        if ((toc_page->seq < _db_flash_gen_rpi) &&
+                (toc_page->seq < _db_flash_gen_tek)) {
+            ct_db_flash_drop(sector);
+        } else if (toc_page->seq < _db_flash_gen_rpi) {
+            _db_flash_rpi_cnt -= toc_page->cnt;
+            toc_page->cnt = 0;
+        }
+    }
+}
+
 int ct_db_flash_rpi(db_rpi_t* rpi)
 {
     int err = 0;
@@ -446,28 +1223,32 @@ int ct_db_flash_rpi(db_rpi_t* rpi)
     // Can we write RPI?
     // => if sector is full  ==> start new sector with TEK-write
     // => if sector is empty ==> write RPI to current sector
-    if ( ((CT_FLASH_SECTOR_SIZE - _db_flash_sector_offset) < sizeof(db_rpi_t))
-            || (_db_flash_sector_offset == 0) ) {
-        db_tek_t tek;
-        ct_db_tek_get_last(tek.tek, &tek.ival);
-        err = ct_db_flash_tek(&tek);
+    if ((_db_flash_sector_offset == 0) || (_db_flash_sector_offset >=
+                CT_FLASH_RPI_ADDR(0, CT_FLASH_SECTOR_RPIS))) {
+        err = ct_db_flash_tek_last();
         if (err != 0) {
             return err;
         }
     }
 
-    // Write RPI
+    // Write RPI and its CRC at once
+    db_flash_rpi_t rec;
+    memcpy(&rec.rpi, rpi, sizeof(db_rpi_t));
+    rec.crc = DB_FLASH_RPI_CRC(&rec);
+
     flash_write_protection_set(_db_flash_dev, false);
     uint32_t addr = _db_flash_sector_idx * CT_FLASH_SECTOR_SIZE
                         + _db_flash_sector_offset;
-    err = flash_write(_db_flash_dev, addr, (uint8_t*)rpi, sizeof(db_rpi_t));
+    err = db_flash_write(addr, (uint8_t*)&rec, sizeof(rec));
     if (err != 0) {
         LOG_ERR("Flash write (rpi) failed! %d\n", err);
+        // Slot may be torn ==> close sector, next RPI starts a new sector.
+        _db_flash_sector_offset = 0;
         return err;
     }
 
     //Write succesfull, so increase offset
-    _db_flash_sector_offset += sizeof(db_rpi_t);
+    _db_flash_sector_offset += sizeof(db_flash_rpi_t);
 
     //Update TOC
     _db_flash_toc[_db_flash_sector_idx].cnt++;
@@ -476,10 +1257,13 @@ int ct_db_flash_rpi(db_rpi_t* rpi)
     return err;
 }
 
-void ct_db_flash_flush(void)
+// Flush all RPI's from local buffer to flash.
+// > On a write error the RPI and all newer RPIs remain in the local buffer.
+int ct_db_flash_flush(void)
 {
     uint32_t idx_rpi;
     db_rpi_t *db_rpi;
+    int err;
 
     // Flush all RPI's from local buffer to flash
     for(int i = _db_rpi_cnt; i>0; i--) {
@@ -490,21 +1274,29 @@ void ct_db_flash_flush(void)
                         _db_rpi_idx, db_rpi->ival_first, db_rpi->ival_last);
 
         if (db_rpi->ival_first != _db_ival_empty) {
-            ct_db_flash_rpi(db_rpi);
+            err = ct_db_flash_rpi(db_rpi);
+            if (err != 0) {
+                return err;
+            }
             //remove element from local databse.
             memset(db_rpi, CT_DB_EMPTY, sizeof(db_rpi_t));
             _db_rpi_cnt--;
         }
     }
+
+    return 0;
 }
 
-int ct_db_flash_rpi_get(uint16_t n, db_rpi_t *rpi)
+// Find sector and slot (n'th RPI in sector) of the n'th RPI in flash.
+static void ct_db_flash_rpi_locate(uint32_t n, uint32_t *sector_out,
+                uint32_t *slot_out)
 {
     uint32_t n_idx;
-    uint32_t sector = _db_flash_sector_idx;
+    uint32_t i      = _db_flash_order_cnt - 1;
+    uint32_t sector = _db_flash_order[i];
 
     //get number of RPIs in databse.
-    uint16_t db_cnt;
+    uint32_t db_cnt;
     ct_db_rpi_get_cnt(&db_cnt);
 
     // Instead of counting from oldest..n'th RPI, we search from newest..n'th.
@@ -516,28 +1308,336 @@ int ct_db_flash_rpi_get(uint16_t n, db_rpi_t *rpi)
     // Use TOC to find which sector contains the n'th RPI
     while( _db_flash_toc[sector].cnt <= n_idx ) {
         n_idx -= _db_flash_toc[sector].cnt;
-        sector = IDX_PREV(sector, CT_FLASH_SECTOR_COUNT);
+        sector = _db_flash_order[--i];
     }
 
-    // address of sector
-    uint32_t addr = sector*CT_FLASH_SECTOR_SIZE;
-    // offset to first RPI in sector
-    addr += sizeof(uint32_t) + sizeof(db_tek_t);
-    // offset to n'th RPI
+    *sector_out = sector;
     // => '+1' is added as "cnt" runs from 1..'X',
     //          while 'n' is an index running from 0..'X-1'
-    addr += sizeof(db_rpi_t) * (_db_flash_toc[sector].cnt - (n_idx + 1));
+    *slot_out   = _db_flash_toc[sector].cnt - (n_idx + 1);
+}
+
+int ct_db_flash_rpi_get(uint32_t n, db_rpi_t *rpi)
+{
+    uint32_t sector;
+    uint32_t slot;
+
+    ct_db_flash_rpi_locate(n, &sector, &slot);
+
+    if (_db_flash_toc[sector].v0) {
+        db_flash_v0_rpi_t v0;
+        int err = db_flash_read(CT_FLASH_V0_RPI_ADDR(sector, slot), &v0,
+                        sizeof(v0));
+        if (err != 0) {
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
+            return err;
+        }
+        ct_db_rpi_from_v0(&v0, rpi);
+        return 0;
+    }
+
+    if (_db_flash_toc[sector].alt) {
+        db_flash_alt_rpi_t alt;
+        uint32_t addr = CT_FLASH_ALT_RPI_ADDR(sector, slot);
+        int err = db_flash_read(addr, &alt, sizeof(alt));
+        if (err != 0) {
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
+            return err;
+        }
+        if (alt.crc != DB_FLASH_ALT_RPI_CRC(&alt)) {
+            LOG_ERR("Flash RPI @ 0x%06x corrupt", addr);
+            return -EIO;
+        }
+        ct_db_rpi_from_alt(&alt, rpi);
+        return 0;
+    }
+
+    uint32_t addr = CT_FLASH_RPI_ADDR(sector, slot);
+
+    // Grab RPI from memory
+    db_flash_rpi_t rec;
+    int err = db_flash_read(addr, (uint8_t*)&rec, sizeof(rec));
+    if (err != 0) {
+        LOG_ERR("Flash read failed! %d [RPI]\n", err);
+        return err;
+    }
+    if (rec.crc != DB_FLASH_RPI_CRC(&rec)) {
+        LOG_ERR("Flash RPI @ 0x%06x corrupt", addr);
+        return -EIO;
+    }
+    memcpy(rpi, &rec.rpi, sizeof(db_rpi_t));
+
+    LOG_DBG("Flash-get: n'th:%04d - addr:%06x - ival:%010d",
+                    n, addr, rpi->ival_first);
+    LOG_HEXDUMP_DBG((uint8_t*)&rpi->rpi, RPI_SIZE,"");
+
+    return 0;
+}
+
+// Export the remainder of version 0 'sector', from 'slot'.
+static int ct_db_flash_v0_rpi_export(uint32_t sector, uint32_t slot,
+                uint8_t *buf, size_t buf_len, uint16_t *cnt)
+{
+    // RPIs are read at once at the end of the buffer and converted from the
+    //  start. An export item may be larger than a version 0 RPI, but never
+    //  overlaps with RPIs which are not yet converted.
+    uint32_t todo = MIN(_db_flash_toc[sector].cnt - slot, buf_len /
+                MAX(sizeof(db_flash_v0_rpi_t), sizeof(ct_db_rpi_export_t)));
+    uint8_t *src  = &buf[buf_len - (todo * sizeof(db_flash_v0_rpi_t))];
+    int err = db_flash_read(CT_FLASH_V0_RPI_ADDR(sector, slot),
+                        src, todo * sizeof(db_flash_v0_rpi_t));
+    if (err != 0) {
+        LOG_ERR("Flash read failed! %d [RPI-EXPORT]\n", err);
+        return err;
+    }
+
+    for (uint32_t i = 0; i < todo; i++) {
+        db_flash_v0_rpi_t v0;
+        db_rpi_t rpi;
+        memcpy(&v0, &src[i * sizeof(db_flash_v0_rpi_t)], sizeof(v0));
+        ct_db_rpi_from_v0(&v0, &rpi);
+        ct_db_rpi_to_export(&rpi,
+                        (ct_db_rpi_export_t*)&buf[i * sizeof(ct_db_rpi_export_t)]);
+    }
+
+    *cnt = todo;
+    return 0;
+}
+
+// Export the remainder of 'sector' of DB_FLASH_FORMAT_ALT, from 'slot'. As for
+//  version 0, RPIs are read at the end of the buffer and converted from the
+//  start, stopping before a corrupt RPI.
+static int ct_db_flash_alt_rpi_export(uint32_t sector, uint32_t slot,
+                uint8_t *buf, size_t buf_len, uint16_t *cnt)
+{
+    uint32_t todo = MIN(_db_flash_toc[sector].cnt - slot, buf_len /
+                MAX(sizeof(db_flash_alt_rpi_t), sizeof(ct_db_rpi_export_t)));
+    uint8_t *src  = &buf[buf_len - (todo * sizeof(db_flash_alt_rpi_t))];
+    int err = db_flash_read(CT_FLASH_ALT_RPI_ADDR(sector, slot),
+                        src, todo * sizeof(db_flash_alt_rpi_t));
+    if (err != 0) {
+        LOG_ERR("Flash read failed! %d [RPI-EXPORT]\n", err);
+        return err;
+    }
+
+    for (uint32_t i = 0; i < todo; i++) {
+        db_flash_alt_rpi_t alt;
+        db_rpi_t rpi;
+        memcpy(&alt, &src[i * sizeof(db_flash_alt_rpi_t)], sizeof(alt));
+        if (alt.crc != DB_FLASH_ALT_RPI_CRC(&alt)) {
+            LOG_ERR("Flash RPI @ 0x%06x corrupt",
+                        CT_FLASH_ALT_RPI_ADDR(sector, slot + i));
+            if (i == 0) {
+                return -EIO;
+            }
+            todo = i;
+            break;
+        }
+        ct_db_rpi_from_alt(&alt, &rpi);
+        ct_db_rpi_to_export(&rpi,
+                        (ct_db_rpi_export_t*)&buf[i * sizeof(ct_db_rpi_export_t)]);
+    }
+
+    *cnt = todo;
+    return 0;
+}
+
+// Export the remainder of the sector holding the n'th RPI in flash.
+int ct_db_flash_rpi_export(uint32_t n, uint8_t *buf, size_t buf_len,
+                uint16_t *cnt)
+{
+    uint32_t sector;
+    uint32_t slot;
+
+    ct_db_flash_rpi_locate(n, &sector, &slot);
+    if (_db_flash_toc[sector].v0) {
+        return ct_db_flash_v0_rpi_export(sector, slot, buf, buf_len, cnt);
+    }
+    if (_db_flash_toc[sector].alt) {
+        return ct_db_flash_alt_rpi_export(sector, slot, buf, buf_len, cnt);
+    }
+
+    // Read all remaining RPIs of this sector at once.
+    uint32_t todo = MIN(_db_flash_toc[sector].cnt - slot,
+                        buf_len / sizeof(db_flash_rpi_t));
+    int err = db_flash_read(CT_FLASH_RPI_ADDR(sector, slot),
+                        buf, todo * sizeof(db_flash_rpi_t));
+    if (err != 0) {
+        LOG_ERR("Flash read failed! %d [RPI-EXPORT]\n", err);
+        return err;
+    }
+
+    // Convert in place. Export items are smaller than db-items, so
+    //  the n'th export item never overlaps with db-item n+1.
+    // >> Export stops before a corrupt RPI, which is then reported by the
+    //    next export.
+    for (uint32_t i = 0; i < todo; i++) {
+        db_flash_rpi_t rec;
+        memcpy(&rec, &buf[i * sizeof(db_flash_rpi_t)], sizeof(rec));
+        if (rec.crc != DB_FLASH_RPI_CRC(&rec)) {
+            LOG_ERR("Flash RPI @ 0x%06x corrupt",
+                        CT_FLASH_RPI_ADDR(sector, slot + i));
+            if (i == 0) {
+                return -EIO;
+            }
+            todo = i;
+            break;
+        }
+        ct_db_rpi_to_export(&rec.rpi,
+                        (ct_db_rpi_export_t*)&buf[i * sizeof(ct_db_rpi_export_t)]);
+    }
+
+    *cnt = todo;
+    return 0;
+}
+
+// Read the RPI in 'slot' of 'sector'. A CRC mismatch is confirmed by reading
+//  the RPI again, so a transient read error does not condemn a sector.
+// > returns -EBADMSG when the RPI is corrupt.
+static int ct_db_flash_rpi_read(uint32_t sector, uint32_t slot,
+                db_flash_rpi_t *rec)
+{
+    for (int i = 0; i < 2; i++) {
+        int err = db_flash_read(CT_FLASH_RPI_ADDR(sector, slot), rec,
+                        sizeof(*rec));
+        if (err != 0) {
+            LOG_ERR("Flash read failed! %d [RPI]\n", err);
+            return err;
+        }
+        if (rec->crc == DB_FLASH_RPI_CRC(rec)) {
+            return 0;
+        }
+    }
+    return -EBADMSG;
+}
+
+// Remove the RPIs of a bad sector from the database and quarantine it.
+// > Valid RPIs of the sector are written again to the newest sector, so they
+//   are kept until that sector expires.
+static void ct_db_flash_quarantine(uint32_t sector)
+{
+    uint16_t cnt = _db_flash_toc[sector].cnt;
+    db_flash_rpi_t rec;
+    int err;
+
+    // Exclude the sector from allocation while its RPIs are relocated.
+    ct_db_flash_drop(sector);
+    atomic_set_bit(_db_flash_quar, sector);
+
+    // Continue writing in a new sector.
+    if (sector == _db_flash_sector_idx) {
+        _db_flash_sector_offset = 0;
+    }
+
+    for (uint32_t slot = 0; slot < cnt; slot++) {
+        err = ct_db_flash_rpi_read(sector, slot, &rec);
+        if (err == -EBADMSG) {
+            continue;
+        }
+        if (err == 0) {
+            err = ct_db_flash_rpi(&rec.rpi);
+        }
+        if (err != 0) {
+            LOG_ERR("Flash: sector %u, %u RPIs lost", sector, cnt - slot);
+            break;
+        }
+        _db_integrity.relocated++;
+    }
+
+    if (_db_flash_quar_cnt >= CT_DB_QUARANTINE_MAX) {
+        atomic_clear_bit(_db_flash_quar, sector);
+        LOG_ERR("Flash: sector %u removed, quarantine full", sector);
+        return;
+    }
+
+    // Without a mark the sector is quarantined until reboot.
+    uint32_t mark = DB_FLASH_MARK_QUARANTINE;
+    flash_write_protection_set(_db_flash_dev, false);
+    err = db_flash_write(CT_FLASH_MARK_ADDR(sector), &mark, sizeof(mark));
+    if (err != 0) {
+        LOG_ERR("Flash write (mark) failed! %d\n", err);
+    }
+
+    _db_flash_quar_cnt++;
+    LOG_WRN("Flash: sector %u quarantined", sector);
+}
+
+// Check the header of 'sector' against the TOC. A mismatch is confirmed by
+//  reading the header again.
+static int ct_db_flash_scrub_hdr(uint32_t sector, bool *bad)
+{
+    db_flash_toc_page_t *toc_page = &_db_flash_toc[sector];
+    db_flash_hdr_t hdr;
+    int err;
+
+    for (int i = 0; i < 2; i++) {
+        err = ct_db_flash_hdr_read(sector, &hdr);
+        if ((err == 0) && (hdr.ival == toc_page->ival) &&
+                (hdr.seq == toc_page->seq) &&
+                (hdr.erase_cnt == toc_page->erase_cnt)) {
+            *bad = false;
+            return 0;
+        }
+        if ((err != 0) && (err != -ENOENT) && (err != -EBADMSG) &&
+                (err != -ENOMSG)) {
+            return err;
+        }
+    }
+
+    *bad = true;
+    return 0;
+}
+
+// Verify a sector holding data against its CRCs and the TOC.
+// => 'bad' is set when the sector has errors.
+static int ct_db_flash_scrub_sector(uint32_t sector, bool *bad)
+{
+    db_flash_toc_page_t *toc_page = &_db_flash_toc[sector];
+    db_flash_rpi_t rec;
+    uint32_t slot;
+    int err;
 
-    // Grab RPI from memory
-    int err = flash_read(_db_flash_dev, addr, (uint8_t*)rpi, sizeof(db_rpi_t));
+    err = ct_db_flash_scrub_hdr(sector, bad);
     if (err != 0) {
-        LOG_ERR("Flash read failed! %d [RPI]\n", err);
         return err;
     }
+    if (*bad) {
+        LOG_WRN("Flash: sector %u header invalid", sector);
+        return 0;
+    }
 
-    LOG_DBG("Flash-get: n'th:%04d - addr:%06x - ival:%010d",
-                    n, addr, rpi->ival_first);
-    LOG_HEXDUMP_DBG((uint8_t*)&rpi->rpi, RPI_SIZE,"");
+    for (slot = 0; slot < toc_page->cnt; slot++) {
+        err = ct_db_flash_rpi_read(sector, slot, &rec);
+        if (err == -EBADMSG) {
+            LOG_WRN("Flash: sector %u RPI %u corrupt", sector, slot);
+            _db_integrity.rpi_errors++;
+            *bad = true;
+        } else if (err != 0) {
+            return err;
+        }
+    }
+
+    // Slots to be written should be erased, e.g. not partially erased.
+    // >> Confirmed by a second read, as for the RPIs.
+    if ((sector == _db_flash_sector_idx) && (_db_flash_sector_offset != 0)) {
+        for (; slot < CT_FLASH_SECTOR_RPIS; slot++) {
+            bool empty = false;
+            for (int i = 0; (i < 2) && !empty; i++) {
+                err = db_flash_read(CT_FLASH_RPI_ADDR(sector, slot), &rec,
+                                sizeof(rec));
+                if (err != 0) {
+                    LOG_ERR("Flash read failed! %d [SCRUB]\n", err);
+                    return err;
+                }
+                empty = db_flash_is_empty(&rec, sizeof(rec));
+            }
+            if (!empty) {
+                LOG_WRN("Flash: sector %u slot %u not erased", sector, slot);
+                *bad = true;
+                break;
+            }
+        }
+    }
 
     return 0;
 }
@@ -546,8 +1646,16 @@ int ct_db_flash_rpi_get(uint16_t n, db_rpi_t *rpi)
 
 
 
+#ifdef DB_USE_EXTERNAL_FLASH
+// Check whether a record in the local buffer should be pushed to flash.
+static bool ct_db_rpi_is_old(const db_rpi_t *db_rpi, uint32_t ival)
+{
+    return (ival - db_rpi->ival_first) > CT_DB_IVAL_DIFF_OLD;
+}
+#endif /* DB_USE_EXTERNAL_FLASH */
+
 // Allow db to provide data-management, providing the current interval.
-int ct_db_tick(uint32_t ival)
+static int ct_db_tick_locked(uint32_t ival)
 {
     // no update..
     if (_db_ival == ival) {
@@ -556,6 +1664,8 @@ int ct_db_tick(uint32_t ival)
     _db_ival = ival;
 
     // DB management
+    // >> RPIs are pushed to flash oldest first, which keeps their index, also
+    //    during a snapshot.
 #ifdef DB_USE_EXTERNAL_FLASH
     uint32_t idx_rpi;
     db_rpi_t *db_rpi;
@@ -569,8 +1679,12 @@ int ct_db_tick(uint32_t ival)
                         db_rpi->ival_last, ival);
 
         if (db_rpi->ival_first != 0) {
-            if ((ival - db_rpi->ival_first) > CT_DB_IVAL_DIFF_OLD) {
-                ct_db_flash_rpi(db_rpi);
+            if (ct_db_rpi_is_old(db_rpi, ival)) {
+                // Keep the RPI, and all newer, local when the write fails:
+                //  it is retried on the next tick.
+                if (ct_db_flash_rpi(db_rpi) != 0) {
+                    break;
+                }
                 //remove element from local databse.
                 memset(db_rpi, CT_DB_EMPTY, sizeof(db_rpi_t));
                 _db_rpi_cnt--;
@@ -580,6 +1694,11 @@ int ct_db_tick(uint32_t ival)
             }
         }
     }
+
+    // Expiry removes the oldest RPIs, changing the index of all others.
+    if (!_db_snap_active) {
+        ct_db_flash_expire();
+    }
 #endif /* DB_USE_EXTERNAL_FLASH */
 
     return 0;
@@ -587,17 +1706,35 @@ int ct_db_tick(uint32_t ival)
 
 
 
+// All RPIs are cleared: the RPIs of a snapshot are removed from its start, and
+//  RPIs stored after the clear follow them.
+// > returns the number of RPIs removed since the snapshot began.
+static uint32_t ct_db_snap_drop_all(void)
+{
+    if (!_db_snap_active) {
+        return 0;
+    }
+#if defined(DB_USE_EXTERNAL_FLASH)
+    return _db_snap_dropped + _db_rpi_cnt + _db_flash_rpi_cnt;
+#else
+    return _db_snap_dropped + _db_rpi_cnt;
+#endif
+}
+
 /************** TEK **************/
 
-int ct_db_tek_clear(void)
+static int ct_db_tek_clear_locked(void)
 {
-    memset(_db_tek_list, CT_DB_EMPTY, sizeof(_db_tek_list));
-    _db_tek_idx = 0;
-    _db_tek_cnt = 0;
+    ct_db_tek_reset();
+#ifdef DB_USE_EXTERNAL_FLASH
+    ct_db_flash_gen(false, true);
+    return ct_db_flash_tek_last();
+#else
     return 0;
+#endif
 }
 
-int ct_db_tek_add(uint8_t *tek, uint32_t ival)
+static int ct_db_tek_add_locked(uint8_t *tek, uint32_t ival)
 {
     // Add tek..
     db_tek_t *dst = &_db_tek_list[_db_tek_idx];
@@ -607,7 +1744,7 @@ int ct_db_tek_add(uint8_t *tek, uint32_t ival)
 #ifdef DB_USE_EXTERNAL_FLASH
     //update db management
     ct_db_tick(ival);
-    //flush all old RPI's
+    //flush all old RPI's, those failing remain local for the next tick
     ct_db_flash_flush();
     //push new tek
     ct_db_flash_tek(dst);
@@ -623,7 +1760,7 @@ int ct_db_tek_add(uint8_t *tek, uint32_t ival)
 }
 
 //compute number of tek's in database.
-int ct_db_tek_get_cnt(uint16_t *cnt)
+static int ct_db_tek_get_cnt_locked(uint16_t *cnt)
 {
     if(!cnt)
         return -EINVAL;
@@ -634,7 +1771,7 @@ int ct_db_tek_get_cnt(uint16_t *cnt)
 
 
 //retrieve n'th tek from DB
-int ct_db_tek_get(uint16_t n, uint8_t *tek, uint32_t *ival)
+static int ct_db_tek_get_locked(uint16_t n, uint8_t *tek, uint32_t *ival)
 {
     if(!tek || !ival || (n>CT_DB_TEK_CNT_LOCAL))
         return -EINVAL;
@@ -669,7 +1806,7 @@ int ct_db_tek_get(uint16_t n, uint8_t *tek, uint32_t *ival)
 
 
 
-int ct_db_tek_get_last(uint8_t *tek, uint32_t *ival)
+static int ct_db_tek_get_last_locked(uint8_t *tek, uint32_t *ival)
 {
     if(!tek || !ival)
         return -EINVAL;
@@ -696,18 +1833,108 @@ int ct_db_tek_get_last(uint8_t *tek, uint32_t *ival)
 
 /************** RPI **************/
 
-int ct_db_rpi_clear(void)
+static int ct_db_rpi_clear_locked(void)
 {
-    memset(_db_rpi_list, CT_DB_EMPTY, sizeof(_db_rpi_list));
-    _db_rpi_idx = 0;
-    _db_rpi_cnt = 0;
+    uint32_t dropped = ct_db_snap_drop_all();
+
+    ct_db_rpi_reset();
+#ifdef DB_USE_EXTERNAL_FLASH
+    ct_db_flash_gen(true, false);
+#endif
+    _db_snap_dropped = dropped;
+#ifdef DB_USE_EXTERNAL_FLASH
+    return ct_db_flash_tek_last();
+#else
     return 0;
+#endif
 }
 
-int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+// Local index of the record at position 'i' of the local buffer (0 = newest)
+#define DB_RPI_IDX(i)  IDX_SKIP_PREV(_db_rpi_idx, (i)+1, CT_DB_RPI_CNT_LOCAL)
+
+// Uptime in seconds, as kept in db_enc_t.
+static uint32_t ct_db_enc_now(void)
+{
+    return (uint32_t)(k_uptime_get() / 1000);
+}
+
+// Encounter started by an RPI: its first 4 bytes. An RPI which is linked
+//  takes over the encounter of the previous RPI.
+static uint32_t ct_db_enc_id(const uint8_t *rpi)
+{
+    uint32_t enc;
+    memcpy(&enc, rpi, sizeof(enc));
+    return enc;
+}
+
+// Find the previous RPI of an ongoing encounter, to link a new RPI to.
+// > The previous RPI should not be linked yet, should have stopped being seen
+//   before the new RPI appeared, within CT_DB_ENC_IVAL_GAP intervals, and its
+//   typical RSSI should be close to the observed RSSI.
+// > returns the local index of the previous RPI, or -ENOENT.
+static int ct_db_enc_find(int8_t rssi, uint32_t ival, uint32_t now)
+{
+    int prev = -ENOENT;
+    int best = CT_DB_ENC_RSSI_DIFF + 1;
+
+    // Records are ordered by their first observation, from new..old.
+    for (int i = 0; i < _db_rpi_cnt; i++) {
+        uint32_t idx = DB_RPI_IDX(i);
+        db_rpi_t *db_rpi = &_db_rpi_list[idx];
+        db_enc_t *enc = &_db_enc[idx];
+
+        // Older records can only continue an encounter beyond its maximum.
+        if ((ival - db_rpi->ival_first) > CT_DB_ENC_IVAL_MAX) {
+            break;
+        }
+        if ((enc->next != DB_ENC_NONE) ||
+                ((ival - db_rpi->ival_last) > CT_DB_ENC_IVAL_GAP) ||
+                ((int32_t)(now - enc->seen) <= 0) ||
+                ((ival - enc->start) > CT_DB_ENC_IVAL_MAX)) {
+            continue;
+        }
+
+        int diff = abs(ct_db_rpi_rssi_typ(db_rpi) - rssi);
+        if (diff < best) {
+            best = diff;
+            prev = idx;
+        }
+    }
+
+    return prev;
+}
+
+// Register an observation of the RPI at local index 'idx'.
+// > An RPI observed after a following RPI was linked to it did not stop being
+//   seen: the following RPIs start a new encounter.
+static void ct_db_enc_seen(uint32_t idx, uint32_t now)
+{
+    _db_enc[idx].seen = now;
+
+    uint16_t next = _db_enc[idx].next;
+    if (next == DB_ENC_NONE) {
+        return;
+    }
+    _db_enc[idx].next = DB_ENC_NONE;
+
+    uint32_t enc   = ct_db_enc_id(_db_rpi_list[next].rpi);
+    uint32_t start = _db_rpi_list[next].ival_first;
+    LOG_DBG("DB: rpi @ %d unlinked", next);
+    for (; next != DB_ENC_NONE; next = _db_enc[next].next) {
+        _db_rpi_list[next].enc = enc;
+        _db_enc[next].start    = start;
+    }
+}
+#endif /* CONFIG_CT_DB_ENCOUNTERS */
+
+static int ct_db_rpi_add_locked(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
 {
     uint32_t i_idx;
     db_rpi_t *db_rpi;
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    uint32_t now = ct_db_enc_now();
+#endif
 
     // check for doubles...
     // >> we check from new..old
@@ -728,10 +1955,11 @@ int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
         // NOTE: in memory/db replacement!
         if(memcmp(db_rpi->rpi, rpi, sizeof(db_rpi->rpi)) == 0) {
             LOG_DBG("DB: old rpi (seen:%d)", db_rpi->cnt);
-            int32_t rssi_sum = ((int32_t) db_rpi->rssi) * db_rpi->cnt + rssi;
-            db_rpi->cnt++;
-            db_rpi->rssi = rssi_sum / db_rpi->cnt;
+            ct_db_rpi_observe(db_rpi, rssi);
             db_rpi->ival_last = ival;
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+            ct_db_enc_seen(i_idx, now);
+#endif
             return 0;
         }
     }
@@ -746,11 +1974,31 @@ int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
     db_rpi = &_db_rpi_list[_db_rpi_idx];
     memcpy(db_rpi->rpi, rpi, sizeof(db_rpi->rpi));
     memcpy(db_rpi->aem, aem, sizeof(db_rpi->aem));
-    db_rpi->cnt = 1;
-    db_rpi->rssi = rssi;
+    db_rpi->cnt      = 0;
+    db_rpi->rssi_sum = 0;
+    db_rpi->rssi_max = rssi;
+    memset(db_rpi->att, 0, sizeof(db_rpi->att));
+    ct_db_rpi_observe(db_rpi, rssi);
     db_rpi->ival_first = ival;
     db_rpi->ival_last  = ival;
 
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    // New RPI continues an encounter ==> link to its previous RPI.
+    db_enc_t *enc = &_db_enc[_db_rpi_idx];
+    int prev = ct_db_enc_find(rssi, ival, now);
+    if (prev >= 0) {
+        LOG_DBG("DB: rpi @ %d linked to %d", _db_rpi_idx, prev);
+        db_rpi->enc        = _db_rpi_list[prev].enc;
+        enc->start         = _db_enc[prev].start;
+        _db_enc[prev].next = _db_rpi_idx;
+    } else {
+        db_rpi->enc        = ct_db_enc_id(rpi);
+        enc->start         = ival;
+    }
+    enc->seen = now;
+    enc->next = DB_ENC_NONE;
+#endif
+
     // Update indices and management.
     _db_rpi_idx = IDX_NEXT(_db_rpi_idx, CT_DB_RPI_CNT_LOCAL);
     _db_rpi_cnt++;
@@ -763,8 +2011,19 @@ int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
     return 0;
 }
 
+// Translate the index 'n' of an RPI in the snapshot to its current index.
+// > returns -ENODATA when the RPI was removed as the flash ring wrapped.
+static int ct_db_rpi_snap_idx(uint32_t *n)
+{
+    if (*n < _db_snap_dropped) {
+        return -ENODATA;
+    }
+    *n -= _db_snap_dropped;
+    return 0;
+}
+
 //compute number of RPI's in database.
-int ct_db_rpi_get_cnt(uint16_t *cnt)
+static int ct_db_rpi_get_cnt_locked(uint32_t *cnt)
 {
     if(!cnt)
         return -EINVAL;
@@ -779,14 +2038,18 @@ int ct_db_rpi_get_cnt(uint16_t *cnt)
 }
 
 //retrieve n'th tek from DB
-int ct_db_rpi_get(uint16_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
+static int ct_db_rpi_get_locked(uint32_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
                 uint8_t *cnt, uint32_t *ival_last)
 {
-    if(!rpi || (n>CT_DB_RPI_CNT_LOCAL))
+    if(!rpi)
         return -EINVAL;
 
+    int err = ct_db_rpi_snap_idx(&n);
+    if (err != 0)
+        return err;
+
     //get number of RPIs in databse.
-    uint16_t db_cnt;
+    uint32_t db_cnt;
     ct_db_rpi_get_cnt(&db_cnt);
 
     // No RPIs in database..
@@ -794,7 +2057,7 @@ int ct_db_rpi_get(uint16_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
         return -EINVAL;
 
     // the requested number is not in database.
-    if (n > db_cnt)
+    if (n >= db_cnt)
         return -EINVAL;
 
     uint32_t n_idx;
@@ -804,7 +2067,10 @@ int ct_db_rpi_get(uint16_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
 #if defined(DB_USE_EXTERNAL_FLASH)
     // grab from memory?
     if (n < _db_flash_rpi_cnt) {
-        ct_db_flash_rpi_get(n,&elm);
+        err = ct_db_flash_rpi_get(n,&elm);
+        if (err != 0) {
+            return err;
+        }
 
     // grab from local db.
     } else {
@@ -828,38 +2094,198 @@ int ct_db_rpi_get(uint16_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
 
     memcpy(rpi,elm.rpi,RPI_SIZE);
     memcpy(aem,elm.aem,AEM_SIZE);
-    *rssi      = elm.rssi;
+    *rssi      = ct_db_rpi_rssi_typ(&elm);
     *cnt       = elm.cnt;
     *ival_last = elm.ival_last;
 
     return 0;
 }
 
-/************** MAIN **************/
+static int ct_db_rpi_export_locked(uint32_t n, uint8_t *buf, size_t buf_len, uint16_t *cnt)
+{
+    if (!buf || !cnt)
+        return -EINVAL;
 
-int ct_db_clear(void)
+    *cnt = 0;
+
+    int err = ct_db_rpi_snap_idx(&n);
+    if (err != 0)
+        return err;
+
+    //get number of RPIs in databse.
+    uint32_t db_cnt;
+    ct_db_rpi_get_cnt(&db_cnt);
+
+    // the requested number is not in database.
+    if (n >= db_cnt)
+        return -EINVAL;
+
+#if defined(DB_USE_EXTERNAL_FLASH)
+    // grab from memory?
+    if (n < _db_flash_rpi_cnt) {
+        return ct_db_flash_rpi_export(n, buf, buf_len, cnt);
+    }
+    // Correct 'n' with flash-cnt so it holds the index in the local buffer.
+    n -= _db_flash_rpi_cnt;
+#endif
+
+    ct_db_rpi_export_t *exp = (ct_db_rpi_export_t*) buf;
+    uint16_t todo = MIN(_db_rpi_cnt - n, buf_len / sizeof(ct_db_rpi_export_t));
+
+    // idx of first element
+    uint32_t n_idx = IDX_SKIP_PREV(_db_rpi_idx, _db_rpi_cnt, CT_DB_RPI_CNT_LOCAL);
+    //idx of n'th element
+    n_idx = IDX_SKIP_NEXT(n_idx, n, CT_DB_RPI_CNT_LOCAL);
+
+    for (uint16_t i = 0; i < todo; i++) {
+        ct_db_rpi_to_export(&_db_rpi_list[n_idx], &exp[i]);
+        n_idx = IDX_NEXT(n_idx, CT_DB_RPI_CNT_LOCAL);
+    }
+
+    *cnt = todo;
+    return 0;
+}
+
+/************** SNAPSHOT **************/
+
+static int ct_db_snapshot_begin_locked(void)
+{
+    _db_snap_active  = true;
+    _db_snap_dropped = 0;
+    return 0;
+}
+
+static int ct_db_snapshot_end_locked(void)
+{
+    if (!_db_snap_active) {
+        return 0;
+    }
+
+    _db_snap_active  = false;
+    _db_snap_dropped = 0;
+
+#ifdef DB_USE_EXTERNAL_FLASH
+    // Process postponed expiry.
+    ct_db_flash_expire();
+#endif
+
+    return 0;
+}
+
+/************** SCRUB **************/
+
+static int ct_db_scrub_locked(uint16_t sectors)
+{
+#if defined(DB_USE_EXTERNAL_FLASH)
+    // Quarantine changes the indices of RPIs.
+    if (_db_snap_active) {
+        return -EBUSY;
+    }
+
+    // Visit sectors until 'sectors' sectors holding data are verified.
+    uint16_t done = 0;
+    for (uint32_t n = 0; (n < CT_FLASH_SECTOR_COUNT) && (done < sectors); n++) {
+        uint32_t sector = _db_scrub_sector;
+        bool bad = false;
+
+        _db_scrub_sector = IDX_NEXT(_db_scrub_sector, CT_FLASH_SECTOR_COUNT);
+        if (_db_scrub_sector == 0) {
+            _db_integrity.passes++;
+        }
+
+        // Version 0 sectors have no CRCs to verify, sectors of
+        //  DB_FLASH_FORMAT_ALT are not rewritten in their own layout.
+        if ((_db_flash_toc[sector].ival == _db_ival_empty) ||
+                _db_flash_toc[sector].v0 || _db_flash_toc[sector].alt ||
+                atomic_test_bit(_db_flash_quar, sector)) {
+            continue;
+        }
+
+        int err = ct_db_flash_scrub_sector(sector, &bad);
+        if (err != 0) {
+            return err;
+        }
+
+        done++;
+        _db_integrity.checked++;
+        if (bad) {
+            _db_integrity.errors++;
+            ct_db_flash_quarantine(sector);
+        }
+    }
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+static void ct_db_get_integrity_locked(ct_db_integrity_t *integrity)
 {
-    ct_db_tek_clear();
-    ct_db_rpi_clear();
 #if defined(DB_USE_EXTERNAL_FLASH)
-    ct_db_flash_clear();
-    ct_db_flash_load();
+    _db_integrity.quarantined = _db_flash_quar_cnt;
+    _db_integrity.torn        = MIN(_db_flash_torn, UINT16_MAX);
 #endif
+    memcpy(integrity, &_db_integrity, sizeof(*integrity));
+}
+
+static int ct_db_get_wear_locked(ct_db_wear_t *wear)
+{
+    memset(wear, 0, sizeof(*wear));
+#if defined(DB_USE_EXTERNAL_FLASH)
+    uint64_t sum = 0;
+
+    wear->erase_min = UINT32_MAX;
+    for (uint32_t sector = 0; sector < CT_FLASH_SECTOR_COUNT; sector++) {
+        uint32_t erase_cnt = _db_flash_toc[sector].erase_cnt;
+        if (atomic_test_bit(_db_flash_quar, sector)) {
+            continue;
+        }
+        wear->erase_min = MIN(wear->erase_min, erase_cnt);
+        wear->erase_max = MAX(wear->erase_max, erase_cnt);
+        wear->sectors++;
+        sum += erase_cnt;
+    }
+
+    if (wear->sectors > 0) {
+        wear->erase_mean = sum / wear->sectors;
+    } else {
+        wear->erase_min = 0;
+    }
+    wear->erases = _db_flash_erases;
     return 0;
+#else
+    return -ENOTSUP;
+#endif
 }
 
+/************** MAIN **************/
 
-int ct_db_init(void)
+static int ct_db_clear_locked(void)
 {
-    int ret;
+    uint32_t dropped = ct_db_snap_drop_all();
 
-    ret = ct_db_tek_clear();
-    if (ret != 0)
-        return ret;
+    ct_db_tek_reset();
+    ct_db_rpi_reset();
+#if defined(DB_USE_EXTERNAL_FLASH)
+    ct_db_flash_gen(true, true);
+#endif
+    _db_snap_dropped = dropped;
+#if defined(DB_USE_EXTERNAL_FLASH)
+    return ct_db_flash_tek_last();
+#else
+    return 0;
+#endif
+}
 
-    ret = ct_db_rpi_clear();
-    if (ret != 0)
-        return ret;
+static int ct_db_init_locked(void)
+{
+    int ret = 0;
+
+    ct_db_tek_reset();
+    ct_db_rpi_reset();
+    _db_snap_active  = false;
+    _db_snap_dropped = 0;
 
 #if defined(DB_USE_EXTERNAL_FLASH)
     ret = ct_db_flash_init();
@@ -871,5 +2297,153 @@ int ct_db_init(void)
         return ret;
 #endif
 
-    return 0;
+    return ret;
+}
+
+/************** API **************/
+
+// Functions of the API hold the database lock, see _db_lock.
+
+int ct_db_init(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_init_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tick(uint32_t ival)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tick_locked(ival);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_clear(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_clear_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tek_clear(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tek_clear_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_rpi_clear(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_rpi_clear_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tek_add(uint8_t *tek, uint32_t ival)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tek_add_locked(tek, ival);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tek_get_cnt(uint16_t *cnt)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tek_get_cnt_locked(cnt);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tek_get(uint16_t n, uint8_t *tek, uint32_t *ival)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tek_get_locked(n, tek, ival);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_tek_get_last(uint8_t *tek, uint32_t *ival)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_tek_get_last_locked(tek, ival);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_rpi_add_locked(rpi, aem, rssi, ival);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_rpi_get_cnt(uint32_t *cnt)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_rpi_get_cnt_locked(cnt);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_rpi_get(uint32_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
+                uint8_t *cnt, uint32_t *ival_last)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_rpi_get_locked(n, rpi, aem, rssi, cnt, ival_last);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_rpi_export(uint32_t n, uint8_t *buf, size_t buf_len, uint16_t *cnt)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_rpi_export_locked(n, buf, buf_len, cnt);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_snapshot_begin(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_snapshot_begin_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_snapshot_end(void)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_snapshot_end_locked();
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+int ct_db_scrub(uint16_t sectors)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_scrub_locked(sectors);
+    k_mutex_unlock(&_db_lock);
+    return ret;
+}
+
+void ct_db_get_integrity(ct_db_integrity_t *integrity)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    ct_db_get_integrity_locked(integrity);
+    k_mutex_unlock(&_db_lock);
+}
+
+int ct_db_get_wear(ct_db_wear_t *wear)
+{
+    k_mutex_lock(&_db_lock, K_FOREVER);
+    int ret = ct_db_get_wear_locked(wear);
+    k_mutex_unlock(&_db_lock);
+    return ret;
 }
@@ -31,6 +31,70 @@
 
 #include <sys/slist.h>
 
+#include "ct.h"
+
+/**
+ * @def CT_DB_EXPORT_BUF_SIZE
+ * @brief Minimal size of a staging buffer used with @ref ct_db_rpi_export.
+ *
+ * Equals the size of a single flash sector, so a full sector can be read
+ * in a single flash-read.
+ */
+#define CT_DB_EXPORT_BUF_SIZE (4096)
+
+/**
+ * @def CT_DB_EXPORT_VERSION
+ * @brief Version of the layout of @ref ct_db_rpi_export_t.
+ *
+ * Capabilities of the build (@ref CT_DB_EXPORT_FLAGS) append fields to it.
+ * Items of version 0 are the first @ref CT_DB_EXPORT_V0_SIZE bytes of it.
+ */
+#define CT_DB_EXPORT_VERSION  1
+
+/**
+ * @def CT_DB_EXPORT_FLAG_ENC
+ * @brief Export capability: items carry the encounter of the RPI
+ *        (CONFIG_CT_DB_ENCOUNTERS).
+ */
+#define CT_DB_EXPORT_FLAG_ENC  (0x01)
+
+/**
+ * @def CT_DB_EXPORT_FLAGS
+ * @brief Export capabilities of this build, see @ref ct_db_rpi_export_t.
+ */
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+#define CT_DB_EXPORT_FLAGS  CT_DB_EXPORT_FLAG_ENC
+#else
+#define CT_DB_EXPORT_FLAGS  0
+#endif
+
+/**
+ * @typedef ct_db_rpi_export_t
+ * @brief Export representation of a single RPI.
+ *
+ * Packed (little endian) structure in which RPIs are offloaded to a BLE
+ * Central. See "Data format RPI" in README.md.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    uint32_t ival_last;
+    int8_t rssi;                 /**< typical (mean) RSSI */
+    uint8_t cnt;                 /**< number of observations */
+    int8_t rssi_max;             /**< strongest RSSI (minimum attenuation) */
+    uint8_t att[CT_ATT_BUCKETS]; /**< observations per attenuation bucket */
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    uint32_t enc;                /**< encounter: first 4 bytes of its first RPI */
+#endif
+} ct_db_rpi_export_t;
+
+/**
+ * @def CT_DB_EXPORT_V0_SIZE
+ * @brief Size of an item of export version 0, without the fields which were
+ *        appended since: the fields of @ref ct_db_rpi_export_t up to 'cnt'.
+ */
+#define CT_DB_EXPORT_V0_SIZE  offsetof(ct_db_rpi_export_t, rssi_max)
+
 /**
  * @brief Initialise database.
  * @return 0 on success, negative errno code on [flash] failure.
@@ -50,19 +114,35 @@ int ct_db_tick(uint32_t ival);
 
 /**
  * @brief Clear local buffers and (external) flash storage.
+ *
+ * The flash is not erased: a new generation of RPIs and TEKs is stored by
+ * starting a new sector, after which older data is ignored. Sectors of older
+ * generations are erased when they are reused.
+ *
+ * The new sector is started right away, also while a snapshot is active. The
+ * RPIs of the snapshot are then removed and return -ENODATA, and RPIs stored
+ * after the clear follow them, see @ref ct_db_snapshot_begin.
+ *
  * @return 0 on success, negative errno code on [flash] failure.
  */
 int ct_db_clear(void);
 
 /**
- * @brief Clear local TEK buffer.
- * @return 0 on success, negative errno code on failure.
+ * @brief Clear local TEK buffer and TEKs in (external) flash storage.
+ *
+ * As @ref ct_db_clear, for TEKs only. The RPIs of an active snapshot keep
+ * their index.
+ *
+ * @return 0 on success, negative errno code on [flash] failure.
  */
 int ct_db_tek_clear(void);
 
 /**
- * @brief Clear local RPI buffer.
- * @return 0 on success, negative errno code on failure.
+ * @brief Clear local RPI buffer and RPIs in (external) flash storage.
+ *
+ * As @ref ct_db_clear, for RPIs only.
+ *
+ * @return 0 on success, negative errno code on [flash] failure.
  */
 int ct_db_rpi_clear(void);
 
@@ -124,12 +204,12 @@ int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival);
  * @brief Retrieve the number of stored RPIs.
  *
  * The return value is the sum of all RPIs stored in the local buffer and
- * stored in the external flash.
+ * stored in the external flash, which can hold more than 65535 RPIs.
  *
  * @param [out]  cnt   : number of RPIs.
  * @return 0 on success, negative errno code on [flash] failure.
  */
-int ct_db_rpi_get_cnt(uint16_t *cnt);
+int ct_db_rpi_get_cnt(uint32_t *cnt);
 
 /**
  * @brief Retrieve the n'th RPI from memory
@@ -140,12 +220,116 @@ int ct_db_rpi_get_cnt(uint16_t *cnt);
  * @param [in]  n     : n'th value in which we are interested.
  * @param [out] rpi   : pointer to a RPI_SIZE-byte array in which the RPI will be stored
  * @param [out] aem   : pointer to a AEM_SIZE-byte array in which the AEM will be stored
- * @param [out] rssi  : RSSI value at which the RPI is received [dB].
+ * @param [out] rssi  : typical (mean) RSSI value of all observations [dB].
  * @param [out] cnt   : number of observations.
  * @param [out] ival  : highest rolling-interval at which the RPI is observed.
  * @return 0 on success, negative errno code on [flash] failure.
+ * @return -ENODATA when the n'th RPI of a snapshot is overwritten.
  */
-int ct_db_rpi_get(uint16_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
+int ct_db_rpi_get(uint32_t n, uint8_t *rpi, uint8_t *aem, int8_t *rssi,
                 uint8_t *cnt, uint32_t *ival_last);
 
+/**
+ * @brief Export a block of consecutive RPIs, starting at the n'th RPI.
+ *
+ * RPIs are converted in bulk into @ref ct_db_rpi_export_t and stored
+ * back-to-back in `buf`. A single call never crosses a flash sector: when the
+ * n'th RPI is stored in flash, the remainder of its sector is fetched with a
+ * single flash-read. RPIs in the local buffer are copied until `buf` is full.
+ *
+ * @param [in]  n       : index of first RPI to export (0 = oldest).
+ * @param [out] buf     : staging buffer, preferably CT_DB_EXPORT_BUF_SIZE bytes.
+ * @param [in]  buf_len : size of `buf` in bytes.
+ * @param [out] cnt     : number of RPIs stored in `buf`.
+ * @return 0 on success, negative errno code on [flash] failure.
+ * @return -EINVAL when the n'th RPI does not exist.
+ * @return -ENODATA when the n'th RPI of a snapshot is overwritten.
+ */
+int ct_db_rpi_export(uint32_t n, uint8_t *buf, size_t buf_len, uint16_t *cnt);
+
+/**
+ * @brief Freeze the indices of all RPIs currently stored in the database.
+ *
+ * While a snapshot is active, RPIs can still be added and pushed to flash,
+ * but existing RPIs keep their index: the expiry of old sectors is postponed
+ * until the snapshot ends. When the flash ring wraps, the oldest RPIs of the
+ * snapshot are overwritten and return -ENODATA, as do all RPIs of the snapshot
+ * after the RPIs are cleared. New observations of an RPI update its contents.
+ * This allows an export while EN keeps scanning.
+ * Calling this function while a snapshot is active refreshes the snapshot.
+ *
+ * @return 0 on success, negative errno code on failure.
+ */
+int ct_db_snapshot_begin(void);
+
+/**
+ * @brief Release a snapshot and expire sectors beyond the retention period.
+ * @return 0 on success, negative errno code on [flash] failure.
+ */
+int ct_db_snapshot_end(void);
+
+/**
+ * @typedef ct_db_integrity_t
+ * @brief Flash integrity summary, as exposed to a BLE Central (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t passes;        /**< completed scrub passes over the flash */
+    uint32_t checked;       /**< sectors verified */
+    uint32_t errors;        /**< sectors with an invalid header or RPI, or not
+                                 matching the table of contents */
+    uint32_t rpi_errors;    /**< RPIs with an invalid CRC */
+    uint16_t quarantined;   /**< sectors currently quarantined */
+    uint16_t torn;          /**< torn records skipped when loading the flash */
+    uint32_t relocated;     /**< valid RPIs moved out of quarantined sectors */
+} ct_db_integrity_t;
+
+/**
+ * @brief Verify the next sectors holding data in the external flash.
+ *
+ * The header and each RPI of a sector are verified against their CRC and the
+ * table of contents. The unused part of the sector which is being written
+ * should be erased. Each error is confirmed by reading the flash again. On
+ * errors, the valid RPIs of the sector are written again to the newest sector
+ * and the sector is quarantined: it is marked in flash and no longer used, up
+ * to @ref CT_DB_QUARANTINE_MAX sectors. As this changes RPI indices, nothing
+ * is verified while a snapshot is active.
+ *
+ * @param [in] sectors : number of sectors to verify.
+ * @return 0 on success, negative errno code on flash failure.
+ * @return -EBUSY while a snapshot is active.
+ * @return -ENOTSUP without external flash.
+ */
+int ct_db_scrub(uint16_t sectors);
+
+/**
+ * @brief Retrieve the flash integrity summary.
+ * @param [out] integrity : integrity summary.
+ */
+void ct_db_get_integrity(ct_db_integrity_t *integrity);
+
+/**
+ * @typedef ct_db_wear_t
+ * @brief Flash wear summary, as exposed to a BLE Central (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t erase_min;     /**< lowest erase count of a sector */
+    uint32_t erase_max;     /**< highest erase count of a sector */
+    uint32_t erase_mean;    /**< mean erase count of the sectors */
+    uint32_t erases;        /**< sectors erased since boot */
+    uint16_t sectors;       /**< sectors counted, i.e. not quarantined */
+} ct_db_wear_t;
+
+/**
+ * @brief Retrieve the flash wear summary.
+ *
+ * Each sector of the external flash keeps its erase count in its header. A new
+ * sector is allocated from the free sectors with the lowest erase count, or is
+ * the sector holding the oldest data when none is free. Sequence numbers in
+ * the headers keep the sectors in time order.
+ *
+ * @param [out] wear : wear summary.
+ * @return 0 on success, -ENOTSUP without external flash.
+ */
+int ct_db_get_wear(ct_db_wear_t *wear);
+
 #endif /* __CT_DB_H */
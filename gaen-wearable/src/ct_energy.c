@@ -0,0 +1,182 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <string.h>
+
+#include <sys/util.h>
+
+#include "ct.h"
+#include "ct_energy.h"
+
+#include "battery.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(ct_energy, LOG_LEVEL_INF);
+
+BUILD_ASSERT(CT_ENERGY_FLASH_ERASE < ARRAY_SIZE(((ct_energy_io_t*)0)->flash_cnt),
+             "Flash operations do not fit exported counters");
+
+// Accumulators: times in [ms], operations in [us]
+static struct k_spinlock _energy_lock;
+
+static ct_energy_en_t _energy_en = CT_ENERGY_EN_IDLE;
+static int64_t  _energy_en_since;
+static uint64_t _energy_en_ms[CT_ENERGY_EN_CNT];
+// parameters of current scan period [0.625 ms]
+static uint16_t _energy_scan_ival;
+static uint16_t _energy_scan_window;
+static uint32_t _energy_scan_windows;
+static uint64_t _energy_scan_rx_us;
+
+static bool     _energy_enc;
+static int64_t  _energy_enc_since;
+static uint64_t _energy_enc_ms;
+static uint16_t _energy_enc_sessions;
+
+static uint32_t _energy_op_cnt[CT_ENERGY_OP_CNT];
+static uint64_t _energy_op_us[CT_ENERGY_OP_CNT];
+
+// Close the current EN phase. Called with lock held.
+static void energy_en_account(int64_t now)
+{
+    uint64_t ms = now - _energy_en_since;
+
+    _energy_en_ms[_energy_en] += ms;
+    _energy_en_since = now;
+
+    if ((_energy_en != CT_ENERGY_EN_SCAN) || (_energy_scan_ival == 0)) {
+        return;
+    }
+
+    // A window opens at the start of each scan interval.
+    uint64_t ival_us = _energy_scan_ival * 625ULL;
+    uint64_t win_us  = MIN(_energy_scan_window, _energy_scan_ival) * 625ULL;
+    uint64_t n       = (ms * 1000) / ival_us;
+    uint64_t rem     = (ms * 1000) % ival_us;
+
+    _energy_scan_windows += n + ((rem > 0) ? 1 : 0);
+    _energy_scan_rx_us   += (n * win_us) + MIN(rem, win_us);
+}
+
+void ct_energy_en_state(ct_energy_en_t state)
+{
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    energy_en_account(k_uptime_get());
+    _energy_en = state;
+    k_spin_unlock(&_energy_lock, key);
+}
+
+void ct_energy_en_scan(uint16_t interval, uint16_t window)
+{
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    energy_en_account(k_uptime_get());
+    _energy_en          = CT_ENERGY_EN_SCAN;
+    _energy_scan_ival   = interval;
+    _energy_scan_window = window;
+    k_spin_unlock(&_energy_lock, key);
+}
+
+void ct_energy_enc(bool active)
+{
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    int64_t now = k_uptime_get();
+
+    if (_energy_enc) {
+        _energy_enc_ms += now - _energy_enc_since;
+    } else if (active) {
+        _energy_enc_sessions++;
+    }
+    _energy_enc       = active;
+    _energy_enc_since = now;
+    k_spin_unlock(&_energy_lock, key);
+}
+
+uint32_t ct_energy_op_start(void)
+{
+    return k_cycle_get_32();
+}
+
+void ct_energy_op_end(ct_energy_op_t op, uint32_t start)
+{
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    _energy_op_cnt[op]++;
+    _energy_op_us[op] += us;
+    k_spin_unlock(&_energy_lock, key);
+}
+
+void ct_energy_get_stats(ct_energy_stats_t *stats)
+{
+    uint32_t adc_cnt;
+    uint64_t adc_us;
+    battery_get_activity(&adc_cnt, &adc_us);
+
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    int64_t now = k_uptime_get();
+
+    // bring running phase and session up to date
+    energy_en_account(now);
+    if (_energy_enc) {
+        _energy_enc_ms   += now - _energy_enc_since;
+        _energy_enc_since = now;
+    }
+
+    uint64_t flash_us = _energy_op_us[CT_ENERGY_FLASH_READ] +
+                        _energy_op_us[CT_ENERGY_FLASH_WRITE] +
+                        _energy_op_us[CT_ENERGY_FLASH_ERASE];
+
+    // charge [uA * ms]
+    uint64_t charge = (uint64_t)CT_ENERGY_IDLE_UA * now
+        + (uint64_t)CT_ENERGY_ADV_UA   * _energy_en_ms[CT_ENERGY_EN_ADV]
+        + (uint64_t)CT_ENERGY_SCAN_UA  * (_energy_scan_rx_us / 1000)
+        + (uint64_t)CT_ENERGY_ENC_UA   * _energy_enc_ms
+        + (uint64_t)CT_ENERGY_FLASH_UA * (flash_us / 1000)
+        + (uint64_t)CT_ENERGY_ADC_UA   * (adc_us / 1000);
+
+    stats->uptime       = now / MSEC_PER_SEC;
+    stats->en_adv       = _energy_en_ms[CT_ENERGY_EN_ADV] / MSEC_PER_SEC;
+    stats->en_scan      = _energy_en_ms[CT_ENERGY_EN_SCAN] / MSEC_PER_SEC;
+    stats->enc          = _energy_enc_ms / MSEC_PER_SEC;
+    stats->scan_windows = _energy_scan_windows;
+    stats->scan_rx      = _energy_scan_rx_us / 1000;
+    stats->charge       = charge / (3600ULL * MSEC_PER_SEC);
+    k_spin_unlock(&_energy_lock, key);
+}
+
+void ct_energy_get_io(ct_energy_io_t *io)
+{
+    uint32_t adc_cnt;
+    uint64_t adc_us;
+    battery_get_activity(&adc_cnt, &adc_us);
+
+    k_spinlock_key_t key = k_spin_lock(&_energy_lock);
+    for (int op = CT_ENERGY_FLASH_READ; op <= CT_ENERGY_FLASH_ERASE; op++) {
+        io->flash_cnt[op] = _energy_op_cnt[op];
+        io->flash_ms[op]  = _energy_op_us[op] / 1000;
+    }
+    io->adc_cnt      = adc_cnt;
+    io->enc_sessions = _energy_enc_sessions;
+    k_spin_unlock(&_energy_lock, key);
+}
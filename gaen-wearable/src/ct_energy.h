@@ -0,0 +1,132 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+/**
+ * @file
+ * @brief Energy accounting of radio, flash and ADC activity.
+ *
+ * Time spent in the EN phases and EN-Config sessions, opened scan windows and
+ * flash and ADC operations are accumulated since boot. An estimate of the
+ * consumed charge is derived from these counters with the currents defined in
+ * ct.h. Counters are cumulative, so the effect of a duty-cycle change follows
+ * from the difference between two readings. ADC activity is read from the
+ * battery module.
+ */
+
+#ifndef __CT_ENERGY_H
+#define __CT_ENERGY_H
+
+#include <zephyr/types.h>
+
+/**
+ * @typedef ct_energy_en_t
+ * @brief Phase of the EN application.
+ */
+typedef enum {
+    CT_ENERGY_EN_IDLE = 0,  /**< EN not active */
+    CT_ENERGY_EN_ADV,       /**< EN advertisement period */
+    CT_ENERGY_EN_SCAN,      /**< EN scan period */
+    CT_ENERGY_EN_CNT,
+} ct_energy_en_t;
+
+/**
+ * @typedef ct_energy_op_t
+ * @brief Timed operations.
+ */
+typedef enum {
+    CT_ENERGY_FLASH_READ = 0,   /**< flash read */
+    CT_ENERGY_FLASH_WRITE,      /**< flash write */
+    CT_ENERGY_FLASH_ERASE,      /**< flash erase */
+    CT_ENERGY_OP_CNT,
+} ct_energy_op_t;
+
+/**
+ * @typedef ct_energy_stats_t
+ * @brief Radio activity and charge estimate, as exposed to a BLE Central
+ *        (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t uptime;        /**< time since boot [s] */
+    uint32_t en_adv;        /**< time in EN advertisement periods [s] */
+    uint32_t en_scan;       /**< time in EN scan periods [s] */
+    uint32_t enc;           /**< time in EN-Config sessions [s] */
+    uint32_t scan_windows;  /**< number of opened scan windows */
+    uint32_t scan_rx;       /**< radio-on time of scan windows [ms] */
+    uint32_t charge;        /**< estimated consumed charge [uAh] */
+} ct_energy_stats_t;
+
+/**
+ * @typedef ct_energy_io_t
+ * @brief Flash, ADC and EN-Config counters, as exposed to a BLE Central
+ *        (little endian). 16-bit counters wrap around.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t flash_cnt[3];  /**< number of flash read/write/erase operations */
+    uint32_t flash_ms[3];   /**< duration of flash read/write/erase [ms] */
+    uint16_t adc_cnt;       /**< number of ADC samples */
+    uint16_t enc_sessions;  /**< number of EN-Config sessions */
+} ct_energy_io_t;
+
+/**
+ * @brief Enter a phase of the EN application.
+ * @param [in] state : new phase, CT_ENERGY_EN_SCAN via @ref ct_energy_en_scan.
+ */
+void ct_energy_en_state(ct_energy_en_t state);
+
+/**
+ * @brief Enter an EN scan period.
+ * @param [in] interval : scan interval [0.625 ms].
+ * @param [in] window   : scan window [0.625 ms].
+ */
+void ct_energy_en_scan(uint16_t interval, uint16_t window);
+
+/**
+ * @brief Mark start or end of an EN-Config session.
+ * @param [in] active : true at start of the session, false at the end.
+ */
+void ct_energy_enc(bool active);
+
+/**
+ * @brief Start timing of an operation.
+ * @return timestamp to be provided to @ref ct_energy_op_end.
+ */
+uint32_t ct_energy_op_start(void);
+
+/**
+ * @brief Account a finished operation.
+ * @param [in] op    : operation, @ref ct_energy_op_t.
+ * @param [in] start : timestamp returned by @ref ct_energy_op_start.
+ */
+void ct_energy_op_end(ct_energy_op_t op, uint32_t start);
+
+/**
+ * @brief Retrieve radio activity and charge estimate.
+ * @param [out] stats : accumulated statistics.
+ */
+void ct_energy_get_stats(ct_energy_stats_t *stats);
+
+/**
+ * @brief Retrieve flash, ADC and EN-Config counters.
+ * @param [out] io : accumulated counters.
+ */
+void ct_energy_get_io(ct_energy_io_t *io);
+
+#endif /* __CT_ENERGY_H */
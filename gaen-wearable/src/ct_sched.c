@@ -0,0 +1,198 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <string.h>
+
+#include <sys/util.h>
+
+#include "ct.h"
+#include "ct_sched.h"
+#include "ct_settings.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(ct_sched, LOG_LEVEL_INF);
+
+BUILD_ASSERT(CT_SCHED_DUTY_MIN > 0 && CT_SCHED_DUTY_MIN <= CT_SCHED_DUTY_MAX,
+             "Invalid scheduler duty-cycle bounds");
+BUILD_ASSERT(CT_SCHED_DUTY_MAX <= 500,
+             "Scan duty-cycle should not exceed advertisement duty-cycle");
+
+// Minimal scan window according to the Bluetooth Specification (2.5 [ms])
+#define SCHED_SCAN_WINDOW_MIN  4
+
+#define SCHED_BATT_UNKNOWN  0xFF
+
+// Current scan duty-cycle [permille] and scan interval [0.625 ms]
+static uint16_t _sched_duty;
+static uint16_t _sched_ival;
+// Consecutive scan periods without contacts
+static uint8_t  _sched_idle;
+// Last battery level [%]
+static uint8_t  _sched_batt = SCHED_BATT_UNKNOWN;
+// Parameters of next adv/scan period
+static ct_sched_param_t _sched_param;
+static ct_sched_stats_t _sched_stats;
+
+// Nominal duty-cycle as defined by the settings.
+static uint16_t sched_duty_nominal(void)
+{
+    uint32_t total = ct_priv.scan_period + ct_priv.adv_period;
+    if (total == 0) {
+        return CT_SCHED_DUTY_MIN;
+    }
+    return (uint16_t)((1000ULL * ct_priv.scan_period) / total);
+}
+
+// Bounds of the adaptive scan interval: the window should fit the interval.
+static uint16_t sched_ival_min(void)
+{
+    return MAX(CT_SCHED_SCAN_IVAL_MIN, ct_priv.scan_window);
+}
+
+static uint16_t sched_ival_max(void)
+{
+    return MAX(CT_SCHED_SCAN_IVAL_MAX, ct_priv.scan_ival);
+}
+
+static bool sched_batt_low(void)
+{
+    return (_sched_batt != SCHED_BATT_UNKNOWN) &&
+                (_sched_batt < CT_SCHED_BATT_LOW);
+}
+
+// Translate duty-cycle into adv/scan periods.
+// => below the nominal duty-cycle, the scan period is kept and the adv period
+//    is stretched. Above, the adv period is kept and the scan period extended.
+static void sched_apply(bool dense)
+{
+    uint32_t duty = MIN(MAX(_sched_duty, CT_SCHED_DUTY_MIN), CT_SCHED_DUTY_MAX);
+
+    if (duty >= sched_duty_nominal()) {
+        _sched_param.adv_period  = ct_priv.adv_period;
+        _sched_param.scan_period = MAX(ct_priv.scan_period,
+                    MIN(CT_SCHED_SCAN_PERIOD_MAX,
+                        (ct_priv.adv_period * duty) / (1000 - duty)));
+    } else {
+        _sched_param.scan_period = ct_priv.scan_period;
+        _sched_param.adv_period  = MAX(ct_priv.adv_period,
+                    MIN(CT_SCHED_ADV_PERIOD_MAX,
+                        (ct_priv.scan_period * (1000 - duty)) / duty));
+    }
+
+    _sched_param.scan_ival   = MIN(MAX(_sched_ival, sched_ival_min()),
+                                    sched_ival_max());
+    _sched_param.scan_window = MIN(ct_priv.scan_window, _sched_param.scan_ival);
+    if (sched_batt_low()) {
+        _sched_param.scan_window = MAX(SCHED_SCAN_WINDOW_MIN,
+                    _sched_param.scan_window / 2);
+    } else if (dense) {
+        _sched_param.scan_window = _sched_param.scan_ival;
+    }
+
+    _sched_stats.duty        = duty;
+    _sched_stats.adv_period  = _sched_param.adv_period;
+    _sched_stats.scan_period = _sched_param.scan_period;
+    _sched_stats.scan_window = _sched_param.scan_window;
+    _sched_stats.scan_ival   = _sched_param.scan_ival;
+}
+
+void ct_sched_reset(void)
+{
+    memset(&_sched_stats, 0, sizeof(_sched_stats));
+    _sched_stats.reason = CT_SCHED_INIT;
+    _sched_stats.batt   = _sched_batt;
+
+    _sched_idle = 0;
+    _sched_duty = sched_duty_nominal();
+    _sched_ival = ct_priv.scan_ival;
+    sched_apply(false);
+}
+
+void ct_sched_battery(uint8_t percent)
+{
+    _sched_batt = percent;
+    _sched_stats.batt = percent;
+}
+
+void ct_sched_scan_done(uint16_t rpi_new, uint16_t contacts)
+{
+    ct_sched_reason_t reason;
+    uint16_t duty = _sched_duty;
+    uint16_t ival = _sched_ival;
+
+    if (contacts == 0) {
+        _sched_idle = MIN(_sched_idle + 1, UINT8_MAX);
+    } else {
+        _sched_idle = 0;
+    }
+
+    if (rpi_new > 0) {
+        // new people around: do not miss their RPIs
+        reason = CT_SCHED_BOOST;
+        duty   = MIN(duty * 2, CT_SCHED_DUTY_MAX);
+        ival   = MAX(ival / 2, sched_ival_min());
+        _sched_stats.cnt_boost++;
+    } else if (_sched_idle >= CT_SCHED_IDLE_SCANS) {
+        // nobody around: save energy
+        reason = CT_SCHED_BACKOFF;
+        duty   = MAX((duty * 3) / 4, CT_SCHED_DUTY_MIN);
+        ival   = MIN((ival * 4) / 3, sched_ival_max());
+        _sched_stats.cnt_backoff++;
+    } else {
+        reason = CT_SCHED_HOLD;
+    }
+
+    if (sched_batt_low()) {
+        uint16_t limit = MAX(sched_duty_nominal() / 2, CT_SCHED_DUTY_MIN);
+        if ((duty > limit) || (ival < ct_priv.scan_ival)) {
+            reason = CT_SCHED_THROTTLE;
+            duty   = MIN(duty, limit);
+            ival   = MAX(ival, ct_priv.scan_ival);
+            _sched_stats.cnt_throttle++;
+        }
+    }
+
+    if ((duty != _sched_duty) || (ival != _sched_ival)) {
+        LOG_INF("duty %u -> %u [permille], ival %u -> %u (reason %u, new %u, "
+                    "contacts %u)", _sched_duty, duty, _sched_ival, ival,
+                    reason, rpi_new, contacts);
+    }
+
+    _sched_duty           = duty;
+    _sched_ival           = ival;
+    _sched_stats.reason   = reason;
+    _sched_stats.rpi_new  = rpi_new;
+    _sched_stats.contacts = contacts;
+
+    sched_apply(!sched_batt_low() && rpi_new >= CT_SCHED_DENSE_RPIS);
+}
+
+void ct_sched_get(ct_sched_param_t *param)
+{
+    *param = _sched_param;
+}
+
+void ct_sched_get_stats(ct_sched_stats_t *stats)
+{
+    *stats = _sched_stats;
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+/**
+ * @file
+ * @brief Adaptive scheduler of the GAEN scan/advertisement duty-cycle.
+ *
+ * The nominal duty-cycle is defined by the settings (@ref ct_settings). After
+ * each scan period the scheduler adapts the duty-cycle to the observed
+ * contact density and battery level, within the bounds defined in ct.h.
+ */
+
+#ifndef __CT_SCHED_H
+#define __CT_SCHED_H
+
+#include <zephyr/types.h>
+
+/**
+ * @typedef ct_sched_reason_t
+ * @brief Reason of the last scheduler decision.
+ */
+typedef enum {
+    CT_SCHED_INIT = 0,  /**< Nominal duty-cycle, no decision made yet */
+    CT_SCHED_HOLD,      /**< Known contacts around, duty-cycle unchanged */
+    CT_SCHED_BOOST,     /**< New RPIs observed, duty-cycle increased */
+    CT_SCHED_BACKOFF,   /**< Empty environment, duty-cycle decreased */
+    CT_SCHED_THROTTLE,  /**< Battery low, duty-cycle limited */
+} ct_sched_reason_t;
+
+/**
+ * @typedef ct_sched_param_t
+ * @brief Parameters of the next advertisement and scan period.
+ */
+typedef struct {
+    uint32_t adv_period;    /**< advertisement period [ms] */
+    uint32_t scan_period;   /**< scan period [ms] */
+    uint16_t scan_ival;     /**< scan interval [0.625 ms] */
+    uint16_t scan_window;   /**< scan window [0.625 ms] */
+} ct_sched_param_t;
+
+/**
+ * @typedef ct_sched_stats_t
+ * @brief Scheduler state, as exposed to a BLE Central (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    uint16_t duty;          /**< scan duty-cycle [permille] */
+    uint8_t  reason;        /**< last decision, @ref ct_sched_reason_t */
+    uint8_t  batt;          /**< last battery level [%], 0xFF if unknown */
+    uint32_t adv_period;    /**< advertisement period [ms] */
+    uint32_t scan_period;   /**< scan period [ms] */
+    uint16_t scan_window;   /**< scan window [0.625 ms] */
+    uint16_t rpi_new;       /**< new RPIs in last scan period */
+    uint16_t contacts;      /**< GAEN advertisements in last scan period */
+    uint16_t cnt_boost;     /**< number of boost decisions */
+    uint16_t cnt_backoff;   /**< number of back-off decisions */
+    uint16_t cnt_throttle;  /**< number of throttle decisions */
+    uint16_t scan_ival;     /**< scan interval [0.625 ms] */
+} ct_sched_stats_t;
+
+/**
+ * @brief Reset scheduler to the nominal duty-cycle.
+ *
+ * Statistics are cleared as well.
+ */
+void ct_sched_reset(void);
+
+/**
+ * @brief Provide the last sampled battery level.
+ * @param [in] percent : battery level [%].
+ */
+void ct_sched_battery(uint8_t percent);
+
+/**
+ * @brief Report the results of a finished scan period.
+ *
+ * Adapts the duty-cycle for the next advertisement and scan period.
+ *
+ * @param [in] rpi_new  : number of RPIs which were added to the database.
+ * @param [in] contacts : number of GAEN advertisements received.
+ */
+void ct_sched_scan_done(uint16_t rpi_new, uint16_t contacts);
+
+/**
+ * @brief Retrieve the parameters of the next advertisement and scan period.
+ * @param [out] param : scheduled parameters.
+ */
+void ct_sched_get(ct_sched_param_t *param);
+
+/**
+ * @brief Retrieve scheduler statistics.
+ * @param [out] stats : scheduler statistics.
+ */
+void ct_sched_get_stats(ct_sched_stats_t *stats);
+
+#endif /* __CT_SCHED_H */
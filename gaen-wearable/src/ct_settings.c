@@ -94,6 +94,13 @@ int ct_settings_handle_get(const char *name, char *val, int val_len_max)
     CT_SETTINGS_HANDLE_GET(tek_rolling_period);
 
     CT_SETTINGS_HANDLE_GET_ARR(device_name);
+    CT_SETTINGS_HANDLE_GET_ARR(att_thresholds);
+
+    CT_SETTINGS_HANDLE_GET(time_checkpoint);
+    CT_SETTINGS_HANDLE_GET(time_drift);
+
+    CT_SETTINGS_HANDLE_GET(db_gen_rpi);
+    CT_SETTINGS_HANDLE_GET(db_gen_tek);
 
     return -ENOENT;
 }
@@ -142,6 +149,13 @@ int ct_settings_handle_set(const char *name, size_t len,
         CT_SETTINGS_HANDLE_SET(tek_rolling_period);
 
         CT_SETTINGS_HANDLE_SET_ARR(device_name);
+        CT_SETTINGS_HANDLE_SET_ARR(att_thresholds);
+
+        CT_SETTINGS_HANDLE_SET(time_checkpoint);
+        CT_SETTINGS_HANDLE_SET(time_drift);
+
+        CT_SETTINGS_HANDLE_SET(db_gen_rpi);
+        CT_SETTINGS_HANDLE_SET(db_gen_tek);
     }
 
     return -ENOENT;
@@ -177,6 +191,7 @@ int ct_settings_handle_commit(void)
     CT_SETTINGS_HANDLE_COMMIT(tek_rolling_period, CT_DEFAULT_TEK_PERIOD);
 
     CT_SETTINGS_HANDLE_COMMIT_ARR(device_name, CT_DEFAULT_DEVICENAME);
+    CT_SETTINGS_HANDLE_COMMIT_ARR(att_thresholds, CT_DEFAULT_ATT_THRESHOLDS);
 
     return 0;
 }
@@ -213,6 +228,13 @@ int ct_settings_handle_export(int (*cb)(const char *name,
     CT_SETTINGS_HANDLE_EXPORT(tek_rolling_period);
 
     CT_SETTINGS_HANDLE_EXPORT_ARR(device_name);
+    CT_SETTINGS_HANDLE_EXPORT_ARR(att_thresholds);
+
+    CT_SETTINGS_HANDLE_EXPORT(time_checkpoint);
+    CT_SETTINGS_HANDLE_EXPORT(time_drift);
+
+    CT_SETTINGS_HANDLE_EXPORT(db_gen_rpi);
+    CT_SETTINGS_HANDLE_EXPORT(db_gen_tek);
 
     return 0;
 }
@@ -29,6 +29,8 @@
 #include <string.h>
 #include <zephyr/types.h>
 
+#include "ct.h"
+
 struct ct_settings {
     uint32_t adv_period;
     uint32_t scan_period;
@@ -52,6 +54,22 @@ struct ct_settings {
 
     // Name of device
     unsigned char device_name[10];
+
+    // Attenuation thresholds [dB] of the RPI attenuation buckets (ascending).
+    uint8_t att_thresholds[CT_ATT_BUCKETS - 1];
+
+    // Last checkpoint of the wall-clock time [seconds since epoch], used to
+    //  restore the clock after a reset. See ct_time.h.
+    uint32_t time_checkpoint;
+
+    // Estimated drift of the local clock [ppb], positive when the local clock
+    //  runs slow. See ct_time.h.
+    int32_t time_drift;
+
+    // Generations of RPIs and TEKs in the database, saved when they start, as
+    //  they are only stored in flash by the next sector. See ct_db.c.
+    uint32_t db_gen_rpi;
+    uint32_t db_gen_tek;
 };
 
 extern struct ct_settings ct_priv;
@@ -0,0 +1,373 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <string.h>
+
+#include <time.h>
+#include <posix/time.h>
+#include <posix/sys/time.h>
+
+#include <settings/settings.h>
+
+#include "ct.h"
+#include "ct_time.h"
+#include "ct_settings.h"
+#include "ctsa.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(ct_time, LOG_LEVEL_INF);
+
+BUILD_ASSERT(CT_TIME_CHECKPOINT_PERIOD >= CT_TIME_RETAIN_PERIOD,
+             "Checkpoint period should exceed the retain period");
+BUILD_ASSERT(CT_TIME_DRIFT_PAIRS >= 2, "Drift fit requires 2 pairs");
+
+#define TIME_RETAIN_MAGIC  (0x54494D45) // "TIME"
+// Error bound of a clock with an unknown error (e.g. restored from NVM)
+#define TIME_ERR_UNBOUNDED UINT32_MAX
+
+// Time kept in RAM which is not initialised upon boot and therefore retained
+//  over a (soft) reset. 'check' validates the content after a power loss.
+static struct {
+    uint32_t magic;
+    uint32_t sec;
+    uint32_t err;
+    uint32_t check;
+} _time_retained __noinit;
+
+static ct_time_source_t _time_source = CT_TIME_NONE;
+static ct_time_sync_cb_t _time_sync_cb;
+
+static struct k_timer _time_timer;
+static struct k_work  _time_save_work;
+static uint32_t       _time_ticks;
+
+// Uptime [ms] at which the clock was set, reference of the drift compensation,
+//  and the error bound [ms] of the clock at that moment.
+// => 64-bit, also read from the timer ISR: access via time_ref_get/set only.
+static struct {
+    int64_t  uptime;
+    uint32_t err;
+} _time_ref = { .err = TIME_ERR_UNBOUNDED };
+
+// Clock synchronisations since boot: (uptime [ms], CTS time [s])
+static struct {
+    int64_t  uptime;
+    uint32_t sec;
+} _time_pairs[CT_TIME_DRIFT_PAIRS];
+static uint8_t _time_pair_idx;
+static uint8_t _time_pair_cnt;
+// Largest residual of the last fit [ms] and offset at last sync [ms]
+static uint32_t _time_residual;
+static int32_t  _time_offset;
+
+// Drift correction [ms] after 'elapsed' [ms] of local time.
+static int64_t time_drift_ms(int64_t elapsed)
+{
+    return (elapsed * ct_priv.time_drift) / 1000000000LL;
+}
+
+static void time_ref_get(int64_t *uptime, uint32_t *err)
+{
+    unsigned int key = irq_lock();
+    *uptime = _time_ref.uptime;
+    *err    = _time_ref.err;
+    irq_unlock(key);
+}
+
+static void time_ref_set(int64_t uptime, uint32_t err)
+{
+    unsigned int key = irq_lock();
+    _time_ref.uptime = uptime;
+    _time_ref.err    = err;
+    irq_unlock(key);
+}
+
+// Add 'add' [ms] to error bound 'err', saturating at TIME_ERR_UNBOUNDED.
+static uint32_t time_err_add(uint32_t err, uint64_t add)
+{
+    uint64_t sum = (uint64_t)err + add;
+    return (sum >= TIME_ERR_UNBOUNDED) ? TIME_ERR_UNBOUNDED : (uint32_t)sum;
+}
+
+// Current error bound [ms]: the bound when the clock was set, grown with the
+//  crystal tolerance since.
+static uint32_t time_err_get(void)
+{
+    int64_t  uptime;
+    uint32_t err;
+
+    time_ref_get(&uptime, &err);
+    return time_err_add(err,
+                    ((k_uptime_get() - uptime) * CT_TIME_ERROR_PPM) / 1000000);
+}
+
+// Least squares fit of the local clock error over the recorded pairs.
+// => x: local time [s], y: CTS time - local time [ms]. Slope [ms/s] = drift.
+static void time_drift_fit(void)
+{
+    uint8_t first = (_time_pair_idx + CT_TIME_DRIFT_PAIRS - _time_pair_cnt)
+                        % CT_TIME_DRIFT_PAIRS;
+    uint8_t last  = (_time_pair_idx + CT_TIME_DRIFT_PAIRS - 1)
+                        % CT_TIME_DRIFT_PAIRS;
+    int64_t up0   = _time_pairs[first].uptime;
+    uint32_t sec0 = _time_pairs[first].sec;
+    double x[CT_TIME_DRIFT_PAIRS];
+    double y[CT_TIME_DRIFT_PAIRS];
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int n = _time_pair_cnt;
+
+    if ((n < 2) ||
+            ((_time_pairs[last].uptime - up0) < (CT_TIME_DRIFT_MIN_SPAN * 1000LL))) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint8_t p = (first + i) % CT_TIME_DRIFT_PAIRS;
+        int64_t up = _time_pairs[p].uptime - up0;
+        x[i] = up / 1000.0;
+        y[i] = (double)(_time_pairs[p].sec - sec0) * 1000.0 - up;
+        sx  += x[i];
+        sy  += y[i];
+        sxx += x[i] * x[i];
+        sxy += x[i] * y[i];
+    }
+
+    double den = (n * sxx) - (sx * sx);
+    if (den <= 0) {
+        return;
+    }
+    double b = ((n * sxy) - (sx * sy)) / den;
+    double a = (sy - (b * sx)) / n;
+
+    // ms/s => ppb
+    int32_t drift = (int32_t)(b * 1000000.0);
+    if ((drift > (CT_TIME_DRIFT_MAX_PPM * 1000)) ||
+            (drift < -(CT_TIME_DRIFT_MAX_PPM * 1000))) {
+        LOG_WRN("drift %d ppb discarded", drift);
+        return;
+    }
+
+    double res_max = 0;
+    for (int i = 0; i < n; i++) {
+        double res = y[i] - (a + (b * x[i]));
+        res_max = MAX(res_max, (res < 0) ? -res : res);
+    }
+
+    ct_priv.time_drift = drift;
+    _time_residual     = (uint32_t) res_max;
+    LOG_INF("drift %d ppb, residual %u ms (%d syncs)", drift, _time_residual, n);
+}
+
+static uint32_t time_retained_check(uint32_t sec, uint32_t err)
+{
+    return ~(TIME_RETAIN_MAGIC ^ sec ^ err);
+}
+
+static void time_retain(uint32_t sec, uint32_t err)
+{
+    _time_retained.magic = TIME_RETAIN_MAGIC;
+    _time_retained.sec   = sec;
+    _time_retained.err   = err;
+    _time_retained.check = time_retained_check(sec, err);
+}
+
+// Store checkpoint in NVM, from the system workqueue.
+static void time_save(struct k_work *work)
+{
+    struct timespec now;
+    ct_time_get(&now);
+
+    if (now.tv_sec < CT_TIME_EPOCH_MIN) {
+        return;
+    }
+
+    ct_priv.time_checkpoint = now.tv_sec;
+    int err = settings_save_one("ct/time_checkpoint", &ct_priv.time_checkpoint,
+                    sizeof(ct_priv.time_checkpoint));
+    if (!err) {
+        err = settings_save_one("ct/time_drift", &ct_priv.time_drift,
+                    sizeof(ct_priv.time_drift));
+    }
+    if (err) {
+        LOG_ERR("Checkpoint failed (err %d)", err);
+    }
+}
+
+static void time_expired(struct k_timer *timer)
+{
+    struct timespec now;
+    ct_time_get(&now);
+
+    if (now.tv_sec < CT_TIME_EPOCH_MIN) {
+        return;
+    }
+
+    time_retain(now.tv_sec, time_err_get());
+
+    _time_ticks++;
+    if (_time_ticks >= (CT_TIME_CHECKPOINT_PERIOD / CT_TIME_RETAIN_PERIOD)) {
+        _time_ticks = 0;
+        k_work_submit(&_time_save_work);
+    }
+}
+
+// Clock set by a BLE Central: update drift, retain and checkpoint directly.
+static void time_synced(const struct timespec *ts)
+{
+    int64_t now = k_uptime_get();
+
+    if (ts->tv_sec < CT_TIME_EPOCH_MIN) {
+        return;
+    }
+
+    // Offset of the compensated local clock with respect to the last sync.
+    if (_time_pair_cnt > 0) {
+        uint8_t last = (_time_pair_idx + CT_TIME_DRIFT_PAIRS - 1)
+                            % CT_TIME_DRIFT_PAIRS;
+        int64_t elapsed = now - _time_pairs[last].uptime;
+        _time_offset = (int32_t)(((int64_t)ts->tv_sec -
+                            _time_pairs[last].sec) * 1000 -
+                            (elapsed + time_drift_ms(elapsed)));
+    }
+
+    _time_pairs[_time_pair_idx].uptime = now;
+    _time_pairs[_time_pair_idx].sec    = ts->tv_sec;
+    _time_pair_idx = (_time_pair_idx + 1) % CT_TIME_DRIFT_PAIRS;
+    _time_pair_cnt = MIN(_time_pair_cnt + 1, CT_TIME_DRIFT_PAIRS);
+    time_drift_fit();
+
+    LOG_INF("clock synced (source was %d, offset %d ms)", _time_source,
+                    _time_offset);
+    _time_source     = CT_TIME_SYNCED;
+    // CTS has a resolution of 1 second.
+    time_ref_set(now, 1000);
+    time_retain(ts->tv_sec, 1000);
+
+    _time_ticks = 0;
+    k_work_submit(&_time_save_work);
+
+    if (_time_sync_cb) {
+        _time_sync_cb();
+    }
+}
+
+int ct_time_init(void)
+{
+    struct timespec ts = { 0 };
+    uint32_t err = TIME_ERR_UNBOUNDED;
+
+    k_work_init(&_time_save_work, time_save);
+    k_timer_init(&_time_timer, time_expired, NULL);
+    bt_gatt_ctsa_set_callback(time_synced);
+    bt_gatt_ctsa_get_callback(ct_time_get);
+
+    // Use the most recent valid source.
+    if ((_time_retained.magic == TIME_RETAIN_MAGIC) &&
+            (_time_retained.check == time_retained_check(_time_retained.sec,
+                                            _time_retained.err)) &&
+            (_time_retained.sec >= CT_TIME_EPOCH_MIN)) {
+        ts.tv_sec    = _time_retained.sec;
+        _time_source = CT_TIME_RETAINED;
+        // Behind by at most the retain period (reset duration is negligible).
+        err = time_err_add(_time_retained.err, CT_TIME_RETAIN_PERIOD * 1000);
+    }
+
+    // The power-off time is unknown, so a checkpoint has an unbounded error.
+    if ((ct_priv.time_checkpoint >= CT_TIME_EPOCH_MIN) &&
+            (ct_priv.time_checkpoint > ts.tv_sec)) {
+        ts.tv_sec    = ct_priv.time_checkpoint;
+        _time_source = CT_TIME_CHECKPOINT;
+        err          = TIME_ERR_UNBOUNDED;
+    }
+
+    k_timer_start(&_time_timer, K_SECONDS(CT_TIME_RETAIN_PERIOD),
+                    K_SECONDS(CT_TIME_RETAIN_PERIOD));
+
+    if (_time_source == CT_TIME_NONE) {
+        LOG_WRN("clock not restored");
+        return -ENOENT;
+    }
+
+    clock_settime(CLOCK_REALTIME, &ts);
+    time_ref_set(k_uptime_get(), err);
+    LOG_INF("clock restored to %u (source %d, %s)", (uint32_t)ts.tv_sec,
+                    _time_source, ct_time_is_trusted() ? "trusted" :
+                    "untrusted until synced");
+    return 0;
+}
+
+void ct_time_set(const struct timespec *ts)
+{
+    clock_settime(CLOCK_REALTIME, ts);
+    time_synced(ts);
+}
+
+void ct_time_get(struct timespec *ts)
+{
+    int64_t  uptime;
+    uint32_t err;
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    time_ref_get(&uptime, &err);
+
+    // Compensate drift since the clock was set.
+    int64_t ms = time_drift_ms(k_uptime_get() - uptime);
+    int64_t ns = ts->tv_nsec + (ms % 1000) * 1000000LL;
+
+    ts->tv_sec += ms / 1000;
+    if (ns < 0) {
+        ns += 1000000000LL;
+        ts->tv_sec--;
+    } else if (ns >= 1000000000LL) {
+        ns -= 1000000000LL;
+        ts->tv_sec++;
+    }
+    ts->tv_nsec = ns;
+}
+
+void ct_time_get_drift(ct_time_drift_t *drift)
+{
+    drift->drift    = ct_priv.time_drift;
+    drift->residual = _time_residual;
+    drift->offset   = _time_offset;
+    drift->pairs    = _time_pair_cnt;
+    drift->source   = _time_source;
+    drift->error    = time_err_get();
+}
+
+ct_time_source_t ct_time_get_source(void)
+{
+    return _time_source;
+}
+
+void ct_time_set_sync_callback(ct_time_sync_cb_t cb)
+{
+    _time_sync_cb = cb;
+}
+
+bool ct_time_is_trusted(void)
+{
+    return (_time_source != CT_TIME_NONE) &&
+                (time_err_get() <= (CT_TIME_ERROR_MAX * 1000));
+}
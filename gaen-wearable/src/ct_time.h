@@ -0,0 +1,134 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+/**
+ * @file
+ * @brief Persistent time base.
+ *
+ * The wall-clock time is kept in RAM which is retained over a reset and is
+ * periodically stored in NVM. Upon boot the clock is restored from these
+ * sources, so GAEN can resume without waiting for a BLE Central to set the
+ * time. Setting the time via the Current Time Service corrects the clock.
+ *
+ * The drift of the local clock is estimated from consecutive clock settings
+ * and compensated in @ref ct_time_get, which is the time source of GAEN.
+ *
+ * An error bound is kept with the clock. It grows with the crystal tolerance
+ * and is unbounded after a restore from NVM, as the power-off time is unknown.
+ * GAEN only uses the clock while it is trusted, see @ref ct_time_is_trusted.
+ */
+
+#ifndef __CT_TIME_H
+#define __CT_TIME_H
+
+#include <zephyr/types.h>
+
+#include <posix/time.h>
+
+/**
+ * @typedef ct_time_source_t
+ * @brief Source of the current wall-clock time.
+ */
+typedef enum {
+    CT_TIME_NONE = 0,       /**< clock not set */
+    CT_TIME_CHECKPOINT,     /**< restored from NVM, behind by power-off time,
+                                 untrusted until synced */
+    CT_TIME_RETAINED,       /**< restored from retained RAM, behind by at most
+                                 CT_TIME_RETAIN_PERIOD */
+    CT_TIME_SYNCED,         /**< set by a BLE Central */
+} ct_time_source_t;
+
+/**
+ * @typedef ct_time_drift_t
+ * @brief Clock drift estimation, as exposed to a BLE Central (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    int32_t  drift;         /**< estimated drift [ppb], positive: slow clock */
+    uint32_t residual;      /**< largest residual of the fit [ms] */
+    int32_t  offset;        /**< CTS time - local time at last sync [ms] */
+    uint8_t  pairs;         /**< number of recorded syncs since boot */
+    uint8_t  source;        /**< @ref ct_time_source_t */
+    uint32_t error;         /**< error bound of the clock [ms],
+                                 UINT32_MAX: unknown */
+} ct_time_drift_t;
+
+/**
+ * @typedef ct_time_sync_cb_t
+ * @brief Callback upon a clock synchronisation.
+ */
+typedef void (*ct_time_sync_cb_t)(void);
+
+/**
+ * @brief Initialise the time base and restore the clock.
+ *
+ * Should be called after the settings are loaded and before GAEN is started.
+ *
+ * @return 0 on success, negative errno code on failure.
+ * @return -ENOENT when the clock could not be restored.
+ */
+int ct_time_init(void);
+
+/**
+ * @brief Set the clock from a trusted source, as a CTS write does.
+ * @param [in] ts : current time.
+ */
+void ct_time_set(const struct timespec *ts);
+
+/**
+ * @brief Retrieve the wall-clock time, compensated for the clock drift.
+ * @param [out] ts : current time.
+ */
+void ct_time_get(struct timespec *ts);
+
+/**
+ * @brief Retrieve the clock drift estimation.
+ * @param [out] drift : drift estimation.
+ */
+void ct_time_get_drift(ct_time_drift_t *drift);
+
+/**
+ * @brief Retrieve the source of the current wall-clock time.
+ * @return @ref ct_time_source_t
+ */
+ct_time_source_t ct_time_get_source(void);
+
+/**
+ * @brief Register a callback for clock synchronisations.
+ *
+ * Used by GAEN to resume when it waits for a trusted clock. Called from the
+ * context which sets the clock, e.g. the BT RX thread upon a CTS write.
+ *
+ * @param [in] cb : callback, NULL to unregister.
+ */
+void ct_time_set_sync_callback(ct_time_sync_cb_t cb);
+
+/**
+ * @brief Check whether the clock is accurate enough for GAEN.
+ *
+ * The clock is trusted when its error bound is within CT_TIME_ERROR_MAX,
+ * i.e. when it was synced (or restored after a reset of a synced clock) and
+ * has not run too long without a sync since.
+ *
+ * @return true when trusted.
+ */
+bool ct_time_is_trusted(void);
+
+#endif /* __CT_TIME_H */
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+
+#include <zephyr.h>
+#include <zephyr/types.h>
+#include <string.h>
+
+#include <sys/util.h>
+
+#include "ct.h"
+#include "ct_trace.h"
+
+#if defined(CONFIG_CT_TRACE)
+
+BUILD_ASSERT(sizeof(ct_trace_rec_t) == 12, "Trace record is not packed");
+
+static struct k_spinlock _trace_lock;
+static ct_trace_rec_t _trace_ring[CT_TRACE_RECORDS];
+// Sequence number of the next record, the ring holds the last
+//  CT_TRACE_RECORDS records before it.
+static uint32_t _trace_seq;
+
+void ct_trace(ct_trace_evt_t evt, uint8_t a8, uint16_t a16, uint32_t a32)
+{
+    k_spinlock_key_t key = k_spin_lock(&_trace_lock);
+
+    ct_trace_rec_t *rec = &_trace_ring[_trace_seq % CT_TRACE_RECORDS];
+    rec->time = k_uptime_get_32();
+    rec->evt  = evt;
+    rec->a8   = a8;
+    rec->a16  = a16;
+    rec->a32  = a32;
+    _trace_seq++;
+
+    k_spin_unlock(&_trace_lock, key);
+}
+
+uint8_t ct_trace_read(uint32_t *seq, ct_trace_rec_t *recs, uint8_t max)
+{
+    uint8_t n = 0;
+    k_spinlock_key_t key = k_spin_lock(&_trace_lock);
+
+    // Skip overwritten records.
+    uint32_t oldest = (_trace_seq > CT_TRACE_RECORDS) ?
+                            (_trace_seq - CT_TRACE_RECORDS) : 0;
+    if ((*seq < oldest) || (*seq > _trace_seq)) {
+        *seq = oldest;
+    }
+
+    while ((n < max) && ((*seq + n) != _trace_seq)) {
+        recs[n] = _trace_ring[(*seq + n) % CT_TRACE_RECORDS];
+        n++;
+    }
+
+    k_spin_unlock(&_trace_lock, key);
+    return n;
+}
+
+#else
+
+uint8_t ct_trace_read(uint32_t *seq, ct_trace_rec_t *recs, uint8_t max)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+
+
+/**
+ * @file
+ * @brief Binary event trace of hot paths.
+ *
+ * Events are stored as fixed-size binary records in a RAM ring, without any
+ * formatting or string duplication, so tracing can stay enabled in production
+ * builds. When the ring is full the oldest records are overwritten. Each
+ * record is identified by a sequence number, which allows a reader to detect
+ * lost records. Records are retrieved over EN-Config (GET_TRACE) and decoded
+ * with scripts/ct_trace.py.
+ */
+
+#ifndef __CT_TRACE_H
+#define __CT_TRACE_H
+
+#include <zephyr/types.h>
+
+/**
+ * @typedef ct_trace_evt_t
+ * @brief Traced events. Meaning of the arguments per event.
+ *
+ * Keep in sync with scripts/ct_trace.py.
+ */
+typedef enum {
+    CT_TRACE_NONE = 0,
+    CT_TRACE_EN_RPI,        /**< GAEN sighting. a8: rssi [dBm, signed],
+                                 a16: result of ct_db_rpi_add (signed),
+                                 a32: first 4 bytes of RPI */
+    CT_TRACE_EN_STATE,      /**< EN phase. a8: CT_EVENT_START_ADV/SCAN,
+                                 a16: -, a32: interval number */
+    CT_TRACE_ENC_RPI_READ,  /**< RPI read. a8: read within the block,
+                                 a16: length, a32: read cursor (RPI index) */
+    CT_TRACE_BATT,          /**< Battery sample. a8: -, a16: sample [mV],
+                                 a32: median << 16 | filtered [mV] */
+} ct_trace_evt_t;
+
+/**
+ * @typedef ct_trace_rec_t
+ * @brief Trace record, as exposed to a BLE Central (little endian).
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t time;          /**< uptime [ms] */
+    uint8_t  evt;           /**< event, @ref ct_trace_evt_t */
+    uint8_t  a8;            /**< event argument */
+    uint16_t a16;           /**< event argument */
+    uint32_t a32;           /**< event argument */
+} ct_trace_rec_t;
+
+#if defined(CONFIG_CT_TRACE)
+
+/**
+ * @brief Add a record to the trace. Safe to call from any context.
+ * @param [in] evt : event, @ref ct_trace_evt_t.
+ * @param [in] a8  : 8-bit argument.
+ * @param [in] a16 : 16-bit argument.
+ * @param [in] a32 : 32-bit argument.
+ */
+void ct_trace(ct_trace_evt_t evt, uint8_t a8, uint16_t a16, uint32_t a32);
+
+#else
+
+static inline void ct_trace(ct_trace_evt_t evt, uint8_t a8, uint16_t a16,
+                uint32_t a32) {}
+
+#endif
+
+/**
+ * @brief Read records from the trace.
+ *
+ * When record 'seq' has already been overwritten, reading starts at the
+ * oldest available record and 'seq' is updated accordingly.
+ *
+ * @param [inout] seq  : sequence number of the first record to read.
+ * @param [out]   recs : buffer for 'max' records.
+ * @param [in]    max  : maximum number of records to read.
+ * @return number of records read, 0 when no records follow 'seq'.
+ */
+uint8_t ct_trace_read(uint32_t *seq, ct_trace_rec_t *recs, uint8_t max);
+
+#endif /* __CT_TRACE_H */
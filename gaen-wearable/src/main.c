@@ -37,6 +37,7 @@
 
 #include "ct_crypto.h"
 #include "ct_db.h"
+#include "ct_time.h"
 
 #include <logging/log.h>
 
@@ -44,6 +45,18 @@ LOG_MODULE_REGISTER(ct_main, LOG_LEVEL_INF);
 
 static ct_app_id_t _app = CT_APP_MAIN;
 
+// Start ENC, after EN is stopped or next to EN ('concurrent').
+static void app_enc_start(bool concurrent)
+{
+    _app = CT_APP_ENC;
+    if (concurrent) {
+        ct_app_en_set_concurrent(true);
+    }
+    ct_app_enc_start();
+    ui_led_blink(UI_LED_GREEN, UI_BLINK_INFINITE);
+    ui_haptic_blink(5);
+}
+
 void btn_callback(int btn, uint8_t clk)
 {
     if(clk == UI_BTN_LONGPRESS) {
@@ -54,7 +67,12 @@ void btn_callback(int btn, uint8_t clk)
         if (_app == CT_APP_ENC) {
             ct_app_enc_stop();
         } else if (_app == CT_APP_EN) {
+#if defined(CONFIG_CT_EN_CONCURRENT)
+            // EN keeps running next to ENC
+            app_enc_start(true);
+#else
             ct_app_en_stop();
+#endif
         } else {
             LOG_ERR("invalid app is active");
         }
@@ -74,7 +92,11 @@ void ct_app_event(ct_app_id_t app, ct_event_t event)
         // When ENC is stopped, start EN.
         if(event == CT_EVENT_STOP) {
             _app = CT_APP_EN;
+#if defined(CONFIG_CT_EN_CONCURRENT)
+            ct_app_en_set_concurrent(false);
+#else
             ct_app_en_start();
+#endif
             ui_led_off(UI_LED_GREEN);
             ui_haptic_blink(1);
         }
@@ -84,10 +106,7 @@ void ct_app_event(ct_app_id_t app, ct_event_t event)
         switch ( event ) {
             // When EN is stopped, start ENC.
             case CT_EVENT_STOP:
-                _app = CT_APP_ENC;
-                ct_app_enc_start();
-                ui_led_blink(UI_LED_GREEN, UI_BLINK_INFINITE);
-                ui_haptic_blink(5);
+                app_enc_start(false);
                 break;
 
             case CT_EVENT_START_SCAN:
@@ -133,6 +152,9 @@ void main(void)
     ui_init();
     ui_btn_set_callback(btn_callback);
 
+    // Restore clock, allowing GAEN to resume directly after a reset.
+    ct_time_init();
+
     ct_crypto_init();
     ct_db_init();
 
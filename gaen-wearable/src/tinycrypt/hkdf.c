@@ -29,10 +29,10 @@
  */
 
 #include "hkdf.h"
-#include <tinycrypt/hmac.h>
-#include <tinycrypt/sha256.h>
-#include <tinycrypt/constants.h>
-#include <tinycrypt/utils.h>
+#include <string.h>
+
+/* HMAC-SHA256 is provided by the configured crypto backend */
+#include "ct_crypto_backend.h"
 
 #define SHA256_HASH_SIZE 32 /* SHA-256 length */
 
@@ -40,22 +40,22 @@ int hmac_sha256(uint8_t *out, unsigned int out_len,
                 const void *key, size_t key_len,
                 const uint8_t *data, size_t data_len)
 {
-    int ret = 1;
-    struct tc_hmac_state_struct h;
+    ct_crypto_hmac_t h;
 
-    memset(&h, 0x0, sizeof(h));
+    if (out_len != SHA256_HASH_SIZE)
+        return 0;
 
-    if (!tc_hmac_set_key(&h, key, key_len) ||
-        !tc_hmac_init(&h) ||
-        !tc_hmac_update(&h, data, data_len) ||
-        !tc_hmac_final(out, out_len, &h))
+    if (ct_crypto_hmac_init(&h, key, key_len) != 0)
+        return 0;
+
+    if (ct_crypto_hmac_update(&h, data, data_len) != 0)
     {
-        ret = 0;
+        ct_crypto_hmac_final(&h, out);
+        memset(out, 0x0, out_len);
+        return 0;
     }
 
-    memset(&h, 0x0, sizeof(h));
-
-    return ret;
+    return (ct_crypto_hmac_final(&h, out) == 0) ? 1 : 0;
 }
 
 /* This function implements HKDF extract
@@ -68,9 +68,8 @@ static int hkdf_sha256_extract(uint8_t *out_key, size_t out_len,
     uint8_t salt0[SHA256_HASH_SIZE];
 
     /* salt is optional for hkdf_sha256, it can be NULL.
-     *  The implement of tc_hmac_set_key in tinycrypt can't
-     *  accept NULL pointer, so salt0 is used here and set
-     *  to all 0s
+     *  Not all HMAC backends accept a NULL pointer, so salt0
+     *  is used here and set to all 0s
      */
     if (!salt || salt_len == 0) {
         memset(salt0, 0, SHA256_HASH_SIZE);
@@ -100,30 +99,30 @@ static int hkdf_sha256_expand(uint8_t *out_key, size_t out_len,
     size_t n, done = 0;
     unsigned int i;
     int ret = 0;
-    struct tc_hmac_state_struct h;
+    ct_crypto_hmac_t h;
 
     n = (out_len + digest_len - 1) / digest_len;
     if (n > 255)
         return 0;
 
-    memset(&h, 0x0, sizeof(h));
-
     for (i = 0; i < n; i++) {
         uint8_t ctr = i + 1;
         size_t todo;
 
-        tc_hmac_set_key(&h, prk, prk_len);
-        tc_hmac_init(&h);
-        if (i != 0 && (!tc_hmac_update(&h, T, digest_len)))
+        if (ct_crypto_hmac_init(&h, prk, prk_len) != 0)
             goto out;
 
-        if (!tc_hmac_update(&h, info, info_len) ||
-            !tc_hmac_update(&h, &ctr, 1) ||
-            !tc_hmac_final(T, digest_len, &h))
+        if ((i != 0 && ct_crypto_hmac_update(&h, T, digest_len) != 0) ||
+            (info_len > 0 && ct_crypto_hmac_update(&h, info, info_len) != 0) ||
+            ct_crypto_hmac_update(&h, &ctr, 1) != 0)
         {
+            ct_crypto_hmac_final(&h, T);
             goto out;
         }
 
+        if (ct_crypto_hmac_final(&h, T) != 0)
+            goto out;
+
         todo = digest_len;
         /* Check if the length of left buffer is smaller than
          * 32 to make sure no buffer overflow in below memcpy
@@ -138,7 +137,6 @@ static int hkdf_sha256_expand(uint8_t *out_key, size_t out_len,
     ret = 1;
 
 out:
-    memset(&h, 0x0, sizeof(h));
     memset(T, 0x0, SHA256_HASH_SIZE);
 
     return ret;
@@ -36,6 +36,7 @@
 
 
 #include "battery.h"
+#include "ct_trace.h"
 
 LOG_MODULE_REGISTER(battery, LOG_LEVEL_INF);
 
@@ -90,6 +91,113 @@ static struct adc_sequence _adc_seq;
 
 static int16_t _adc_raw;
 
+// Asynchronous sampling: completion is signalled to a work item.
+static struct k_poll_signal _adc_sig;
+static struct k_poll_event  _adc_evt;
+static struct k_work_poll   _adc_work;
+static atomic_t             _adc_busy;
+static uint32_t             _adc_start;
+static battery_sample_cb_t  _adc_done;
+
+// ADC activity since boot: number of samples and their duration [us].
+static struct k_spinlock _adc_lock;
+static uint32_t          _adc_cnt;
+static uint64_t          _adc_us;
+
+static void battery_adc_account(uint32_t start)
+{
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+    k_spinlock_key_t key = k_spin_lock(&_adc_lock);
+    _adc_cnt++;
+    _adc_us += us;
+    k_spin_unlock(&_adc_lock, key);
+}
+
+// Filtering of samples:
+// > median of the last BATT_MEDIAN_LEN samples rejects single outliers, e.g.
+//   a sample taken during a radio burst.
+// > exponential moving average (alpha = 1 / 2^BATT_EMA_SHIFT) smooths the
+//   medians.
+#define BATT_MEDIAN_LEN  3
+#define BATT_EMA_SHIFT   2
+
+static int16_t _batt_hist[BATT_MEDIAN_LEN];
+static uint8_t _batt_hist_idx;
+static uint8_t _batt_hist_cnt;
+// Filtered voltage [mV << BATT_EMA_SHIFT], negative when not yet sampled.
+static int32_t _batt_ema = -1;
+
+static int battery_raw_to_mV(void)
+{
+    int32_t val = _adc_raw;
+
+    adc_raw_to_millivolts(adc_ref_internal(_adc_dev),
+                    _adc_cfg.gain,
+                    _adc_seq.resolution,
+                    &val);
+
+    /* resistor correction to be added for externally measured voltages */
+    return val;
+}
+
+static void battery_filter(int mV)
+{
+    int16_t sorted[BATT_MEDIAN_LEN];
+
+    _batt_hist[_batt_hist_idx] = mV;
+    _batt_hist_idx = (_batt_hist_idx + 1) % BATT_MEDIAN_LEN;
+    _batt_hist_cnt = MIN(_batt_hist_cnt + 1, BATT_MEDIAN_LEN);
+
+    // insertion sort of the (few) available samples
+    for (int i = 0; i < _batt_hist_cnt; i++) {
+        int16_t v = _batt_hist[i];
+        int j = i;
+        while ((j > 0) && (sorted[j - 1] > v)) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    int32_t median = sorted[_batt_hist_cnt / 2];
+
+    if (_batt_ema < 0) {
+        _batt_ema = median << BATT_EMA_SHIFT;
+    } else {
+        _batt_ema += median - (_batt_ema >> BATT_EMA_SHIFT);
+    }
+
+    ct_trace(CT_TRACE_BATT, 0, mV,
+                    (median << 16) | (_batt_ema >> BATT_EMA_SHIFT));
+    LOG_DBG("batt %d mV (median %d mV, filtered %d mV)", mV, median,
+                    _batt_ema >> BATT_EMA_SHIFT);
+}
+
+static void battery_async_done(struct k_work *work)
+{
+    unsigned int signaled;
+    int result;
+    int mV;
+    battery_sample_cb_t done = _adc_done;
+
+    battery_adc_account(_adc_start);
+
+    k_poll_signal_check(&_adc_sig, &signaled, &result);
+    if (signaled && (result == 0)) {
+        mV = battery_raw_to_mV();
+        battery_filter(mV);
+    } else {
+        LOG_WRN("ADC sample failed (%d)", result);
+        mV = -EIO;
+    }
+
+    atomic_set(&_adc_busy, 0);
+
+    if (done) {
+        done(mV);
+    }
+}
+
 int battery_init(void)
 {
     int rc;
@@ -132,6 +240,11 @@ int battery_init(void)
     if(rc)
         LOG_ERR("Setup AIN_VDD got %d", rc);
 
+    k_poll_signal_init(&_adc_sig);
+    k_poll_event_init(&_adc_evt, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                    &_adc_sig);
+    k_work_poll_init(&_adc_work, battery_async_done);
+
     battery_sample();
 
     return rc;
@@ -145,24 +258,71 @@ int battery_sample(void)
         return -ENOENT;
     }
 
+    if (!atomic_cas(&_adc_busy, 0, 1)) {
+        return -EBUSY;
+    }
+
+    uint32_t start = k_cycle_get_32();
     rc = adc_read(_adc_dev, &_adc_seq);
+    battery_adc_account(start);
     _adc_seq.calibrate = false;
     if (rc == 0) {
-        int32_t val = _adc_raw;
+        rc = battery_raw_to_mV();
+        battery_filter(rc);
+    }
+
+    atomic_set(&_adc_busy, 0);
+    return rc;
+}
 
-        adc_raw_to_millivolts(adc_ref_internal(_adc_dev),
-                        _adc_cfg.gain,
-                        _adc_seq.resolution,
-                        &val);
-        rc = val;
-        LOG_INF("raw batt %d mV",  val);
+int battery_sample_async(battery_sample_cb_t done)
+{
+    int rc;
+
+    if (_adc_dev == NULL) {
+        return -ENOENT;
+    }
 
-        /* resistor correction to be added for externally measured voltages */
+    if (!atomic_cas(&_adc_busy, 0, 1)) {
+        return -EBUSY;
     }
 
+    _adc_done = done;
+    k_poll_signal_reset(&_adc_sig);
+    rc = k_work_poll_submit(&_adc_work, &_adc_evt, 1, K_FOREVER);
+    if (rc == 0) {
+        _adc_start = k_cycle_get_32();
+        rc = adc_read_async(_adc_dev, &_adc_seq, &_adc_sig);
+        if (rc != 0) {
+            k_work_poll_cancel(&_adc_work);
+        }
+    }
+
+    if (rc != 0) {
+        LOG_ERR("ADC sample failed to start (%d)", rc);
+        atomic_set(&_adc_busy, 0);
+    }
     return rc;
 }
 
+int battery_get_mV(void)
+{
+    int32_t ema = _batt_ema;
+
+    if (ema < 0) {
+        return -ENODATA;
+    }
+    return ema >> BATT_EMA_SHIFT;
+}
+
+void battery_get_activity(uint32_t *cnt, uint64_t *us)
+{
+    k_spinlock_key_t key = k_spin_lock(&_adc_lock);
+    *cnt = _adc_cnt;
+    *us  = _adc_us;
+    k_spin_unlock(&_adc_lock, key);
+}
+
 /* battery level in pptt (parts per 10.000) */
 unsigned int battery_level_pptt(unsigned int batt_mV,
                 const struct battery_level_point *curve)
@@ -66,11 +66,50 @@ extern const struct battery_level_point cr2032[];
 int battery_init(void);
 
 /**
- * @brief Sample the remaining battery voltage.
- * @return milliVolt readout.
+ * @brief Sample the remaining battery voltage (blocking).
+ *
+ * The sample is added to the filtered voltage. Prefer @ref battery_sample_async
+ * and @ref battery_get_mV while the radio is in use.
+ *
+ * @return milliVolt readout, negative errno code on failure.
+ * @return -EBUSY when a sample is in progress.
  */
 int battery_sample(void);
 
+/**
+ * @typedef battery_sample_cb_t
+ * @brief Callback upon completion of an asynchronous sample.
+ * @param [in] mV : sample in milliVolt, negative errno code on failure.
+ */
+typedef void (*battery_sample_cb_t)(int mV);
+
+/**
+ * @brief Start an asynchronous sample of the battery voltage.
+ *
+ * Upon completion, the sample is added to the filtered voltage which is
+ * retrieved with @ref battery_get_mV. Samples are filtered with a median
+ * (rejecting single outliers) followed by a moving average.
+ *
+ * @param [in] done : called from the system workqueue upon completion, e.g. to
+ *                    resume radio activity paused for the sample. May be NULL.
+ * @return 0 when the sample is started, negative errno code on failure.
+ * @return -EBUSY when a sample is in progress.
+ */
+int battery_sample_async(battery_sample_cb_t done);
+
+/**
+ * @brief Retrieve the filtered battery voltage, without sampling the ADC.
+ * @return milliVolt, -ENODATA when no sample is available.
+ */
+int battery_get_mV(void);
+
+/**
+ * @brief Retrieve the ADC activity since boot, e.g. for energy accounting.
+ * @param [out] cnt : number of samples.
+ * @param [out] us  : accumulated duration of the samples [us].
+ */
+void battery_get_activity(uint32_t *cnt, uint64_t *us);
+
 /**
  * @brief Compute battery level-point.
  * @param [in] batt_mv : milliVolt readout.
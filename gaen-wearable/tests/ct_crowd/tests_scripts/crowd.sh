@@ -0,0 +1,98 @@
+#!/bin/bash
+#
+# This file is part of the Contact Tracing / GAEN Wearable distribution
+#        https://github.com/Sendrato/gaen-wearable.
+#
+# Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+#                    Hessel van der Molen  (https://sendrato.com/)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License along
+# with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+#
+
+# Run crowds of simulated wearables in BabbleSim, summarise the EN results and
+# fail when a crowd misses its criteria. All devices are within range of each
+# other, so each scan period should capture the RPIs of all other N-1 devices.
+#
+# usage: crowd.sh [N ...]
+#   N : crowd sizes to simulate (default: 10 50 200)
+#
+# environment:
+#   BSIM_OUT_PATH : BabbleSim output folder (bin/bs_2G4_phy_v1)
+#   CROWD_EXE     : tests/ct_crowd built for nrf52_bsim
+#                   (default: build/zephyr/zephyr.exe)
+#   SIM_LENGTH    : simulated time in seconds (default: 1800)
+#   CAPTURE_MIN   : lowest capture in percent to pass (default: 80)
+#
+# A crowd passes when its capture is at least CAPTURE_MIN, no wearable stored
+# duplicate RPI records or dropped RPIs on a full database, and all RPIs were
+# tracked (no overflow, else raise CONFIG_CT_EN_CROWD_RPIS).
+
+set -e
+
+EXE=$(realpath "${CROWD_EXE:-build/zephyr/zephyr.exe}")
+CROWDS=${@:-10 50 200}
+SIM_LENGTH=${SIM_LENGTH:-1800}
+CAPTURE_MIN=${CAPTURE_MIN:-80}
+PHY=${BSIM_OUT_PATH:?BSIM_OUT_PATH not set}/bin/bs_2G4_phy_v1
+LOGS=$(mktemp -d)
+RESULT=0
+
+echo "N     capture  dup  overflow  enomem  cb-avg[ns]  cb-max[ns]"
+
+for N in ${CROWDS}; do
+    SIM_ID="gaen_crowd_${N}_$$"
+
+    for ((d = 0; d < N; d++)); do
+        "${EXE}" -s="${SIM_ID}" -d=${d} -rs=$((d + 1)) \
+            > "${LOGS}/${N}_${d}.log" 2>&1 &
+    done
+
+    (cd "${BSIM_OUT_PATH}/bin" && "${PHY}" -s="${SIM_ID}" -D=${N} \
+        -sim_length=$((SIM_LENGTH * 1000000)) > "${LOGS}/${N}_phy.log" 2>&1)
+    wait
+
+    # Per scan period: "crowd: scan S seen X sightings Y rpis R records C
+    #  dup D overflow O enomem E cb A/M ns". Skip the first scan period
+    #  (start-up).
+    cat "${LOGS}/${N}"_[0-9]*.log | grep -o "crowd: .*" | awk \
+        -v n=${N} -v capture_min=${CAPTURE_MIN} '
+        {
+            for (i = 2; i < NF; i += 2) v[$i] = $(i + 1)
+            if (v["scan"] < 2) next
+            split(v["cb"], cb, "/")
+            scans++
+            seen += v["seen"]
+            enomem += v["enomem"]
+            cb_avg += cb[1]
+            if (cb[2] > cb_max) cb_max = cb[2]
+            if (v["dup"] > dup) dup = v["dup"]
+            if (v["overflow"] > overflow) overflow = v["overflow"]
+        }
+        END {
+            if (scans == 0) { print n "     FAIL: no results"; exit 1 }
+            capture = 100 * seen / (scans * (n - 1))
+            printf "%-5d %6.1f%%  %-4s %-9d %-7d %-11d %d\n", n, capture,
+                (overflow > 0) ? "-" : dup, overflow, enomem,
+                cb_avg / scans, cb_max
+            if (capture < capture_min) print "      FAIL: capture"
+            if (overflow > 0) print "      FAIL: overflow, " \
+                "raise CONFIG_CT_EN_CROWD_RPIS"
+            else if (dup > 0) print "      FAIL: duplicate records"
+            if (enomem > 0) print "      FAIL: database full"
+            exit (capture < capture_min || overflow > 0 || dup > 0 ||
+                    enomem > 0)
+        }' || RESULT=1
+done
+
+echo "logs: ${LOGS}"
+exit ${RESULT}
@@ -0,0 +1,321 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+/**
+ * @file
+ * @brief Known answer tests of the GAEN key derivation.
+ *
+ * The AES-128 and HMAC-SHA256 primitives are checked separately, so each
+ * backend configuration of testcase.yaml is verified against the standards.
+ */
+
+#include <ztest.h>
+
+#include <string.h>
+
+#include <tinycrypt/hkdf.h>
+
+#include "ct.h"
+#include "ct_crypto.h"
+#include "ct_crypto_backend.h"
+#include "ct_settings.h"
+#include "ct_time.h"
+
+struct ct_settings ct_priv;
+
+// The interval number is not under test.
+void ct_time_get(struct timespec *ts)
+{
+    ts->tv_sec  = 0;
+    ts->tv_nsec = 0;
+}
+
+// RFC 5869, Appendix A: test case 1 and test case 3 (no salt and info, as used
+//  by GAEN). Both use the same input keying material.
+static const uint8_t _hkdf_ikm[22] = {
+    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b };
+static const uint8_t _hkdf_salt[13] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c };
+static const uint8_t _hkdf_info[10] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9 };
+static const uint8_t _hkdf_okm1[42] = {
+    0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64,
+    0xd0, 0x36, 0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a, 0x5a, 0x4c,
+    0x5d, 0xb0, 0x2d, 0x56, 0xec, 0xc4, 0xc5, 0xbf, 0x34, 0x00, 0x72, 0x08,
+    0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65 };
+static const uint8_t _hkdf_okm3[42] = {
+    0x8d, 0xa4, 0xe7, 0x75, 0xa5, 0x63, 0xc1, 0x8f, 0x71, 0x5f, 0x80, 0x2a,
+    0x06, 0x3c, 0x5a, 0x31, 0xb8, 0xa1, 0x1f, 0x5c, 0x5e, 0xe1, 0x87, 0x9e,
+    0xc3, 0x45, 0x4e, 0x5f, 0x3c, 0x73, 0x8d, 0x2d, 0x9d, 0x20, 0x13, 0x95,
+    0xfa, 0xa4, 0xb6, 0x1a, 0x96, 0xc8 };
+
+// GAEN Cryptography Specification test vectors.
+static const uint8_t _gaen_tek[TEK_SIZE] = {
+    0x75, 0xc7, 0x34, 0xc6, 0xdd, 0x1a, 0x78, 0x2d,
+    0xe7, 0xa9, 0x65, 0xda, 0x5e, 0xb9, 0x31, 0x25 };
+static const uint32_t _gaen_ival = 2642976;
+static const uint8_t _gaen_rpik[RPIK_SIZE] = {
+    0x18, 0x5a, 0xd9, 0x1d, 0xb6, 0x9e, 0xc7, 0xdd,
+    0x04, 0x89, 0x60, 0xf1, 0xf3, 0xba, 0x61, 0x75 };
+static const uint8_t _gaen_aemk[AEMK_SIZE] = {
+    0xd5, 0x7c, 0x46, 0xaf, 0x7a, 0x1d, 0x83, 0x96,
+    0x5b, 0x9b, 0xed, 0x8b, 0xd1, 0x52, 0x93, 0x6a };
+static const uint8_t _gaen_meta[META_SIZE] = { 0x40, 0x08, 0x00, 0x00 };
+// RPI and AEM of the first interval, RPI of the last interval of the TEK.
+static const uint8_t _gaen_rpi_first[RPI_SIZE] = {
+    0x8b, 0xe6, 0xcd, 0x37, 0x1c, 0x5c, 0x89, 0x16,
+    0x04, 0xbf, 0xbe, 0x49, 0xdf, 0x84, 0x50, 0x96 };
+static const uint8_t _gaen_aem_first[AEM_SIZE] = { 0x72, 0x03, 0x38, 0x74 };
+static const uint8_t _gaen_rpi_last[RPI_SIZE] = {
+    0xf4, 0x31, 0xb6, 0x2e, 0xcf, 0x44, 0x31, 0x02,
+    0xce, 0x4e, 0xd0, 0x40, 0x7d, 0xe5, 0x4b, 0xd4 };
+
+// RPIs derived from a single TEK
+#define GAEN_CHAIN  144
+
+// FIPS-197, Appendix C.1: AES-128.
+static const uint8_t _aes_fips_key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+static const uint8_t _aes_fips_pt[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+static const uint8_t _aes_fips_ct[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+    0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+
+// NIST SP 800-38A, F.1.1 (ECB-AES128) and F.5.1 (CTR-AES128), first two
+//  blocks. Both use the same key and plaintext.
+static const uint8_t _aes_sp_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t _aes_sp_pt[32] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+    0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+    0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51 };
+static const uint8_t _aes_sp_ecb[16] = {
+    0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60,
+    0xa8, 0x9a, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97 };
+static const uint8_t _aes_sp_ctr[16] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+static const uint8_t _aes_sp_ctr_ct[32] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26,
+    0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff,
+    0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xab };
+
+// RFC 4231, test case 2: HMAC-SHA256.
+static const char _hmac_key[]  = "Jefe";
+static const char _hmac_data[] = "what do ya want for nothing?";
+static const uint8_t _hmac_mac[32] = {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e,
+    0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83,
+    0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43 };
+
+static void test_aes128_ecb(void)
+{
+    uint8_t out[16];
+
+    zassert_equal(ct_crypto_aes128_ecb(_aes_fips_key, _aes_fips_pt, out), 0,
+                    "ECB failed");
+    zassert_mem_equal(out, _aes_fips_ct, sizeof(out), "FIPS-197 C.1");
+
+    zassert_equal(ct_crypto_aes128_ecb(_aes_sp_key, _aes_sp_pt, out), 0,
+                    "ECB failed");
+    zassert_mem_equal(out, _aes_sp_ecb, sizeof(out), "SP 800-38A F.1.1");
+}
+
+static void test_aes128_ecb_key_change(void)
+{
+    uint8_t key[16];
+    uint8_t out[16];
+
+    // A backend may keep state per key: alternate keys, and change the
+    //  contents of a key buffer which was used before.
+    memcpy(key, _aes_fips_key, sizeof(key));
+    for (int i = 0; i < 3; i++) {
+        zassert_equal(ct_crypto_aes128_ecb(key, _aes_fips_pt, out), 0,
+                        "ECB failed");
+        zassert_mem_equal(out, _aes_fips_ct, sizeof(out), "key A, round %d", i);
+
+        zassert_equal(ct_crypto_aes128_ecb(_aes_sp_key, _aes_sp_pt, out), 0,
+                        "ECB failed");
+        zassert_mem_equal(out, _aes_sp_ecb, sizeof(out), "key B, round %d", i);
+    }
+
+    memcpy(key, _aes_sp_key, sizeof(key));
+    zassert_equal(ct_crypto_aes128_ecb(key, _aes_sp_pt, out), 0, "ECB failed");
+    zassert_mem_equal(out, _aes_sp_ecb, sizeof(out), "key buffer reused");
+}
+
+static void test_aes128_ctr(void)
+{
+    uint8_t ctr[16];
+    uint8_t out[32];
+
+    memcpy(ctr, _aes_sp_ctr, sizeof(ctr));
+    zassert_equal(ct_crypto_aes128_ctr(_aes_sp_key, ctr, _aes_sp_pt, out,
+                    sizeof(out)), 0, "CTR failed");
+    zassert_mem_equal(out, _aes_sp_ctr_ct, sizeof(out), "SP 800-38A F.5.1");
+    zassert_mem_equal(ctr, _aes_sp_ctr, sizeof(ctr), "counter modified");
+
+    // Partial block, as used for the AEM.
+    zassert_equal(ct_crypto_aes128_ctr(_aes_sp_key, ctr, _aes_sp_pt, out,
+                    AEM_SIZE), 0, "CTR failed");
+    zassert_mem_equal(out, _aes_sp_ctr_ct, AEM_SIZE, "partial block");
+}
+
+static void test_hmac_sha256(void)
+{
+    ct_crypto_hmac_t h;
+    uint8_t mac[32];
+    size_t len = strlen(_hmac_data);
+
+    zassert_equal(ct_crypto_hmac_init(&h, _hmac_key, strlen(_hmac_key)), 0,
+                    "HMAC init failed");
+    zassert_equal(ct_crypto_hmac_update(&h, _hmac_data, len), 0,
+                    "HMAC update failed");
+    zassert_equal(ct_crypto_hmac_final(&h, mac), 0, "HMAC final failed");
+    zassert_mem_equal(mac, _hmac_mac, sizeof(mac), "RFC 4231 #2");
+
+    // Same MAC when the data is added in parts.
+    zassert_equal(ct_crypto_hmac_init(&h, _hmac_key, strlen(_hmac_key)), 0,
+                    "HMAC init failed");
+    zassert_equal(ct_crypto_hmac_update(&h, _hmac_data, 5), 0,
+                    "HMAC update failed");
+    zassert_equal(ct_crypto_hmac_update(&h, &_hmac_data[5], len - 5), 0,
+                    "HMAC update failed");
+    zassert_equal(ct_crypto_hmac_final(&h, mac), 0, "HMAC final failed");
+    zassert_mem_equal(mac, _hmac_mac, sizeof(mac), "RFC 4231 #2, in parts");
+}
+
+static void test_hkdf_rfc5869(void)
+{
+    uint8_t okm[sizeof(_hkdf_okm1)];
+
+    zassert_true(hkdf_sha256(okm, sizeof(okm), _hkdf_ikm, sizeof(_hkdf_ikm),
+                    _hkdf_salt, sizeof(_hkdf_salt),
+                    _hkdf_info, sizeof(_hkdf_info)), "HKDF failed");
+    zassert_mem_equal(okm, _hkdf_okm1, sizeof(okm), "RFC 5869 #1");
+
+    zassert_true(hkdf_sha256(okm, sizeof(okm), _hkdf_ikm, sizeof(_hkdf_ikm),
+                    NULL, 0, NULL, 0), "HKDF failed");
+    zassert_mem_equal(okm, _hkdf_okm3, sizeof(okm), "RFC 5869 #3");
+}
+
+static void test_gaen_keys(void)
+{
+    uint8_t tek[TEK_SIZE];
+    uint8_t rpik[RPIK_SIZE];
+    uint8_t aemk[AEMK_SIZE];
+
+    memcpy(tek, _gaen_tek, sizeof(tek));
+
+    zassert_equal(ct_crypto_calc_rpik(tek, rpik), 0, "RPIK failed");
+    zassert_mem_equal(rpik, _gaen_rpik, sizeof(rpik), "RPIK");
+
+    zassert_equal(ct_crypto_calc_aemk(tek, aemk), 0, "AEMK failed");
+    zassert_mem_equal(aemk, _gaen_aemk, sizeof(aemk), "AEMK");
+}
+
+static void test_gaen_rpi_aem(void)
+{
+    uint8_t rpik[RPIK_SIZE];
+    uint8_t aemk[AEMK_SIZE];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    uint8_t meta[META_SIZE];
+
+    memcpy(rpik, _gaen_rpik, sizeof(rpik));
+    memcpy(aemk, _gaen_aemk, sizeof(aemk));
+    memcpy(meta, _gaen_meta, sizeof(meta));
+
+    zassert_equal(ct_crypto_calc_rpi(_gaen_ival, rpik, rpi), 0, "RPI failed");
+    zassert_mem_equal(rpi, _gaen_rpi_first, sizeof(rpi), "RPI");
+
+    // The RPI is the counter block of the AEM, which should not be modified.
+    zassert_equal(ct_crypto_calc_aem(aemk, rpi, meta, aem), 0, "AEM failed");
+    zassert_mem_equal(aem, _gaen_aem_first, sizeof(aem), "AEM");
+    zassert_mem_equal(rpi, _gaen_rpi_first, sizeof(rpi), "RPI modified by AEM");
+
+    // Same AEM when calculated again from the same RPI.
+    zassert_equal(ct_crypto_calc_aem(aemk, rpi, meta, aem), 0, "AEM failed");
+    zassert_mem_equal(aem, _gaen_aem_first, sizeof(aem), "AEM repeated");
+}
+
+static void test_gaen_chain(void)
+{
+    uint8_t tek[TEK_SIZE];
+    uint8_t rpik[RPIK_SIZE];
+    uint8_t aemk[AEMK_SIZE];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    uint8_t meta[META_SIZE];
+
+    // All RPIs and AEMs of a single TEK, as derived by EN.
+    memcpy(tek, _gaen_tek, sizeof(tek));
+    memcpy(meta, _gaen_meta, sizeof(meta));
+    ct_crypto_calc_rpik(tek, rpik);
+    ct_crypto_calc_aemk(tek, aemk);
+    for (uint32_t i = 0; i < GAEN_CHAIN; i++) {
+        zassert_equal(ct_crypto_calc_rpi(_gaen_ival + i, rpik, rpi), 0,
+                        "RPI %u failed", i);
+        zassert_equal(ct_crypto_calc_aem(aemk, rpi, meta, aem), 0,
+                        "AEM %u failed", i);
+        if (i == 0) {
+            zassert_mem_equal(aem, _gaen_aem_first, sizeof(aem), "AEM #0");
+        }
+    }
+    zassert_mem_equal(rpi, _gaen_rpi_last, sizeof(rpi), "RPI #143");
+}
+
+static void test_tek_random(void)
+{
+    uint8_t tek1[TEK_SIZE];
+    uint8_t tek2[TEK_SIZE];
+
+    zassert_equal(ct_crypto_calc_tek(tek1), 0, "TEK failed");
+    zassert_equal(ct_crypto_calc_tek(tek2), 0, "TEK failed");
+    zassert_true(memcmp(tek1, tek2, TEK_SIZE) != 0, "TEKs are equal");
+}
+
+void test_main(void)
+{
+    zassert_equal(ct_crypto_init(), 0, "crypto init failed");
+    TC_PRINT("backend: %s\n", ct_crypto_backend_name());
+
+    ztest_test_suite(ct_crypto,
+            ztest_unit_test(test_aes128_ecb),
+            ztest_unit_test(test_aes128_ecb_key_change),
+            ztest_unit_test(test_aes128_ctr),
+            ztest_unit_test(test_hmac_sha256),
+            ztest_unit_test(test_hkdf_rfc5869),
+            ztest_unit_test(test_gaen_keys),
+            ztest_unit_test(test_gaen_rpi_aem),
+            ztest_unit_test(test_gaen_chain),
+            ztest_unit_test(test_tek_random)
+            );
+    ztest_run_test_suite(ct_crypto);
+}
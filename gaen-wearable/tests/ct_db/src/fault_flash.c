@@ -0,0 +1,152 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+#define DT_DRV_COMPAT ct_fault_flash
+
+#include <kernel.h>
+#include <device.h>
+#include <init.h>
+#include <errno.h>
+
+#include <drivers/flash.h>
+
+#include "fault_flash.h"
+
+// All operations are forwarded to the flash simulator of native_posix.
+#define FAULT_FLASH_SIM          DT_LABEL(DT_PARENT(DT_NODELABEL(flash0)))
+#define FAULT_FLASH_SECTOR_SIZE  (4096)
+
+static const struct device *_sim;
+
+static struct {
+    uint32_t countdown;
+    uint32_t len;
+    bool hdr;
+    bool fired;
+    uint32_t corrupt_reads;
+} _fault;
+
+void fault_flash_arm(uint32_t countdown, uint32_t len, bool hdr)
+{
+    _fault.countdown = countdown;
+    _fault.len       = len;
+    _fault.hdr       = hdr;
+    _fault.fired     = false;
+}
+
+bool fault_flash_fired(void)
+{
+    return _fault.fired;
+}
+
+void fault_flash_corrupt_reads(uint32_t cnt)
+{
+    _fault.corrupt_reads = cnt;
+}
+
+void fault_flash_reset(void)
+{
+    _fault.countdown     = 0;
+    _fault.fired         = false;
+    _fault.corrupt_reads = 0;
+}
+
+static int fault_flash_read(const struct device *dev, off_t offset,
+                void *data, size_t len)
+{
+    int err = flash_read(_sim, offset, data, len);
+    if ((err == 0) && (len > 0) && (_fault.corrupt_reads > 0)) {
+        _fault.corrupt_reads--;
+        ((uint8_t*)data)[0] ^= 0xFF;
+    }
+    return err;
+}
+
+static int fault_flash_write(const struct device *dev, off_t offset,
+                const void *data, size_t len)
+{
+    if (_fault.fired) {
+        return -EIO;
+    }
+    if ((_fault.countdown == 0) ||
+            (_fault.hdr && ((offset % FAULT_FLASH_SECTOR_SIZE) != 0)) ||
+            (--_fault.countdown != 0)) {
+        return flash_write(_sim, offset, data, len);
+    }
+
+    // Tear the write: only its first bytes reach the flash.
+    _fault.fired = true;
+    len = _fault.len % len;
+    if (len > 0) {
+        flash_write(_sim, offset, data, len);
+    }
+    return -EIO;
+}
+
+static int fault_flash_erase(const struct device *dev, off_t offset,
+                size_t size)
+{
+    if (_fault.fired) {
+        return -EIO;
+    }
+    return flash_erase(_sim, offset, size);
+}
+
+static int fault_flash_write_protection(const struct device *dev, bool enable)
+{
+    return flash_write_protection_set(_sim, enable);
+}
+
+static const struct flash_parameters *fault_flash_get_parameters(
+                const struct device *dev)
+{
+    return flash_get_parameters(_sim);
+}
+
+#if defined(CONFIG_FLASH_PAGE_LAYOUT)
+static void fault_flash_page_layout(const struct device *dev,
+                const struct flash_pages_layout **layout, size_t *layout_size)
+{
+    const struct flash_driver_api *api = _sim->api;
+
+    api->page_layout(_sim, layout, layout_size);
+}
+#endif
+
+static const struct flash_driver_api _fault_flash_api = {
+    .read             = fault_flash_read,
+    .write            = fault_flash_write,
+    .erase            = fault_flash_erase,
+    .write_protection = fault_flash_write_protection,
+    .get_parameters   = fault_flash_get_parameters,
+#if defined(CONFIG_FLASH_PAGE_LAYOUT)
+    .page_layout      = fault_flash_page_layout,
+#endif
+};
+
+static int fault_flash_init(const struct device *dev)
+{
+    _sim = device_get_binding(FAULT_FLASH_SIM);
+    return (_sim != NULL) ? 0 : -ENODEV;
+}
+
+DEVICE_AND_API_INIT(fault_flash, DT_INST_LABEL(0), fault_flash_init,
+                NULL, NULL, POST_KERNEL, CONFIG_APPLICATION_INIT_PRIORITY,
+                &_fault_flash_api);
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+/**
+ * @file
+ * @brief Fault injecting flash controller on top of the flash simulator.
+ */
+
+#ifndef __FAULT_FLASH_H
+#define __FAULT_FLASH_H
+
+#include <zephyr/types.h>
+
+/**
+ * @brief Tear a future write, as by a brown-out.
+ *
+ * The @p countdown th write is torn after @p len modulo its length bytes and
+ * fails. Afterwards all writes and erases fail until @ref fault_flash_reset.
+ *
+ * @param countdown Number of the write to tear, counting from 1.
+ * @param len       Number of bytes written of the torn write.
+ * @param hdr       Only count writes at the start of a 4 KiB sector.
+ */
+void fault_flash_arm(uint32_t countdown, uint32_t len, bool hdr);
+
+/**
+ * @brief Check whether the armed write was torn.
+ *
+ * @return true when a write was torn since @ref fault_flash_arm.
+ */
+bool fault_flash_fired(void);
+
+/**
+ * @brief Corrupt the data returned by the next reads, as by a transient error.
+ *
+ * The first byte of the next @p cnt reads is inverted, the flash itself is
+ * not changed.
+ *
+ * @param cnt Number of reads to corrupt.
+ */
+void fault_flash_corrupt_reads(uint32_t cnt);
+
+/**
+ * @brief Disarm and allow writes and erases again, as after a reboot.
+ */
+void fault_flash_reset(void);
+
+#endif /* __FAULT_FLASH_H */
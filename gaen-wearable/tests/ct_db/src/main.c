@@ -0,0 +1,805 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+/**
+ * @file
+ * @brief Tests of the database on the flash simulator.
+ *
+ * ct_db.c is included, so the tests can check its state against the flash.
+ * The flash simulator does not reflect the timing of the external flash, so
+ * the tests count operations instead of timing them.
+ */
+
+#include <ztest.h>
+
+#include "ct_db.c"
+#include "fault_flash.h"
+
+struct ct_settings ct_priv;
+
+// ADC activity is accounted by ct_energy, the battery is not under test.
+void battery_get_activity(uint32_t *cnt, uint64_t *us)
+{
+    *cnt = 0;
+    *us  = 0;
+}
+
+// Synthetic workload: a crowd of contacts, each rotating its RPI every couple
+//  of intervals, for a number of days. This exceeds the capacity of the flash
+//  ring and the retention period, so both are covered.
+#define DB_WL_DAYS        21
+#define DB_WL_IVALS_DAY   144
+#define DB_WL_CONTACTS    24
+#define DB_WL_SIGHTINGS   3
+#define DB_WL_RPI_IVALS   2
+#define DB_WL_IVAL_START  2700000
+
+enum {
+    DB_WL_RPI_ADD = 0,
+    DB_WL_TICK,
+    DB_WL_TEK_ADD,
+    DB_WL_RPI_GET,
+    DB_WL_OPS,
+};
+
+static const char * const _db_wl_names[DB_WL_OPS] = {
+    "rpi_add", "tick", "tek_add", "rpi_get",
+};
+
+static struct {
+    uint32_t cnt;
+    uint32_t err;
+} _db_wl[DB_WL_OPS];
+
+#define DB_WL_OP(_op, _call)                                            \
+    do {                                                                \
+        int _err = (_call);                                             \
+        _db_wl[_op].cnt++;                                              \
+        _db_wl[_op].err += (_err != 0) ? 1 : 0;                         \
+    } while (0)
+
+static void test_db_workload(void)
+{
+    uint8_t tek[TEK_SIZE];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    uint32_t cnt;
+
+    memset(_db_wl, 0, sizeof(_db_wl));
+    memset(aem, 0, sizeof(aem));
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+
+    ct_energy_io_t io_start;
+    ct_energy_get_io(&io_start);
+    uint32_t erases_start = _db_flash_erases;
+
+    for (uint32_t day = 0; day < DB_WL_DAYS; day++) {
+        for (uint32_t i = 0; i < DB_WL_IVALS_DAY; i++) {
+            uint32_t ival = DB_WL_IVAL_START + (day * DB_WL_IVALS_DAY) + i;
+
+            if (i == 0) {
+                memset(tek, 0, sizeof(tek));
+                memcpy(tek, &ival, sizeof(ival));
+                DB_WL_OP(DB_WL_TEK_ADD, ct_db_tek_add(tek, ival));
+            }
+            DB_WL_OP(DB_WL_TICK, ct_db_tick(ival));
+
+            for (uint32_t s = 0; s < DB_WL_SIGHTINGS; s++) {
+                for (uint32_t c = 0; c < DB_WL_CONTACTS; c++) {
+                    // RPI of contact 'c', rotated every DB_WL_RPI_IVALS
+                    uint32_t id = ((ival + c) / DB_WL_RPI_IVALS);
+                    memset(rpi, 0, sizeof(rpi));
+                    memcpy(&rpi[0], &c, sizeof(c));
+                    memcpy(&rpi[4], &id, sizeof(id));
+                    DB_WL_OP(DB_WL_RPI_ADD,
+                            ct_db_rpi_add(rpi, aem, -50 - c - s, ival));
+                }
+            }
+        }
+    }
+
+    // Read all stored RPIs, oldest first.
+    int8_t   rssi;
+    uint8_t  obs;
+    uint32_t ival_first = 0;
+    uint32_t ival_last  = 0;
+    ct_db_rpi_get_cnt(&cnt);
+    for (uint32_t n = 0; n < cnt; n++) {
+        uint32_t ival = 0;
+        DB_WL_OP(DB_WL_RPI_GET,
+                ct_db_rpi_get(n, rpi, aem, &rssi, &obs, &ival));
+        if (n == 0) {
+            ival_first = ival;
+        }
+        ival_last = MAX(ival_last, ival);
+    }
+
+    for (int op = 0; op < DB_WL_OPS; op++) {
+        TC_PRINT("%-8s %6u ops, %u err\n", _db_wl_names[op], _db_wl[op].cnt,
+                        _db_wl[op].err);
+        zassert_equal(_db_wl[op].err, 0, "%s failed", _db_wl_names[op]);
+    }
+
+    // Expired data is dropped a sector at a time, the newest is always kept.
+    TC_PRINT("%u RPIs stored, ival %u..%u\n", cnt, ival_first, ival_last);
+    zassert_true(ival_last - ival_first <=
+                    (CT_DB_RETAIN_PERIODS + 1) * DB_WL_IVALS_DAY,
+                    "RPIs retained beyond the retention period");
+
+    uint32_t sectors = _db_flash_erases - erases_start;
+    TC_PRINT("%u sectors written, %u wraps\n", sectors,
+                    sectors / CT_FLASH_SECTOR_COUNT);
+    zassert_true(sectors > CT_FLASH_SECTOR_COUNT, "flash ring did not wrap");
+
+    // Reload the TOC from flash, after flushing the local buffer. As after a
+    //  reboot, expired sectors are dropped by the first tick.
+    uint32_t cnt_load;
+    uint32_t ival = _db_ival;
+    zassert_equal(ct_db_flash_flush(), 0, "flush failed");
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(ct_db_flash_load(), 0, "load failed");
+    _db_ival = 0;
+    ct_db_tick(ival);
+    ct_db_rpi_get_cnt(&cnt_load);
+    zassert_equal(cnt_load, cnt, "%u/%u RPIs reloaded", cnt_load, cnt);
+
+    ct_energy_io_t io;
+    ct_energy_get_io(&io);
+    ct_db_wear_t wear;
+    zassert_equal(ct_db_get_wear(&wear), 0, "no wear statistics");
+
+    TC_PRINT("flash read %u, write %u, erase %u\n",
+                    io.flash_cnt[CT_ENERGY_FLASH_READ] -
+                            io_start.flash_cnt[CT_ENERGY_FLASH_READ],
+                    io.flash_cnt[CT_ENERGY_FLASH_WRITE] -
+                            io_start.flash_cnt[CT_ENERGY_FLASH_WRITE],
+                    io.flash_cnt[CT_ENERGY_FLASH_ERASE] -
+                            io_start.flash_cnt[CT_ENERGY_FLASH_ERASE]);
+    TC_PRINT("sector erase count min %u, max %u, mean %u\n",
+                    wear.erase_min, wear.erase_max, wear.erase_mean);
+    // Sectors are allocated by erase count, so wear is levelled.
+    zassert_true(wear.erase_max - wear.erase_min <= 1, "wear not levelled");
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Power-fail test: each round tears a random flash write, simulating a
+//  brown-out, and reloads the flash as after a reboot. Afterwards all RPIs
+//  which were written completely should be found and be valid, while data is
+//  appended after the torn write in the next round.
+#define DB_PF_ROUNDS      64
+#define DB_PF_WRITES      1024
+#define DB_PF_CONTACTS    16
+#define DB_PF_IVAL_START  2700000
+
+// Deterministic pseudo random numbers (xorshift32), so a run is reproducible.
+static uint32_t db_pf_rand(void)
+{
+    static uint32_t x = 0x2545F491;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void test_db_power_fail(void)
+{
+    uint8_t tek[TEK_SIZE];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    uint32_t ival = DB_PF_IVAL_START;
+    uint32_t cnt;
+
+    memset(aem, 0, sizeof(aem));
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+
+    for (uint32_t round = 0; round < DB_PF_ROUNDS; round++) {
+        // Tear a random write, every 4th round the write of a sector header.
+        bool hdr = ((round % 4) == 3);
+        fault_flash_arm(1 + (db_pf_rand() % (hdr ? 4 : DB_PF_WRITES)),
+                        db_pf_rand(), hdr);
+
+        // Run until the write is torn: a new TEK every day, RPIs rotating
+        //  every interval.
+        while (!fault_flash_fired()) {
+            if ((ival % 144) == 0) {
+                memset(tek, 0, sizeof(tek));
+                memcpy(tek, &ival, sizeof(ival));
+                ct_db_tek_add(tek, ival);
+            }
+            ct_db_tick(ival);
+            for (uint32_t c = 0; c < DB_PF_CONTACTS; c++) {
+                memset(rpi, 0, sizeof(rpi));
+                memcpy(&rpi[0], &c, sizeof(c));
+                memcpy(&rpi[4], &ival, sizeof(ival));
+                ct_db_rpi_add(rpi, aem, -60, ival);
+            }
+            ival++;
+        }
+
+        // Reboot: RPIs in RAM are lost, RPIs written to flash should remain.
+        //  Expired sectors are dropped by the first tick.
+        uint32_t expect = _db_flash_rpi_cnt;
+        fault_flash_reset();
+        _db_ival = 0;
+        zassert_equal(ct_db_init(), 0, "round %u: init failed", round);
+        ct_db_tick(ival - 1);
+
+        ct_db_rpi_get_cnt(&cnt);
+        zassert_equal(cnt, expect, "round %u: %u/%u RPIs reloaded",
+                        round, cnt, expect);
+
+        for (uint32_t n = 0; n < cnt; n++) {
+            db_rpi_t elm;
+            zassert_equal(ct_db_flash_rpi_get(n, &elm), 0,
+                            "round %u: RPI %u corrupt", round, n);
+        }
+    }
+
+    // Torn records remain in flash until their sector is reused.
+    TC_PRINT("%u rounds, %u torn records in flash\n", DB_PF_ROUNDS,
+                    _db_flash_torn);
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// A clear starts a new generation, which is stored in flash by the header of
+//  the next sector. Clearing the TEKs should survive a reboot, also when that
+//  header could not be written.
+#define DB_CP_IVAL_START  2800000
+#define DB_CP_DAYS        3
+
+static void test_db_clear_persist(void)
+{
+    uint8_t tek[TEK_SIZE];
+    uint32_t ival = DB_CP_IVAL_START;
+    uint16_t cnt;
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+
+    for (uint32_t day = 0; day < DB_CP_DAYS; day++) {
+        ival = DB_CP_IVAL_START + (day * 144);
+        memset(tek, 0, sizeof(tek));
+        memcpy(tek, &ival, sizeof(ival));
+        zassert_equal(ct_db_tek_add(tek, ival), 0, "TEK add failed");
+        ct_db_tick(ival);
+    }
+    ct_db_tek_get_cnt(&cnt);
+    zassert_equal(cnt, DB_CP_DAYS, "%u/%u TEKs stored", cnt, DB_CP_DAYS);
+
+    // The header of the new sector is lost.
+    fault_flash_arm(1, 0, true);
+    zassert_not_equal(ct_db_tek_clear(), 0, "header write not failed");
+    zassert_true(fault_flash_fired(), "no fault injected");
+    ct_db_tek_get_cnt(&cnt);
+    zassert_equal(cnt, 0, "%u TEKs after clear", cnt);
+
+    // Reboot: ct_priv survives, as if loaded from settings.
+    fault_flash_reset();
+    _db_ival = 0;
+    zassert_equal(ct_db_init(), 0, "init failed");
+    ct_db_tick(ival);
+    ct_db_tek_get_cnt(&cnt);
+    zassert_equal(cnt, 0, "%u cleared TEKs restored after reboot", cnt);
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Snapshot: while an export is running EN keeps adding RPIs, more than the
+//  local buffer holds. RPIs should still be pushed to flash, keep their index
+//  and be updated instead of stored twice.
+#define DB_SN_IVAL_START  2900000
+#define DB_SN_IVALS       12
+#define DB_SN_CONTACTS    100
+
+static void db_sn_rpi(uint8_t *rpi, uint32_t c, uint32_t ival)
+{
+    memset(rpi, 0, RPI_SIZE);
+    memcpy(&rpi[0], &c, sizeof(c));
+    memcpy(&rpi[4], &ival, sizeof(ival));
+}
+
+static void test_db_snapshot(void)
+{
+    static uint8_t snap[DB_SN_CONTACTS][RPI_SIZE];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    int8_t rssi;
+    uint8_t obs;
+    uint32_t ival_last;
+    uint32_t ival = DB_SN_IVAL_START;
+    uint32_t snap_cnt;
+    uint32_t cnt;
+
+    memset(aem, 0, sizeof(aem));
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+
+    ct_db_tick(ival);
+    for (uint32_t c = 0; c < DB_SN_CONTACTS; c++) {
+        db_sn_rpi(rpi, c, ival);
+        zassert_equal(ct_db_rpi_add(rpi, aem, -60, ival), 0, "add failed");
+    }
+
+    zassert_equal(ct_db_snapshot_begin(), 0, "snapshot failed");
+    ct_db_rpi_get_cnt(&snap_cnt);
+    zassert_equal(snap_cnt, DB_SN_CONTACTS, "%u RPIs in snapshot", snap_cnt);
+    for (uint32_t n = 0; n < snap_cnt; n++) {
+        zassert_equal(ct_db_rpi_get(n, snap[n], aem, &rssi, &obs, &ival_last),
+                        0, "get %u failed", n);
+    }
+
+    for (uint32_t i = 1; i <= DB_SN_IVALS; i++) {
+        ival++;
+        ct_db_tick(ival);
+        for (uint32_t c = 0; c < DB_SN_CONTACTS; c++) {
+            db_sn_rpi(rpi, c, ival);
+            zassert_equal(ct_db_rpi_add(rpi, aem, -60, ival), 0,
+                            "ival %u: add failed", i);
+        }
+        // RPIs of the snapshot are observed again.
+        if (i == 1) {
+            for (uint32_t c = 0; c < DB_SN_CONTACTS; c++) {
+                db_sn_rpi(rpi, c, DB_SN_IVAL_START);
+                zassert_equal(ct_db_rpi_add(rpi, aem, -60, ival), 0,
+                                "update failed");
+            }
+        }
+    }
+
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(cnt, snap_cnt + (DB_SN_IVALS * DB_SN_CONTACTS),
+                    "%u RPIs stored", cnt);
+    zassert_true(_db_flash_rpi_cnt >= snap_cnt, "RPIs not pushed to flash");
+
+    for (uint32_t n = 0; n < snap_cnt; n++) {
+        zassert_equal(ct_db_rpi_get(n, rpi, aem, &rssi, &obs, &ival_last), 0,
+                        "get %u failed", n);
+        zassert_mem_equal(rpi, snap[n], RPI_SIZE, "RPI %u moved", n);
+        zassert_equal(obs, 2, "RPI %u: %u observations", n, obs);
+    }
+
+    // A clear starts its sector right away. Clearing TEKs keeps the RPIs of
+    //  the snapshot, clearing RPIs removes them and RPIs stored after the
+    //  clear follow them.
+    uint32_t seq = _db_flash_seq;
+    zassert_equal(ct_db_tek_clear(), 0, "TEK clear failed");
+    zassert_equal(_db_flash_seq, seq + 1, "TEK clear postponed");
+    for (uint32_t n = 0; n < snap_cnt; n++) {
+        zassert_equal(ct_db_rpi_get(n, rpi, aem, &rssi, &obs, &ival_last), 0,
+                        "get %u failed after TEK clear", n);
+        zassert_mem_equal(rpi, snap[n], RPI_SIZE, "RPI %u moved", n);
+    }
+
+    zassert_equal(ct_db_rpi_clear(), 0, "RPI clear failed");
+    zassert_equal(_db_flash_seq, seq + 2, "RPI clear postponed");
+    for (uint32_t n = 0; n < cnt; n++) {
+        zassert_equal(ct_db_rpi_get(n, rpi, aem, &rssi, &obs, &ival_last),
+                        -ENODATA, "RPI %u kept after RPI clear", n);
+    }
+
+    db_sn_rpi(rpi, 0, ival + 1);
+    zassert_equal(ct_db_rpi_add(rpi, aem, -60, ival), 0, "add failed");
+    zassert_equal(ct_db_rpi_get(cnt, snap[0], aem, &rssi, &obs, &ival_last), 0,
+                    "new RPI not found");
+    zassert_mem_equal(rpi, snap[0], RPI_SIZE, "new RPI moved");
+
+    zassert_equal(ct_db_snapshot_end(), 0, "snapshot release failed");
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(cnt, 1, "%u RPIs after clear", cnt);
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Scrubbing: a transient read error should not quarantine a sector, while a
+//  corrupt RPI in flash quarantines its sector and the valid RPIs of that
+//  sector are kept.
+#define DB_SC_IVAL_START  3000000
+#define DB_SC_RPIS        150
+#define DB_SC_BAD_SLOT    5
+
+static void test_db_scrub(void)
+{
+    ct_db_integrity_t before;
+    ct_db_integrity_t after;
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    static bool found[DB_SC_RPIS];
+    int8_t rssi;
+    uint8_t obs;
+    uint32_t ival_last;
+    uint32_t ival = DB_SC_IVAL_START;
+    uint32_t cnt;
+
+    memset(aem, 0, sizeof(aem));
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+
+    ct_db_tick(ival);
+    for (uint32_t c = 0; c < DB_SC_RPIS; c++) {
+        db_sn_rpi(rpi, c, ival);
+        zassert_equal(ct_db_rpi_add(rpi, aem, -60, ival), 0, "add failed");
+    }
+    ct_db_tick(ival + CT_DB_IVAL_DIFF_OLD + 1);
+    zassert_equal(_db_flash_rpi_cnt, DB_SC_RPIS, "%u RPIs in flash",
+                    _db_flash_rpi_cnt);
+
+    // Transient: each first read of a sector is corrupt.
+    ct_db_get_integrity(&before);
+    fault_flash_corrupt_reads(1);
+    zassert_equal(ct_db_scrub(CT_FLASH_SECTOR_COUNT), 0, "scrub failed");
+    ct_db_get_integrity(&after);
+    zassert_equal(after.errors, before.errors, "transient error condemned");
+    zassert_equal(after.quarantined, before.quarantined, "sector quarantined");
+
+    // Persistent: an RPI of the full sector is corrupt in flash.
+    uint32_t sector = _db_flash_order[0];
+    uint32_t zero   = 0;
+    zassert_equal(_db_flash_toc[sector].cnt, CT_FLASH_SECTOR_RPIS,
+                    "first sector not full");
+    zassert_equal(db_flash_write(CT_FLASH_RPI_ADDR(sector, DB_SC_BAD_SLOT),
+                    &zero, sizeof(zero)), 0, "corrupting failed");
+
+    zassert_equal(ct_db_scrub(CT_FLASH_SECTOR_COUNT), 0, "scrub failed");
+    ct_db_get_integrity(&after);
+    zassert_equal(after.errors, before.errors + 1, "error not detected");
+    zassert_equal(after.quarantined, before.quarantined + 1,
+                    "sector not quarantined");
+    zassert_equal(after.relocated - before.relocated,
+                    CT_FLASH_SECTOR_RPIS - 1, "%u RPIs relocated",
+                    after.relocated - before.relocated);
+    zassert_true(atomic_test_bit(_db_flash_quar, sector), "not marked");
+
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(cnt, DB_SC_RPIS - 1, "%u RPIs kept", cnt);
+    memset(found, 0, sizeof(found));
+    for (uint32_t n = 0; n < cnt; n++) {
+        uint32_t c;
+        zassert_equal(ct_db_rpi_get(n, rpi, aem, &rssi, &obs, &ival_last), 0,
+                        "get %u failed", n);
+        memcpy(&c, rpi, sizeof(c));
+        zassert_true(c < DB_SC_RPIS, "unknown RPI");
+        found[c] = true;
+    }
+    for (uint32_t c = 0; c < DB_SC_RPIS; c++) {
+        zassert_equal(found[c], c != DB_SC_BAD_SLOT, "RPI %u", c);
+    }
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Version 0: sectors of the first firmware, without format, are read as they
+//  are. They precede new sectors in order of their interval.
+#define DB_V0_IVAL_START  3050000
+#define DB_V0_RPIS_NEW    10
+
+static void db_v0_sector(uint32_t sector, uint32_t ival, uint32_t rpis)
+{
+    db_flash_v0_hdr_t hdr;
+    db_flash_v0_rpi_t rec;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.ival     = ival;
+    hdr.tek.ival = ival;
+    zassert_equal(db_flash_write(sector * CT_FLASH_SECTOR_SIZE, &hdr,
+                    sizeof(hdr)), 0, "header write failed");
+
+    for (uint32_t slot = 0; slot < rpis; slot++) {
+        memset(&rec, 0, sizeof(rec));
+        rec.ival_first = ival;
+        rec.ival_last  = ival;
+        db_sn_rpi(rec.rpi, slot, ival);
+        rec.rssi       = -60;
+        rec.cnt        = 3;
+        zassert_equal(db_flash_write(CT_FLASH_V0_RPI_ADDR(sector, slot), &rec,
+                        sizeof(rec)), 0, "RPI write failed");
+    }
+}
+
+static void test_db_v0(void)
+{
+    static ct_db_rpi_export_t exp[CT_DB_EXPORT_BUF_SIZE /
+                    sizeof(ct_db_rpi_export_t)];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    int8_t rssi;
+    uint8_t obs;
+    uint32_t ival_last;
+    uint32_t cnt;
+    uint32_t c;
+    uint16_t n_exp;
+    uint16_t teks;
+
+    // Flash as left by the first firmware: the newer sector comes first.
+    zassert_equal(db_flash_erase(0, CT_FLASH_MEMORY_SIZE), 0, "erase failed");
+    ct_priv.db_gen_rpi = 0;
+    ct_priv.db_gen_tek = 0;
+    db_v0_sector(1, DB_V0_IVAL_START + 1, DB_V0_RPIS_NEW);
+    db_v0_sector(3, DB_V0_IVAL_START, CT_FLASH_V0_RPIS);
+
+    _db_ival = 0;
+    zassert_equal(ct_db_init(), 0, "init failed");
+    zassert_true(_db_flash_toc[1].v0 && _db_flash_toc[3].v0, "not version 0");
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(cnt, CT_FLASH_V0_RPIS + DB_V0_RPIS_NEW, "%u RPIs", cnt);
+    ct_db_tek_get_cnt(&teks);
+    zassert_equal(teks, 2, "%u TEKs", teks);
+
+    zassert_equal(ct_db_rpi_get(CT_FLASH_V0_RPIS, rpi, aem, &rssi, &obs,
+                    &ival_last), 0, "get failed");
+    memcpy(&c, rpi, sizeof(c));
+    zassert_equal(c, 0, "RPI %u out of order", c);
+    zassert_equal(ival_last, DB_V0_IVAL_START + 1, "ival %u", ival_last);
+    zassert_true((rssi == -60) && (obs == 3), "RSSI %d, %u observations",
+                    rssi, obs);
+
+    // Exported in bulk, with the statistics derived from the average.
+    zassert_equal(ct_db_rpi_export(0, (uint8_t*)exp, sizeof(exp), &n_exp), 0,
+                    "export failed");
+    zassert_true(n_exp > 0, "nothing exported");
+    for (uint16_t i = 0; i < n_exp; i++) {
+        memcpy(&c, exp[i].rpi, sizeof(c));
+        zassert_equal(c, i, "RPI %u out of order", c);
+        zassert_true((exp[i].rssi == -60) && (exp[i].rssi_max == -60) &&
+                        (exp[i].cnt == 3), "RPI %u statistics", i);
+        zassert_equal(exp[i].att[ct_db_att_bucket(-60)], 3, "RPI %u buckets", i);
+    }
+
+    // New RPIs follow in a sector of the current format.
+    uint32_t ival = DB_V0_IVAL_START + 2;
+    memset(aem, 0, sizeof(aem));
+    ct_db_tick(ival);
+    db_sn_rpi(rpi, 0, ival);
+    zassert_equal(ct_db_rpi_add(rpi, aem, -50, ival), 0, "add failed");
+    ct_db_tick(ival + CT_DB_IVAL_DIFF_OLD + 1);
+    zassert_equal(ct_db_rpi_get(cnt, rpi, aem, &rssi, &obs, &ival_last), 0,
+                    "get failed");
+    zassert_true((ival_last == ival) && (rssi == -50), "new RPI not last");
+
+    // Scrubbing skips version 0 sectors.
+    ct_db_integrity_t before;
+    ct_db_integrity_t after;
+    ct_db_get_integrity(&before);
+    zassert_equal(ct_db_scrub(CT_FLASH_SECTOR_COUNT), 0, "scrub failed");
+    ct_db_get_integrity(&after);
+    zassert_equal(after.errors, before.errors, "version 0 sector condemned");
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Sectors written with CONFIG_CT_DB_ENCOUNTERS toggled (DB_FLASH_FORMAT_ALT)
+//  are read as they are: their RPIs and TEKs are kept.
+#define DB_ALT_IVAL_START  3070000
+#define DB_ALT_RPIS_NEW    10
+
+static void db_alt_sector(uint32_t sector, uint32_t seq, uint32_t ival,
+                uint32_t rpis)
+{
+    db_flash_hdr_t hdr;
+    db_flash_alt_rpi_t rec;
+    db_rpi_t rpi;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.format   = DB_FLASH_FORMAT_ALT;
+    hdr.ival     = ival;
+    hdr.seq      = seq;
+    hdr.tek.ival = ival;
+    hdr.crc      = DB_FLASH_HDR_CRC(&hdr);
+    zassert_equal(db_flash_write(sector * CT_FLASH_SECTOR_SIZE, &hdr,
+                    sizeof(hdr)), 0, "header write failed");
+
+    for (uint32_t slot = 0; slot < rpis; slot++) {
+        memset(&rpi, 0, sizeof(rpi));
+        rpi.ival_first = ival;
+        rpi.ival_last  = ival;
+        db_sn_rpi(rpi.rpi, slot, ival);
+        rpi.cnt        = 3;
+        rpi.rssi_max   = -60;
+        rpi.rssi_sum   = -180;
+        rpi.att[ct_db_att_bucket(-60)] = 3;
+        // Encounter of an RPI linked to another one, when stored.
+        memset(&rec, 0xA5, sizeof(rec));
+        memcpy(rec.rpi, &rpi, MIN(sizeof(rpi), DB_RPI_ALT_SIZE));
+        rec.crc = DB_FLASH_ALT_RPI_CRC(&rec);
+        zassert_equal(db_flash_write(CT_FLASH_ALT_RPI_ADDR(sector, slot), &rec,
+                        sizeof(rec)), 0, "RPI write failed");
+    }
+}
+
+static void test_db_alt_format(void)
+{
+    static ct_db_rpi_export_t exp[CT_DB_EXPORT_BUF_SIZE /
+                    sizeof(ct_db_rpi_export_t)];
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+    int8_t rssi;
+    uint8_t obs;
+    uint32_t ival_last;
+    uint32_t cnt;
+    uint32_t c;
+    uint16_t n_exp;
+    uint16_t teks;
+
+    zassert_equal(db_flash_erase(0, CT_FLASH_MEMORY_SIZE), 0, "erase failed");
+    ct_priv.db_gen_rpi = 0;
+    ct_priv.db_gen_tek = 0;
+    db_alt_sector(2, 0, DB_ALT_IVAL_START, CT_FLASH_ALT_RPIS);
+    db_alt_sector(0, 1, DB_ALT_IVAL_START + 1, DB_ALT_RPIS_NEW);
+
+    _db_ival = 0;
+    zassert_equal(ct_db_init(), 0, "init failed");
+    zassert_true(_db_flash_toc[0].alt && _db_flash_toc[2].alt,
+                    "not of the other format");
+    ct_db_rpi_get_cnt(&cnt);
+    zassert_equal(cnt, CT_FLASH_ALT_RPIS + DB_ALT_RPIS_NEW, "%u RPIs", cnt);
+    ct_db_tek_get_cnt(&teks);
+    zassert_equal(teks, 2, "%u TEKs", teks);
+
+    zassert_equal(ct_db_rpi_get(CT_FLASH_ALT_RPIS, rpi, aem, &rssi, &obs,
+                    &ival_last), 0, "get failed");
+    memcpy(&c, rpi, sizeof(c));
+    zassert_equal(c, 0, "RPI %u out of order", c);
+    zassert_equal(ival_last, DB_ALT_IVAL_START + 1, "ival %u", ival_last);
+    zassert_equal(obs, 3, "%u observations", obs);
+
+    // Exported in bulk, each RPI its own encounter.
+    zassert_equal(ct_db_rpi_export(0, (uint8_t*)exp, sizeof(exp), &n_exp), 0,
+                    "export failed");
+    zassert_equal(n_exp, CT_FLASH_ALT_RPIS, "%u exported", n_exp);
+    for (uint16_t i = 0; i < n_exp; i++) {
+        memcpy(&c, exp[i].rpi, sizeof(c));
+        zassert_equal(c, i, "RPI %u out of order", c);
+        zassert_true((exp[i].rssi_max == -60) && (exp[i].cnt == 3),
+                        "RPI %u statistics", i);
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+        zassert_equal(exp[i].enc, c, "RPI %u linked", i);
+#endif
+    }
+
+    // New RPIs follow in a sector of the current format.
+    uint32_t ival = DB_ALT_IVAL_START + 2;
+    memset(aem, 0, sizeof(aem));
+    ct_db_tick(ival);
+    db_sn_rpi(rpi, 0, ival);
+    zassert_equal(ct_db_rpi_add(rpi, aem, -50, ival), 0, "add failed");
+    ct_db_tick(ival + CT_DB_IVAL_DIFF_OLD + 1);
+    zassert_equal(ct_db_rpi_get(cnt, rpi, aem, &rssi, &obs, &ival_last), 0,
+                    "get failed");
+    zassert_true((ival_last == ival) && (rssi == -50), "new RPI not last");
+
+    // Scrubbing skips sectors of the other format.
+    ct_db_integrity_t before;
+    ct_db_integrity_t after;
+    ct_db_get_integrity(&before);
+    zassert_equal(ct_db_scrub(CT_FLASH_SECTOR_COUNT), 0, "scrub failed");
+    ct_db_get_integrity(&after);
+    zassert_equal(after.errors, before.errors, "sector condemned");
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+}
+
+// Encounters: a new RPI is linked to the previous RPI of a nearby device, when
+//  that RPI stopped being seen before the new RPI appeared. Each RPI keeps its
+//  own record, and links survive pushing RPIs to flash.
+#define DB_EN_IVAL_START  3100000
+
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+static void db_en_add(uint8_t id, int8_t rssi, uint32_t ival)
+{
+    uint8_t rpi[RPI_SIZE];
+    uint8_t aem[AEM_SIZE];
+
+    memset(rpi, id, sizeof(rpi));
+    memset(aem, id, sizeof(aem));
+    zassert_equal(ct_db_rpi_add(rpi, aem, rssi, ival), 0, "add %u failed", id);
+}
+
+// Encounter of RPI 'id', as exported.
+static uint32_t db_en_get(uint8_t id)
+{
+    static ct_db_rpi_export_t exp[CT_DB_EXPORT_BUF_SIZE /
+                    sizeof(ct_db_rpi_export_t)];
+    uint32_t cnt;
+    uint16_t n_exp;
+
+    ct_db_rpi_get_cnt(&cnt);
+    for (uint32_t n = 0; n < cnt; n += n_exp) {
+        zassert_equal(ct_db_rpi_export(n, (uint8_t*)exp, sizeof(exp), &n_exp),
+                        0, "export %u failed", n);
+        for (uint16_t i = 0; i < n_exp; i++) {
+            if (exp[i].rpi[0] == id) {
+                zassert_equal(exp[i].aem[0], id, "RPI %u: AEM lost", id);
+                return exp[i].enc;
+            }
+        }
+    }
+    zassert_unreachable("RPI %u not found", id);
+    return 0;
+}
+
+// Encounter started by RPI 'id'.
+#define DB_EN_ID(id)  ((uint32_t)(id) * 0x01010101)
+#endif
+
+static void test_db_encounters(void)
+{
+#if defined(CONFIG_CT_DB_ENCOUNTERS)
+    uint32_t ival = DB_EN_IVAL_START;
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+    ct_db_tick(ival);
+
+    // 1 rotates to 2, while 3 and 4 are on air together.
+    db_en_add(1, -60, ival);
+    db_en_add(3, -80, ival);
+    k_sleep(K_SECONDS(2));
+    db_en_add(2, -61, ival);
+    db_en_add(3, -80, ival);
+    db_en_add(4, -80, ival);
+    zassert_equal(db_en_get(2), DB_EN_ID(1), "rotation not linked");
+    zassert_equal(db_en_get(4), DB_EN_ID(4), "linked while both seen");
+
+    // 2 rotates to 7 in the next interval, continuing the encounter of 1.
+    ival++;
+    ct_db_tick(ival);
+    k_sleep(K_SECONDS(2));
+    db_en_add(7, -59, ival);
+    zassert_equal(db_en_get(7), DB_EN_ID(1), "encounter not continued");
+
+    // 5 rotates to 6, but 5 is seen again.
+    db_en_add(5, -70, ival);
+    k_sleep(K_SECONDS(2));
+    db_en_add(6, -70, ival);
+    zassert_equal(db_en_get(6), DB_EN_ID(5), "rotation not linked");
+    k_sleep(K_SECONDS(1));
+    db_en_add(5, -70, ival);
+    zassert_equal(db_en_get(6), DB_EN_ID(6), "not unlinked");
+
+    // Links are kept in flash.
+    ct_db_tick(ival + CT_DB_IVAL_DIFF_OLD + 1);
+    zassert_equal(_db_rpi_cnt, 0, "RPIs not pushed to flash");
+    zassert_equal(db_en_get(1), DB_EN_ID(1), "encounter lost");
+    zassert_equal(db_en_get(2), DB_EN_ID(1), "encounter lost");
+    zassert_equal(db_en_get(7), DB_EN_ID(1), "encounter lost");
+    zassert_equal(db_en_get(6), DB_EN_ID(6), "encounter lost");
+
+    zassert_equal(ct_db_clear(), 0, "clear failed");
+#else
+    ztest_test_skip();
+#endif
+}
+
+void test_main(void)
+{
+    ct_priv.tek_rolling_period = CT_DEFAULT_TEK_PERIOD;
+    memcpy(ct_priv.att_thresholds, CT_DEFAULT_ATT_THRESHOLDS,
+                    sizeof(ct_priv.att_thresholds));
+
+    zassert_equal(ct_db_init(), 0, "init failed");
+
+    ztest_test_suite(ct_db,
+            ztest_unit_test(test_db_workload),
+            ztest_unit_test(test_db_power_fail),
+            ztest_unit_test(test_db_clear_persist),
+            ztest_unit_test(test_db_snapshot),
+            ztest_unit_test(test_db_scrub),
+            ztest_unit_test(test_db_v0),
+            ztest_unit_test(test_db_alt_format),
+            ztest_unit_test(test_db_encounters)
+            );
+    ztest_run_test_suite(ct_db);
+}
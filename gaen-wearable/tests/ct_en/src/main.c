@@ -0,0 +1,340 @@
+/*
+ * This file is part of the Contact Tracing / GAEN Wearable distribution
+ *        https://github.com/Sendrato/gaen-wearable.
+ *
+ * Copyright (c) 2020 Vincent van der Locht (https://www.synchronicit.nl/)
+ *                    Hessel van der Molen  (https://sendrato.com/)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License along
+ * with this program. If not, see <https://www.gnu.org/licenses/agpl-3.0.txt>.
+ */
+
+/**
+ * @file
+ * @brief Tests of the EN application state machine.
+ *
+ * ct_app_en.c is included, so the tests can drive its states and events
+ * directly. Bluetooth, the database, the clock and the battery are faked, so
+ * the tests check what is sent to the controller.
+ */
+
+#include <ztest.h>
+
+// Bluetooth is not enabled, the controller is faked below.
+#define CONFIG_BT_ID_MAX  2
+
+#include "ct_app_en.c"
+
+struct ct_settings ct_priv;
+
+/************* FAKES ***************/
+
+static bool     _fake_adv_on;
+static uint32_t _fake_adv_starts;
+static bool     _fake_scan_on;
+static bool     _fake_trusted;
+static uint32_t _fake_sec;
+static uint32_t _fake_invalid_clock;
+static uint32_t _fake_batt_empty;
+static int      _fake_batt_mV = -ENODEV;
+static unsigned int _fake_batt_pptt = 10000;
+static ct_time_sync_cb_t _fake_sync_cb;
+
+int bt_le_adv_start(const struct bt_le_adv_param *param,
+            const struct bt_data *ad, size_t ad_len,
+            const struct bt_data *sd, size_t sd_len)
+{
+    _fake_adv_on = true;
+    _fake_adv_starts++;
+    return 0;
+}
+
+int bt_le_adv_stop(void)
+{
+    _fake_adv_on = false;
+    return 0;
+}
+
+int bt_le_scan_start(const struct bt_le_scan_param *param, bt_le_scan_cb_t cb)
+{
+    _fake_scan_on = true;
+    return 0;
+}
+
+int bt_le_scan_stop(void)
+{
+    _fake_scan_on = false;
+    return 0;
+}
+
+int bt_id_create(bt_addr_le_t *addr, uint8_t *irk)
+{
+    return 1;
+}
+
+void bt_id_get(bt_addr_le_t *addrs, size_t *count)
+{
+    *count = 2;
+}
+
+int bt_id_reset(uint8_t id, bt_addr_le_t *addr, uint8_t *irk)
+{
+    return id;
+}
+
+void ct_time_get(struct timespec *ts)
+{
+    ts->tv_sec  = _fake_sec;
+    ts->tv_nsec = 0;
+}
+
+void ct_time_set(const struct timespec *ts)
+{
+    _fake_sec = ts->tv_sec;
+}
+
+ct_time_source_t ct_time_get_source(void)
+{
+    return CT_TIME_SYNCED;
+}
+
+bool ct_time_is_trusted(void)
+{
+    return _fake_trusted;
+}
+
+void ct_time_set_sync_callback(ct_time_sync_cb_t cb)
+{
+    _fake_sync_cb = cb;
+}
+
+int ct_db_tick(uint32_t ival)
+{
+    return 0;
+}
+
+int ct_db_tek_add(uint8_t *tek, uint32_t ival)
+{
+    return 0;
+}
+
+int ct_db_tek_get_last(uint8_t *tek, uint32_t *ival)
+{
+    return -ENOENT;
+}
+
+int ct_db_rpi_add(uint8_t *rpi, uint8_t *aem, int8_t rssi, uint32_t ival)
+{
+    return 0;
+}
+
+int ct_db_rpi_get_cnt(uint32_t *cnt)
+{
+    *cnt = 0;
+    return 0;
+}
+
+const struct battery_level_point lipo[] = {
+    { 10000, 4200 },
+    { 0,     3000 },
+};
+
+// A sample completes right away.
+int battery_sample_async(battery_sample_cb_t done)
+{
+    if (_fake_batt_mV < 0) {
+        return _fake_batt_mV;
+    }
+
+    done(_fake_batt_mV);
+    return 0;
+}
+
+int battery_get_mV(void)
+{
+    return _fake_batt_mV;
+}
+
+void battery_get_activity(uint32_t *cnt, uint64_t *us)
+{
+    *cnt = 0;
+    *us  = 0;
+}
+
+unsigned int battery_level_pptt(unsigned int batt_mV,
+                const struct battery_level_point *curve)
+{
+    return _fake_batt_pptt;
+}
+
+void ct_app_event(ct_app_id_t app, ct_event_t event)
+{
+    if (event == CT_EVENT_INVALID_CLOCK) {
+        _fake_invalid_clock++;
+    } else if (event == CT_EVENT_BATTERY_EMPTY) {
+        _fake_batt_empty++;
+    }
+}
+
+/************* TESTS ***************/
+
+static void en_test_evt(en_evt_id_t id, uint8_t gen)
+{
+    en_evt_t evt = {
+        .id    = id,
+        .gen   = gen,
+        .stamp = k_cycle_get_32(),
+    };
+
+    en_evt_handle(&evt);
+}
+
+// EN advertising and scanning with a trusted clock.
+static void en_test_start(void)
+{
+    _fake_trusted       = true;
+    _fake_sec           = CT_TIME_EPOCH_MIN + 1000000;
+    _fake_invalid_clock = 0;
+
+    en_test_evt(EN_EVT_START, 0);
+    app_en_state_start();
+    zassert_true(_fake_adv_on, "not advertising");
+    zassert_equal(_en_phase_next, app_en_state_scan, "no scan scheduled");
+
+    en_test_evt(EN_EVT_TIMER, _en_phase_gen);
+    zassert_true(_fake_scan_on, "not scanning");
+    zassert_true(_fake_adv_on, "not advertising");
+}
+
+// Nothing is sent or received while EN waits for a trusted clock, whatever
+//  event arrives.
+static void en_test_parked(void)
+{
+    uint32_t starts = _fake_adv_starts;
+
+    zassert_true(_en_parked, "not waiting for the clock");
+    zassert_false(_fake_adv_on, "advertising with an untrusted clock");
+    zassert_false(_fake_scan_on, "scanning with an untrusted clock");
+    zassert_is_null(_en_phase_next, "phase scheduled");
+    zassert_equal(_fake_invalid_clock, 1, "clock event not raised once");
+
+    _fake_sec += CT_DEFAULT_TEK_IVAL;
+    en_test_evt(EN_EVT_ROLL, 0);
+    en_test_evt(EN_EVT_BATTERY, 0);
+    en_test_evt(EN_EVT_SAMPLED, 0);
+    en_test_evt(EN_EVT_TIMER, _en_phase_gen);
+    en_test_evt(EN_EVT_TIMER, _en_phase_gen - 1);
+
+    zassert_equal(_fake_adv_starts, starts, "advertising restarted");
+    zassert_false(_fake_adv_on, "advertising with an untrusted clock");
+    zassert_false(_fake_scan_on, "scanning with an untrusted clock");
+
+    // A sync which leaves the clock untrusted (not expected) keeps waiting.
+    en_test_evt(EN_EVT_SYNCED, 0);
+    zassert_true(_en_parked, "resumed with an untrusted clock");
+    zassert_false(_fake_adv_on, "advertising with an untrusted clock");
+}
+
+// A sync resumes advertising with a new RPI.
+static void en_test_resume(void)
+{
+    uint32_t starts = _fake_adv_starts;
+
+    zassert_equal(_fake_sync_cb, en_clock_synced, "sync not registered");
+
+    _fake_trusted = true;
+    en_test_evt(EN_EVT_SYNCED, 0);
+    zassert_false(_en_parked, "still waiting for the clock");
+    zassert_true(_fake_adv_on, "not advertising");
+    zassert_equal(_fake_adv_starts, starts + 1, "RPI not rotated");
+    zassert_equal(_en_phase_next, app_en_state_scan, "no scan scheduled");
+
+    en_test_evt(EN_EVT_STOP, 0);
+    zassert_false(_fake_adv_on, "advertising after stop");
+}
+
+// The clock becomes untrusted during a scan period: the next advertisement
+//  period stops EN.
+void test_en_untrusted_adv(void)
+{
+    en_test_start();
+
+    _fake_trusted = false;
+    en_test_evt(EN_EVT_TIMER, _en_phase_gen);
+    en_test_parked();
+
+    en_test_resume();
+}
+
+// The clock becomes untrusted at an interval boundary: the RPI is not kept.
+void test_en_untrusted_roll(void)
+{
+    en_test_start();
+
+    _fake_trusted = false;
+    _fake_sec += CT_DEFAULT_TEK_IVAL;
+    en_test_evt(EN_EVT_ROLL, 0);
+    en_test_parked();
+
+    en_test_resume();
+}
+
+// Only new battery samples count towards an empty battery, not battery periods
+//  which report the filtered level again.
+void test_en_battery_empty(void)
+{
+    en_test_start();
+
+    _fake_batt_mV    = 3000;
+    _fake_batt_pptt  = 0;
+    _fake_batt_empty = 0;
+
+    for (int i = 0; i < 2 * CT_BATT_EMPTY_CNT; i++) {
+        en_test_evt(EN_EVT_BATTERY, 0);
+        en_test_evt(EN_EVT_SAMPLED, 0);
+    }
+    zassert_equal(_fake_batt_empty, 0, "empty without samples");
+
+    for (int i = 0; i < CT_BATT_EMPTY_CNT; i++) {
+        zassert_equal(_fake_batt_empty, 0, "empty after %d samples", i);
+        en_test_evt(EN_EVT_BATTERY, 0);
+        en_battery_sample();
+        en_test_evt(EN_EVT_SAMPLED, 0);
+    }
+    zassert_equal(_fake_batt_empty, 1, "empty not raised once");
+    zassert_true(_fake_adv_on, "advertising not resumed");
+
+    en_test_evt(EN_EVT_STOP, 0);
+    _fake_batt_mV   = -ENODEV;
+    _fake_batt_pptt = 10000;
+}
+
+void test_main(void)
+{
+    ct_priv.adv_period           = CT_DEFAULT_BT_ADV_PERIOD;
+    ct_priv.scan_period          = CT_DEFAULT_BT_SCAN_PERIOD;
+    ct_priv.adv_ival_min         = CT_DEFAULT_BT_ADV_IVAL_MIN;
+    ct_priv.adv_ival_max         = CT_DEFAULT_BT_ADV_IVAL_MAX;
+    ct_priv.scan_ival            = CT_DEFAULT_BT_SCAN_IVAL;
+    ct_priv.scan_window          = CT_DEFAULT_BT_SCAN_WINDOW;
+    ct_priv.tek_rolling_interval = CT_DEFAULT_TEK_IVAL;
+    ct_priv.tek_rolling_period   = CT_DEFAULT_TEK_PERIOD;
+
+    zassert_equal(ct_app_en_init(), 0, "init failed");
+
+    ztest_test_suite(ct_en,
+            ztest_unit_test(test_en_untrusted_adv),
+            ztest_unit_test(test_en_untrusted_roll),
+            ztest_unit_test(test_en_battery_empty)
+            );
+    ztest_run_test_suite(ct_en);
+}